@@ -0,0 +1,83 @@
+#include "acpi.h"
+#include "paging.h"     // For PHYS_TO_VIRT
+#include "string.h"
+#include "serialport.h"
+
+// Root System Description Pointer (ACPI 2.0+ layout; 1.0 stops at rsdt)
+typedef struct {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;           // First 20 bytes sum to 0
+    char oem_id[6];
+    uint8_t revision;           // 0: ACPI 1.0 (RSDT only), 2+: XSDT too
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;  // Whole structure sums to 0
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+#define RSDP_V1_SIZE 20
+
+static const acpi_sdt_header_t* root = NULL;
+static bool root_is_xsdt = false;
+
+static bool checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// Tables live in ACPI memory, which the HHDM covers like any other RAM
+static const void* acpi_map(uint64_t phys) {
+    return phys >= VIRTUAL_MEMORY_OFFSET ? (const void*)phys : PHYS_TO_VIRT(phys);
+}
+
+bool acpi_init(void* rsdp_ptr) {
+    if (rsdp_ptr == NULL) {
+        serial_write_string("ACPI: no RSDP\n");
+        return false;
+    }
+    const acpi_rsdp_t* rsdp = (const acpi_rsdp_t*)acpi_map((uint64_t)rsdp_ptr);
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !checksum_ok(rsdp, RSDP_V1_SIZE)) {
+        serial_write_string("ACPI: bad RSDP\n");
+        return false;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_address != 0 && checksum_ok(rsdp, rsdp->length)) {
+        root = (const acpi_sdt_header_t*)acpi_map(rsdp->xsdt_address);
+        root_is_xsdt = true;
+    } else {
+        root = (const acpi_sdt_header_t*)acpi_map(rsdp->rsdt_address);
+        root_is_xsdt = false;
+    }
+    if (!checksum_ok(root, root->length)) {
+        serial_write_string("ACPI: bad root table\n");
+        root = NULL;
+        return false;
+    }
+    serial_write_string(root_is_xsdt ? "ACPI: using the XSDT\n" : "ACPI: using the RSDT\n");
+    return true;
+}
+
+const acpi_sdt_header_t* acpi_find_table(const char* signature) {
+    if (root == NULL) {
+        return NULL;
+    }
+    // The root table is a header followed by 64-bit (XSDT) or 32-bit
+    // (RSDT) physical pointers; XSDT entries need not be 8-byte aligned
+    uint32_t entry_size = root_is_xsdt ? 8 : 4;
+    uint32_t count = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    const uint8_t* entries = (const uint8_t*)root + sizeof(acpi_sdt_header_t);
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = 0;
+        memcpy(&phys, entries + i * entry_size, entry_size);
+        const acpi_sdt_header_t* table = (const acpi_sdt_header_t*)acpi_map(phys);
+        if (memcmp(table->signature, signature, 4) == 0) {
+            return checksum_ok(table, table->length) ? table : NULL;
+        }
+    }
+    return NULL;
+}
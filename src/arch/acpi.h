@@ -0,0 +1,90 @@
+#ifndef __ACPI_H__
+#define __ACPI_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- ACPI Tables ---
+// Just enough of ACPI to find the firmware's tables (through the RSDP
+// the bootloader hands over) and read them through the HHDM.
+
+#ifdef _MSC_VER
+#pragma pack(push,1)
+#define PACKED
+#else
+#define PACKED __attribute__((packed))
+#endif
+
+// Common header of every system description table
+typedef struct {
+    char signature[4];
+    uint32_t length;            // Whole table, header included
+    uint8_t revision;
+    uint8_t checksum;           // All bytes of the table sum to 0
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} PACKED acpi_sdt_header_t;
+
+// MADT ("APIC"): the interrupt controllers. Variable-length entries,
+// each starting with a type and a length, follow this header.
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;             // Bit 0: the machine also has 8259 PICs
+} PACKED acpi_madt_t;
+
+#define MADT_TYPE_LAPIC           0
+#define MADT_TYPE_IOAPIC          1
+#define MADT_TYPE_ISO             2  // Interrupt source override
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} PACKED acpi_madt_entry_t;
+
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;           // Physical address of its registers
+    uint32_t gsi_base;          // First global system interrupt it handles
+} PACKED acpi_madt_ioapic_t;
+
+// An ISA IRQ wired to a different GSI, or with non-ISA polarity/trigger
+typedef struct {
+    acpi_madt_entry_t entry;
+    uint8_t bus;                // 0: ISA
+    uint8_t source;             // ISA IRQ
+    uint32_t gsi;
+    uint16_t flags;             // MADT_ISO_* polarity and trigger mode
+} PACKED acpi_madt_iso_t;
+
+#define MADT_ISO_POLARITY_MASK    0x3
+#define MADT_ISO_ACTIVE_LOW       0x3
+#define MADT_ISO_TRIGGER_MASK     0xC
+#define MADT_ISO_LEVEL            0xC
+
+#ifdef _MSC_VER
+#pragma pack(pop)
+#endif
+
+#undef PACKED
+
+/**
+ * @brief Finds the root table (XSDT, or RSDT on ACPI 1.0).
+ * @param rsdp The RSDP from the bootloader (physical or HHDM address).
+ * @return false if the RSDP or root table is missing or corrupt.
+ */
+bool acpi_init(void* rsdp);
+
+/**
+ * @brief Finds a table by its signature (e.g. "APIC").
+ * @return The table (through the HHDM), or NULL if there is none or its
+ * checksum is wrong.
+ */
+const acpi_sdt_header_t* acpi_find_table(const char* signature);
+
+#endif // __ACPI_H__
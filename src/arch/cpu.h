@@ -0,0 +1,149 @@
+#ifndef __CPU_H__
+#define __CPU_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Upper bound on the number of CPUs the kernel keeps per-CPU state for
+#define MAX_CPUS 16
+
+struct task;
+
+// Per-CPU data block. Each CPU's GS base points at its own, so the
+// fields below are one GS-relative load away.
+typedef struct cpu_local {
+    struct cpu_local* self;     // For cpu_local()
+    uint32_t id;                // Index into per-CPU arrays (0 = boot CPU)
+    uint32_t lapic_id;
+    struct task* current_task;  // See task_current()
+} cpu_local_t;
+
+extern cpu_local_t cpu_locals[MAX_CPUS];
+
+// Index of the CPU we are running on. A task may move to another CPU
+// when it is switched out, so keep interrupts off while the value is used.
+static inline unsigned int cpu_id(void) {
+    uint32_t id;
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(id) : "i"(offsetof(cpu_local_t, id)));
+    return id;
+}
+
+// This CPU's per-CPU data block
+static inline cpu_local_t* cpu_local(void) {
+    cpu_local_t* self;
+    __asm__ volatile ("movq %%gs:%c1, %0" : "=r"(self) : "i"(offsetof(cpu_local_t, self)));
+    return self;
+}
+
+// Disable interrupts and return the previous RFLAGS
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+// Restore the interrupt flag saved by irq_save()
+static inline void irq_restore(uint64_t flags) {
+    if (flags & 0x200) { // RFLAGS.IF
+        __asm__ volatile ("sti" ::: "memory");
+    }
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" ::: "memory");
+}
+
+// Read the Time-Stamp Counter (cycles since reset)
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Execute CPUID for the given leaf/subleaf
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                      : "a"(leaf), "c"(subleaf));
+}
+
+// Control register access
+static inline uint64_t read_cr0(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr0" :: "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr3(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr3" :: "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr4" :: "r"(value) : "memory");
+}
+
+// Model-specific registers
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+// Extended control registers (XCR0 selects the XSAVE state components)
+static inline uint64_t xgetbv(uint32_t xcr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(xcr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void xsetbv(uint32_t xcr, uint64_t value) {
+    __asm__ volatile ("xsetbv" :: "c"(xcr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+#define MSR_IA32_PAT 0x277
+#define MSR_IA32_APIC_BASE 0x1B
+#define MSR_GS_BASE  0xC0000101
+
+#define CR0_MP (1ull << 1)  // WAIT/FWAIT honour TS
+#define CR0_EM (1ull << 2)  // Emulate x87 (must be clear for SSE)
+#define CR0_TS (1ull << 3)  // Task switched: FPU/SSE use raises #NM
+#define CR0_NE (1ull << 5)  // Native x87 error reporting
+#define CR0_NW (1ull << 29) // Not write-through (must be clear with CD)
+#define CR0_CD (1ull << 30) // Cache disable
+
+#define CR4_PGE   (1ull << 7)  // Global pages survive CR3 writes
+#define CR4_OSFXSR     (1ull << 9)  // FXSAVE/FXRSTOR and SSE enabled
+#define CR4_OSXMMEXCPT (1ull << 10) // Unmasked SSE exceptions raise #XM
+#define CR4_PCIDE (1ull << 17) // CR3[11:0] holds a PCID that tags TLB entries
+#define CR4_OSXSAVE    (1ull << 18) // XSAVE and XCR0 enabled
+
+// With CR4.PCIDE, a CR3 write with this bit set keeps the new PCID's TLB entries
+#define CR3_NOFLUSH (1ull << 63)
+
+// Drop the TLB entry for one virtual address
+static inline void invlpg(uint64_t virt) {
+    __asm__ volatile ("invlpg (%0)" :: "r"(virt) : "memory");
+}
+
+#endif // __CPU_H__
@@ -0,0 +1,240 @@
+#include "fpu.h"
+#include "task.h"
+#include "slab.h"
+#include "cpu.h"
+#include "serialport.h"
+#include "string.h"
+
+// XCR0 state components
+#define XSTATE_X87       (1ull << 0)
+#define XSTATE_SSE       (1ull << 1)
+#define XSTATE_AVX       (1ull << 2)
+#define XSTATE_AVX512    (7ull << 5)  // Opmask, ZMM_Hi256, Hi16_ZMM
+
+#define FXSAVE_AREA_SIZE 512
+#define FPU_AREA_ALIGN   64           // XSAVE needs 64, FXSAVE 16
+
+// Initial values the legacy area gives a new task
+#define FPU_DEFAULT_FCW   0x037F      // All x87 exceptions masked
+#define FPU_DEFAULT_MXCSR 0x1F80      // All SSE exceptions masked
+#define FXSAVE_FCW_OFFSET   0
+#define FXSAVE_MXCSR_OFFSET 24
+
+// One CPU's view of its FPU registers. Only that CPU touches it, with
+// interrupts off.
+typedef struct {
+    struct task* owner; // Task whose state is loaded (CR0.TS clear), or NULL
+    bool ts;            // CR0.TS is set
+    bool in_irq;        // Between fpu_irq_enter() and fpu_irq_exit()
+    bool irq_set_ts;    // fpu_irq_enter() set TS over a loaded state
+    bool irq_used;      // The handler used the FPU, the owner was saved
+} fpu_cpu_t;
+
+static fpu_cpu_t fpu_cpus[MAX_CPUS];
+
+static fpu_mode_t fpu_mode = FPU_MODE_FXSAVE;
+static uint64_t fpu_xcr0 = 0;
+static uint32_t fpu_area_size = FXSAVE_AREA_SIZE;
+static kmem_cache_t* fpu_cache = NULL;
+
+// Counters, updated with atomics
+static uint64_t stat_traps = 0;
+static uint64_t stat_restores = 0;
+static uint64_t stat_saves = 0;
+static uint64_t stat_irq_saves = 0;
+
+static inline void set_ts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void clear_ts(void) {
+    __asm__ volatile ("clts" ::: "memory");
+}
+
+static void save_state(void* area) {
+    // Save every enabled component (EDX:EAX = requested-feature bitmap)
+    switch (fpu_mode) {
+    case FPU_MODE_XSAVEOPT:
+        __asm__ volatile ("xsaveopt64 (%0)" :: "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+        break;
+    case FPU_MODE_XSAVE:
+        __asm__ volatile ("xsave64 (%0)" :: "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+        break;
+    default:
+        __asm__ volatile ("fxsave64 (%0)" :: "r"(area) : "memory");
+        break;
+    }
+}
+
+static void restore_state(void* area) {
+    if (fpu_mode == FPU_MODE_FXSAVE) {
+        __asm__ volatile ("fxrstor64 (%0)" :: "r"(area) : "memory");
+    } else {
+        __asm__ volatile ("xrstor64 (%0)" :: "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+    }
+}
+
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    bool has_xsave = (ecx >> 26) & 1;
+    bool has_avx = (ecx >> 28) & 1;
+
+    if (has_xsave) {
+        // Enable the components this CPU supports (AVX-512 needs AVX)
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        uint64_t supported = ((uint64_t)edx << 32) | eax;
+        fpu_xcr0 = XSTATE_X87 | XSTATE_SSE;
+        if (has_avx && (supported & XSTATE_AVX)) {
+            fpu_xcr0 |= XSTATE_AVX;
+            if ((supported & XSTATE_AVX512) == XSTATE_AVX512) {
+                fpu_xcr0 |= XSTATE_AVX512;
+            }
+        }
+    }
+    fpu_init_cpu();
+
+    if (has_xsave) {
+        // EBX: save area size for the components now enabled
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_area_size = ebx;
+        cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+        fpu_mode = (eax & 1) ? FPU_MODE_XSAVEOPT : FPU_MODE_XSAVE;
+    }
+
+    fpu_cache = kmem_cache_create("fpu_state", fpu_area_size, FPU_AREA_ALIGN, NULL);
+    if (fpu_cache == NULL) {
+        serial_write_string("PANIC: Failed to create the FPU state cache!\n");
+        for (;;) __asm__ volatile ("cli; hlt");
+    }
+
+    static const char* mode_names[] = { "FXSAVE", "XSAVE", "XSAVEOPT" };
+    serial_write_string("FPU: lazy switching with ");
+    serial_write_string(mode_names[fpu_mode]);
+    serial_write_string((fpu_xcr0 & XSTATE_AVX) ? " (AVX state)\n" : "\n");
+}
+
+void fpu_init_cpu(void) {
+    // x87 native, SSE on
+    uint64_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+
+    uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (fpu_xcr0 != 0) {
+        cr4 |= CR4_OSXSAVE;
+    }
+    write_cr4(cr4);
+
+    if (fpu_xcr0 != 0) {
+        xsetbv(0, fpu_xcr0);
+    }
+    __asm__ volatile ("fninit");
+}
+
+void fpu_set_boot_owner(struct task* task) {
+    fpu_cpu_t* cpu = &fpu_cpus[cpu_id()];
+    cpu->owner = task;
+    cpu->ts = false; // fpu_init_cpu() cleared CR0.TS
+}
+
+void* fpu_state_alloc(void) {
+    uint8_t* area = (uint8_t*)kmem_cache_alloc(fpu_cache);
+    if (area == NULL) {
+        return NULL;
+    }
+    // A zeroed XSAVE header restores every component to its initial
+    // state; only the control words come from the legacy area
+    memset(area, 0, fpu_area_size);
+    *(uint16_t*)(area + FXSAVE_FCW_OFFSET) = FPU_DEFAULT_FCW;
+    *(uint32_t*)(area + FXSAVE_MXCSR_OFFSET) = FPU_DEFAULT_MXCSR;
+    return area;
+}
+
+void fpu_state_free(void* state) {
+    if (state != NULL) {
+        kmem_cache_free(fpu_cache, state);
+    }
+}
+
+// --- Lazy Switching ---
+
+void fpu_switch(struct task* prev) {
+    fpu_cpu_t* cpu = &fpu_cpus[cpu_id()];
+    if (cpu->owner == prev) {
+        save_state(prev->fpu_state);
+        cpu->owner = NULL;
+        __atomic_add_fetch(&stat_saves, 1, __ATOMIC_RELAXED);
+    }
+    if (!cpu->ts) {
+        set_ts();
+        cpu->ts = true;
+    }
+}
+
+void fpu_handle_nm(void) {
+    fpu_cpu_t* cpu = &fpu_cpus[cpu_id()];
+    clear_ts();
+    cpu->ts = false;
+    __atomic_add_fetch(&stat_traps, 1, __ATOMIC_RELAXED);
+
+    if (cpu->in_irq) {
+        // A handler wants the registers: put the task's state away first
+        if (cpu->owner != NULL) {
+            save_state(cpu->owner->fpu_state);
+            cpu->owner = NULL;
+            __atomic_add_fetch(&stat_irq_saves, 1, __ATOMIC_RELAXED);
+        }
+        cpu->irq_used = true;
+        return;
+    }
+
+    task_t* task = task_current();
+    if (task == NULL || task->fpu_state == NULL || cpu->owner == task) {
+        return; // Before tasking starts, the registers are free for all
+    }
+    if (cpu->owner != NULL) {
+        save_state(cpu->owner->fpu_state);
+        __atomic_add_fetch(&stat_saves, 1, __ATOMIC_RELAXED);
+    }
+    restore_state(task->fpu_state);
+    cpu->owner = task;
+    __atomic_add_fetch(&stat_restores, 1, __ATOMIC_RELAXED);
+}
+
+void fpu_irq_enter(void) {
+    fpu_cpu_t* cpu = &fpu_cpus[cpu_id()];
+    cpu->in_irq = true;
+    if (!cpu->ts) {
+        set_ts();
+        cpu->ts = true;
+        cpu->irq_set_ts = true;
+    }
+}
+
+void fpu_irq_exit(void) {
+    fpu_cpu_t* cpu = &fpu_cpus[cpu_id()];
+    cpu->in_irq = false;
+    if (cpu->irq_used) {
+        // The registers hold the handler's values: trap on the next use
+        set_ts();
+        cpu->ts = true;
+        cpu->irq_used = false;
+    } else if (cpu->irq_set_ts) {
+        // Untouched: hand the loaded state straight back
+        clear_ts();
+        cpu->ts = false;
+    }
+    cpu->irq_set_ts = false;
+}
+
+void fpu_get_info(fpu_info_t* info) {
+    info->mode = fpu_mode;
+    info->xcr0 = fpu_xcr0;
+    info->area_size = fpu_area_size;
+    info->traps = __atomic_load_n(&stat_traps, __ATOMIC_RELAXED);
+    info->restores = __atomic_load_n(&stat_restores, __ATOMIC_RELAXED);
+    info->saves = __atomic_load_n(&stat_saves, __ATOMIC_RELAXED);
+    info->irq_saves = __atomic_load_n(&stat_irq_saves, __ATOMIC_RELAXED);
+}
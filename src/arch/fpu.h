@@ -0,0 +1,84 @@
+#ifndef __FPU_H__
+#define __FPU_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- Lazy FPU/SSE/AVX State ---
+// Each task has a save area for its extended (x87/SSE/AVX) registers.
+// A task's state is loaded only when it first uses one of those
+// registers after being switched in: the scheduler sets CR0.TS, the
+// instruction raises #NM, and the handler restores the state and clears
+// TS. When the task is switched out its state is saved only if it was
+// loaded, so tasks that never touch vector registers pay nothing.
+//
+// Interrupt handlers run on the interrupted task's registers. They are
+// bracketed by fpu_irq_enter()/fpu_irq_exit(): if a handler uses vector
+// registers, the task's state is saved first and reloaded on its next use.
+
+struct task;
+
+typedef enum {
+    FPU_MODE_FXSAVE,    // x87 + SSE only (no XSAVE)
+    FPU_MODE_XSAVE,
+    FPU_MODE_XSAVEOPT,  // Skips components unchanged since the last restore
+} fpu_mode_t;
+
+// What fpu_init() found and how often the lazy paths ran
+typedef struct {
+    fpu_mode_t mode;
+    uint64_t xcr0;          // Enabled state components (0 without XSAVE)
+    uint32_t area_size;     // Bytes per task save area
+    uint64_t traps;         // #NM exceptions taken
+    uint64_t restores;      // Task states loaded
+    uint64_t saves;         // Task states saved at switch-out
+    uint64_t irq_saves;     // Task states saved because a handler used the FPU
+} fpu_info_t;
+
+/**
+ * @brief Enables SSE (and XSAVE with AVX where present) and creates the
+ * cache for per-task save areas. Call after heap_init(), before task_init().
+ */
+void fpu_init(void);
+
+/**
+ * @brief Same CPU setup on an application processor (after fpu_init()).
+ */
+void fpu_init_cpu(void);
+
+/**
+ * @brief Makes `task` the owner of the registers this CPU runs on now.
+ * task_init_cpu() calls it for the idle task that the boot context
+ * becomes, so its live state is saved on the first switch away.
+ */
+void fpu_set_boot_owner(struct task* task);
+
+/**
+ * @brief Returns a save area holding the initial state, or NULL if out of memory.
+ */
+void* fpu_state_alloc(void);
+
+void fpu_state_free(void* state);
+
+/**
+ * @brief Called by the scheduler right before switching away from
+ * `prev`: saves its state if it is loaded, and sets CR0.TS so the next
+ * task's first FPU/SSE instruction traps. Must not touch vector
+ * registers itself.
+ */
+void fpu_switch(struct task* prev) __attribute__((target("general-regs-only")));
+
+/**
+ * @brief The #NM (device not available) handler.
+ */
+void fpu_handle_nm(void);
+
+/**
+ * @brief Bracket interrupt handlers that may use vector registers.
+ */
+void fpu_irq_enter(void);
+void fpu_irq_exit(void);
+
+void fpu_get_info(fpu_info_t* info);
+
+#endif // __FPU_H__
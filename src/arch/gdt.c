@@ -1,5 +1,6 @@
 #include "gdt.h"        
 #include "serialport.h" 
+#include "cpu.h"          // For MAX_CPUS
 #include <stdint.h>
 
 
@@ -13,31 +14,49 @@
                          GDT_ACCESS_DESCTYPE(1) | GDT_ACCESS_RW | \
                          GDT_GRAN_4K_GRANULARITY)
 
-                         // Our GDT array (Global Descriptor Table)
-// It has 3 entries: Null, Kernel Code, Kernel Data
-uint64_t gdt[3];
+// One GDT per CPU: Null, Kernel Code, Kernel Data and the two halves
+// of the CPU's TSS descriptor
+#define GDT_ENTRIES 5
 
-// The GDT descriptor (GDTR) structure used by the lgdt instruction
-struct gdt_descriptor gdt_desc;
+static uint64_t gdts[MAX_CPUS][GDT_ENTRIES];
+static struct tss tss[MAX_CPUS];
 
-// This function sets up the GDT and loads it.
+// The GDT descriptors (GDTR) used by the lgdt instruction
+static struct gdt_descriptor gdt_descs[MAX_CPUS];
+
+// This function sets up the boot CPU's GDT and loads it.
 void gdt_init(void) {
     serial_write_string("Initializing GDT...\n");
+    gdt_init_cpu(0);
+    serial_write_string("GDT loaded!\n");
+}
+
+void gdt_init_cpu(unsigned int cpu) {
+    uint64_t* gdt = gdts[cpu];
 
     // Fill the GDT array with the correct entries
     gdt[0] = 0;                      // Entry 0: Null Descriptor (required)
     gdt[1] = GDT_KERNEL_CODE;        // Entry 1: Kernel Code Segment (Selector 0x08)
     gdt[2] = GDT_KERNEL_DATA;        // Entry 2: Kernel Data Segment (Selector 0x10)
 
+    // Entries 3-4: this CPU's TSS (Selector 0x18). No I/O bitmap.
+    tss[cpu].iomap_base = sizeof(struct tss);
+    uint64_t base = (uint64_t)&tss[cpu];
+    uint64_t limit = sizeof(struct tss) - 1;
+    gdt[3] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) | GDT_TYPE_TSS_AVAILABLE |
+             GDT_ACCESS_PRESENT | (((base >> 24) & 0xFF) << 56);
+    gdt[4] = base >> 32;
+
     // Prepare the GDT descriptor structure for the lgdt instruction
-    gdt_desc.limit = sizeof(gdt) - 1; // Limit is size - 1
-    gdt_desc.base = (uint64_t)&gdt[0]; // Base address of the GDT array
+    gdt_descs[cpu].limit = sizeof(gdts[cpu]) - 1; // Limit is size - 1
+    gdt_descs[cpu].base = (uint64_t)gdt;          // Base address of the GDT array
 
     // Load the GDT using the assembly function from gdt_asm.S
-    load_gdt(&gdt_desc);
+    load_gdt(&gdt_descs[cpu]);
 
     // Reload segment registers using the assembly function from gdt_asm.S
     reload_segments();
 
-    serial_write_string("GDT loaded!\n");
-}
\ No newline at end of file
+    // Load the task register (marks the descriptor busy)
+    __asm__ volatile ("ltr %w0" :: "r"(GDT_SELECTOR_TSS));
+}
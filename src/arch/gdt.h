@@ -16,6 +16,19 @@ struct gdt_descriptor {
     uint64_t base;
 } PACKED;
 
+// 64-bit Task State Segment. Only the stack pointers are used in long
+// mode: rsp0 for interrupts from user mode, ist[] for IDT entries that
+// ask for a known-good stack.
+struct tss {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} PACKED;
+
 #ifdef _MSC_VER
 #pragma pack(pop)
 #endif
@@ -30,14 +43,28 @@ struct gdt_descriptor {
 #define GDT_ACCESS_EXECUTABLE   (1ULL << 43) // Executable bit
 #define GDT_ACCESS_RW           (1ULL << 41) // Readable/Writable bit
 
+// System descriptor type for an available 64-bit TSS (16 bytes long)
+#define GDT_TYPE_TSS_AVAILABLE  (0x9ULL << 40)
+
+// Selectors
+#define GDT_SELECTOR_KERNEL_CODE 0x08
+#define GDT_SELECTOR_KERNEL_DATA 0x10
+#define GDT_SELECTOR_TSS         0x18
+
 // Granularity flags
 #define GDT_GRAN_LONG_MODE      (1ULL << 53) // Long mode (64-bit)
 #define GDT_GRAN_4K_GRANULARITY (1ULL << 55) // 4K granularity
 
 
-// Function to initialize the GDT
+// Function to initialize the GDT (boot CPU)
 void gdt_init(void);
 
+/**
+ * @brief Loads CPU `cpu`'s own GDT and TSS and reloads the segment
+ * registers. This clears the GS base, so set it afterwards.
+ */
+void gdt_init_cpu(unsigned int cpu);
+
 // Assembly functions
 extern void load_gdt(struct gdt_descriptor* desc);
 extern void reload_segments(void);
@@ -1,23 +1,14 @@
 #include "idt.h"
 #include "serialport.h" // For debugging
 #include <stddef.h>     // For NULL
-#include "pic.h"        // For pic_send_eoi()
+#include "irq.h"        // For irq_eoi()
 #include "io.h"         // For inb()
 #include "framebuffer.h"  // For fb_putchar
 #include "keyboard.h"     // For kbd_us_map
 #include "string.h"       // For strcmp
-#include "timer.h" 
 #include "kshell.h"      
-
-static volatile uint64_t ticks = 0;
-
-uint64_t get_ticks(void) {
-    return ticks;
-}
-
-void timer_tick(void) {
-    ticks++;
-}
+#include "fpu.h"          // For the #NM handler
+#include "lapic.h"        // For the local APIC vectors
 
 // --- Define the IDT array (256 entries) ---
 static struct InterruptDescriptor64 idt[256];
@@ -54,7 +45,12 @@ extern void* isr_stub_29;
 extern void* isr_stub_30;
 extern void* isr_stub_31;
 extern void* isr_stub_128; // For syscall (if needed)
+extern void* isr_stub_129; // Old-style switch, for 'switchbench'
 extern void* isr_stub_default;
+extern void* lapic_timer_stub;
+extern void* resched_ipi_stub;
+extern void* tlb_shootdown_stub;
+extern void* spurious_stub;
 
 // Array of stub pointers to make initialization easier
 static void* isr_stubs[] = {
@@ -110,7 +106,12 @@ void idt_set_descriptor(uint8_t vector, void* isr, uint8_t flags) {
 
 // Exception Message Strings
 void __attribute__((used))exception_handler(struct registers* regs) {
-    // (This function is unchanged)
+    // Device Not Available: a task touched the FPU with CR0.TS set
+    if (regs->int_no == 7) {
+        fpu_handle_nm();
+        return;
+    }
+
     serial_write_string("Exception triggered: ");
     if (regs->int_no < 10) {
         char c[2] = { (char)(regs->int_no + '0'), '\0' };
@@ -136,6 +137,9 @@ void __attribute__((used))exception_handler(struct registers* regs) {
 void __attribute__((used))irq_handler(struct registers* regs) {
     uint8_t irq = regs->int_no - 32;
 
+    // The shell (and anything else here) may use SSE registers
+    fpu_irq_enter();
+
     switch (irq) {
     case 1: // Keyboard (IRQ 1)
     {
@@ -171,8 +175,10 @@ void __attribute__((used))irq_handler(struct registers* regs) {
         break;
     }
 
-    // Send the End-of-Interrupt (EOI) signal to the PIC
-    pic_send_eoi(irq);
+    fpu_irq_exit();
+
+    // Send the End-of-Interrupt (EOI) signal to the PIC or local APIC
+    irq_eoi(irq);
 }
 
 // Initialize the IDT
@@ -209,6 +215,20 @@ void idt_init(void) {
     idt_set_descriptor(0x80, &isr_stub_128, syscall_flags);
     serial_write_string("Syscall vector 0x80 set with user flags (0xEE).\n");
 
+    // Switch benchmark vector: only kernel code raises it
+    idt_set_descriptor(SWITCH_BENCH_VECTOR, &isr_stub_129, flags);
+
+    // Local APIC: per-CPU timer, reschedule and TLB shootdown IPIs, spurious
+    idt_set_descriptor(LAPIC_TIMER_VECTOR, &lapic_timer_stub, flags);
+    idt_set_descriptor(RESCHED_VECTOR, &resched_ipi_stub, flags);
+    idt_set_descriptor(TLB_SHOOTDOWN_VECTOR, &tlb_shootdown_stub, flags);
+    idt_set_descriptor(LAPIC_SPURIOUS_VECTOR, &spurious_stub, flags);
+
     load_idt(&idt_desc);
     serial_write_string("IDT loaded!\n");
-}
\ No newline at end of file
+}
+
+// Application processors share the boot CPU's IDT
+void idt_load(void) {
+    load_idt(&idt_desc);
+}
@@ -35,6 +35,10 @@ struct idt_descriptor {
 
 #undef PACKED
 
+// Software interrupt 'switchbench' uses to replay the switch path from
+// before switch_context(): full interrupt frame, 22-word copy, iretq
+#define SWITCH_BENCH_VECTOR 0x81
+
 // This struct defines the stack frame pushed by our ISR/IRQ/Syscall stubs
 struct registers {
     // Pushed by 'common_stub'
@@ -52,6 +56,9 @@ struct registers {
 // The main function to set up the IDT
 void idt_init(void);
 
+// Loads the (already built) IDT on an application processor
+void idt_load(void);
+
 // Assembly function (in idt_asm.S) to load the IDT Register (IDTR) 
 extern void load_idt(struct idt_descriptor* desc);
 
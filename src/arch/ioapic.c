@@ -0,0 +1,180 @@
+#include "ioapic.h"
+#include "acpi.h"
+#include "vmm.h"
+#include "spinlock.h"
+#include "serialport.h"
+
+#define ISA_IRQS 16
+
+typedef struct {
+    volatile uint32_t* regs;
+    uint32_t gsi_base;
+    uint32_t gsi_count;         // Redirection entries
+} ioapic_t;
+
+static ioapic_t ioapics[IOAPIC_MAX];
+static uint32_t ioapic_count = 0;
+
+// ISA IRQ -> GSI and the polarity/trigger bits of its entry
+static uint32_t isa_gsi[ISA_IRQS];
+static uint64_t isa_flags[ISA_IRQS];
+
+// Register select and data window form one access
+static spinlock_t ioapic_lock = SPINLOCK_INIT;
+
+static uint32_t ioapic_read(ioapic_t* ioapic, uint32_t reg) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->regs[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t* ioapic, uint32_t reg, uint32_t value) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    ioapic->regs[IOAPIC_WINDOW / 4] = value;
+}
+
+static uint64_t read_redir(ioapic_t* ioapic, uint32_t entry) {
+    uint64_t low = ioapic_read(ioapic, IOAPIC_REG_REDIR(entry));
+    uint64_t high = ioapic_read(ioapic, IOAPIC_REG_REDIR(entry) + 1);
+    return (high << 32) | low;
+}
+
+static void write_redir(ioapic_t* ioapic, uint32_t entry, uint64_t value) {
+    // Mask first, so the entry is never live half-written
+    ioapic_write(ioapic, IOAPIC_REG_REDIR(entry), (uint32_t)IOAPIC_REDIR_MASKED);
+    ioapic_write(ioapic, IOAPIC_REG_REDIR(entry) + 1, (uint32_t)(value >> 32));
+    ioapic_write(ioapic, IOAPIC_REG_REDIR(entry), (uint32_t)value);
+}
+
+// The I/O APIC handling `gsi`, or NULL
+static ioapic_t* find_ioapic(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].gsi_count) {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+static void add_ioapic(const acpi_madt_ioapic_t* entry) {
+    if (ioapic_count == IOAPIC_MAX) {
+        serial_write_string("IOAPIC: too many, ignoring one\n");
+        return;
+    }
+    ioapic_t* ioapic = &ioapics[ioapic_count];
+    ioapic->regs = (volatile uint32_t*)vmm_map_mmio(entry->address, PAGE_SIZE, PTE_CACHE_UC);
+    if (ioapic->regs == NULL) {
+        serial_write_string("IOAPIC: could not map the registers\n");
+        return;
+    }
+    ioapic->gsi_base = entry->gsi_base;
+    ioapic->gsi_count = ((ioapic_read(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+    for (uint32_t i = 0; i < ioapic->gsi_count; i++) {
+        write_redir(ioapic, i, IOAPIC_REDIR_MASKED);
+    }
+    ioapic_count++;
+}
+
+static void add_override(const acpi_madt_iso_t* iso) {
+    if (iso->bus != 0 || iso->source >= ISA_IRQS) {
+        return;
+    }
+    uint64_t flags = 0;
+    if ((iso->flags & MADT_ISO_POLARITY_MASK) == MADT_ISO_ACTIVE_LOW) {
+        flags |= IOAPIC_REDIR_ACTIVE_LOW;
+    }
+    if ((iso->flags & MADT_ISO_TRIGGER_MASK) == MADT_ISO_LEVEL) {
+        flags |= IOAPIC_REDIR_LEVEL;
+    }
+    isa_gsi[iso->source] = iso->gsi;
+    isa_flags[iso->source] = flags;
+}
+
+bool ioapic_init(void) {
+    const acpi_madt_t* madt = (const acpi_madt_t*)acpi_find_table("APIC");
+    if (madt == NULL) {
+        serial_write_string("IOAPIC: no MADT\n");
+        return false;
+    }
+
+    // ISA IRQs map 1:1 to GSIs unless overridden
+    for (uint32_t irq = 0; irq < ISA_IRQS; irq++) {
+        isa_gsi[irq] = irq;
+        isa_flags[irq] = 0;
+    }
+
+    const uint8_t* entry = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (entry + sizeof(acpi_madt_entry_t) <= end) {
+        const acpi_madt_entry_t* header = (const acpi_madt_entry_t*)entry;
+        if (header->length < sizeof(acpi_madt_entry_t) || entry + header->length > end) {
+            break; // Corrupt: stop rather than read past the table
+        }
+        if (header->type == MADT_TYPE_IOAPIC && header->length >= sizeof(acpi_madt_ioapic_t)) {
+            add_ioapic((const acpi_madt_ioapic_t*)entry);
+        } else if (header->type == MADT_TYPE_ISO && header->length >= sizeof(acpi_madt_iso_t)) {
+            add_override((const acpi_madt_iso_t*)entry);
+        }
+        entry += header->length;
+    }
+
+    if (ioapic_count == 0) {
+        serial_write_string("IOAPIC: none found\n");
+        return false;
+    }
+    serial_write_string("IOAPIC: enabled\n");
+    return true;
+}
+
+bool ioapic_available(void) {
+    return ioapic_count > 0;
+}
+
+bool ioapic_route_isa_irq(uint8_t irq, uint8_t vector, uint32_t apic_id) {
+    if (irq >= ISA_IRQS) {
+        return false;
+    }
+    ioapic_t* ioapic = find_ioapic(isa_gsi[irq]);
+    if (ioapic == NULL) {
+        return false;
+    }
+    uint64_t value = vector | isa_flags[irq] | ((uint64_t)apic_id << IOAPIC_REDIR_DEST_SHIFT);
+    uint64_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    write_redir(ioapic, isa_gsi[irq] - ioapic->gsi_base, value);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+    return true;
+}
+
+void ioapic_mask_isa_irq(uint8_t irq) {
+    if (irq >= ISA_IRQS) {
+        return;
+    }
+    ioapic_t* ioapic = find_ioapic(isa_gsi[irq]);
+    if (ioapic == NULL) {
+        return;
+    }
+    uint32_t entry = isa_gsi[irq] - ioapic->gsi_base;
+    uint64_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    write_redir(ioapic, entry, read_redir(ioapic, entry) | IOAPIC_REDIR_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+}
+
+bool ioapic_get_isa_route(uint8_t irq, ioapic_route_t* route) {
+    if (irq >= ISA_IRQS) {
+        return false;
+    }
+    ioapic_t* ioapic = find_ioapic(isa_gsi[irq]);
+    if (ioapic == NULL) {
+        return false;
+    }
+    uint64_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    uint64_t value = read_redir(ioapic, isa_gsi[irq] - ioapic->gsi_base);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+
+    route->gsi = isa_gsi[irq];
+    route->vector = (uint8_t)value;
+    route->apic_id = (uint32_t)(value >> IOAPIC_REDIR_DEST_SHIFT);
+    route->masked = (value & IOAPIC_REDIR_MASKED) != 0;
+    route->active_low = (value & IOAPIC_REDIR_ACTIVE_LOW) != 0;
+    route->level = (value & IOAPIC_REDIR_LEVEL) != 0;
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef __IOAPIC_H__
+#define __IOAPIC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- I/O APIC ---
+// Routes device interrupts (global system interrupts, GSIs) to a vector
+// on the local APIC of a chosen CPU. The I/O APICs are found through the
+// ACPI MADT, which also says which ISA IRQs are wired to another GSI or
+// with another polarity/trigger mode than ISA's (active high, edge).
+
+#define IOAPIC_MAX 4
+
+// Register select / data window (MMIO offsets)
+#define IOAPIC_REGSEL   0x00
+#define IOAPIC_WINDOW   0x10
+
+// Registers
+#define IOAPIC_REG_VERSION   0x01   // Bits 16-23: last redirection entry
+#define IOAPIC_REG_REDIR(n)  (0x10 + 2 * (n))
+
+// Redirection entry bits (fixed delivery, physical destination)
+#define IOAPIC_REDIR_ACTIVE_LOW (1ull << 13)
+#define IOAPIC_REDIR_LEVEL      (1ull << 15)
+#define IOAPIC_REDIR_MASKED     (1ull << 16)
+#define IOAPIC_REDIR_DEST_SHIFT 56
+
+// Where an ISA IRQ goes, see ioapic_get_isa_route()
+typedef struct {
+    uint32_t gsi;
+    uint8_t vector;
+    uint32_t apic_id;       // Destination local APIC
+    bool masked;
+    bool active_low;
+    bool level;
+} ioapic_route_t;
+
+/**
+ * @brief Reads the MADT, maps every I/O APIC and masks all their inputs.
+ * Call after acpi_init() and lapic_init().
+ * @return false if there is no MADT or no usable I/O APIC.
+ */
+bool ioapic_init(void);
+
+bool ioapic_available(void);
+
+/**
+ * @brief Sends ISA IRQ `irq` (0-15) to `vector` on the CPU with APIC ID
+ * `apic_id` and unmasks it, applying any MADT override.
+ * @return false if no I/O APIC handles that IRQ's GSI.
+ */
+bool ioapic_route_isa_irq(uint8_t irq, uint8_t vector, uint32_t apic_id);
+
+/**
+ * @brief Masks ISA IRQ `irq`.
+ */
+void ioapic_mask_isa_irq(uint8_t irq);
+
+/**
+ * @brief Reads back the redirection entry of ISA IRQ `irq`.
+ * @return false if no I/O APIC handles it.
+ */
+bool ioapic_get_isa_route(uint8_t irq, ioapic_route_t* route);
+
+#endif // __IOAPIC_H__
@@ -0,0 +1,61 @@
+#include "irq.h"
+#include "pic.h"
+#include "lapic.h"
+#include "ioapic.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "serialport.h"
+
+// The IRQs the kernel handles: PIT and keyboard
+static const uint8_t used_irqs[] = { 0, 1 };
+
+static bool use_apic = false;
+
+void irq_init(void* rsdp) {
+    if (!lapic_available() || !acpi_init(rsdp) || !ioapic_init()) {
+        serial_write_string("IRQ: using the 8259 PIC\n");
+        return;
+    }
+
+    // Everything goes to the boot CPU to start with
+    for (unsigned int i = 0; i < sizeof(used_irqs); i++) {
+        if (!ioapic_route_isa_irq(used_irqs[i], IRQ_VECTOR_BASE + used_irqs[i], lapic_id())) {
+            // Half-routed is worse than not at all: back to the PIC
+            for (unsigned int j = 0; j < i; j++) {
+                ioapic_mask_isa_irq(used_irqs[j]);
+            }
+            serial_write_string("IRQ: I/O APIC lacks an ISA IRQ, using the 8259 PIC\n");
+            return;
+        }
+    }
+    pic_disable();
+    use_apic = true;
+    serial_write_string("IRQ: using the I/O APIC\n");
+}
+
+bool irq_uses_apic(void) {
+    return use_apic;
+}
+
+void irq_eoi(uint8_t irq) {
+    if (use_apic) {
+        lapic_eoi();
+    } else {
+        pic_send_eoi(irq);
+    }
+}
+
+void irq_mask(uint8_t irq) {
+    if (use_apic) {
+        ioapic_mask_isa_irq(irq);
+    } else {
+        pic_mask(irq);
+    }
+}
+
+bool irq_set_cpu(uint8_t irq, unsigned int cpu) {
+    if (!use_apic || cpu >= MAX_CPUS || cpu_locals[cpu].self == NULL) {
+        return false;
+    }
+    return ioapic_route_isa_irq(irq, IRQ_VECTOR_BASE + irq, cpu_locals[cpu].lapic_id);
+}
@@ -0,0 +1,44 @@
+#ifndef __IRQ_H__
+#define __IRQ_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- Device IRQs ---
+// The ISA IRQs (0 = PIT, 1 = keyboard, ...) arrive on vectors 32-47,
+// either through the I/O APIC (when the machine has one) or through the
+// legacy 8259 PICs. This picks one at boot and hides the difference.
+
+#define IRQ_VECTOR_BASE 32
+
+/**
+ * @brief Switches IRQ delivery to the I/O APIC and masks the PICs, if
+ * the local APIC is up and the MADT lists an I/O APIC. Otherwise the
+ * PICs set up by pic_remap_and_init() stay in use.
+ * @param rsdp The RSDP from the bootloader, or NULL.
+ */
+void irq_init(void* rsdp);
+
+/**
+ * @brief True once IRQs are delivered through the I/O APIC.
+ */
+bool irq_uses_apic(void);
+
+/**
+ * @brief Acknowledges IRQ `irq` (a local APIC register write, or port
+ * I/O to the PIC(s)).
+ */
+void irq_eoi(uint8_t irq);
+
+/**
+ * @brief Stops IRQ `irq` from being delivered.
+ */
+void irq_mask(uint8_t irq);
+
+/**
+ * @brief Sends IRQ `irq` to CPU `cpu` from now on.
+ * @return false without an I/O APIC, or if `cpu` is not started.
+ */
+bool irq_set_cpu(uint8_t irq, unsigned int cpu);
+
+#endif // __IRQ_H__
@@ -0,0 +1,126 @@
+#include "lapic.h"
+#include "cpu.h"
+#include "vmm.h"
+#include "pit.h"        // For the TSC frequency
+#include "serialport.h"
+
+#define APIC_BASE_ENABLE (1ull << 11)   // IA32_APIC_BASE: global enable
+#define APIC_BASE_MASK   0xFFFFFFFFF000ull
+
+// Calibration: run the timer this long against the TSC
+#define LAPIC_CALIBRATE_MS 10
+
+// Longest one-shot wait lapic_timer_arm() programs
+#define LAPIC_ARM_MAX_S 10
+
+static volatile uint32_t* lapic = NULL;
+
+// Timer counts per second at divide-by-16 (same on every CPU)
+static uint64_t lapic_timer_hz = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+bool lapic_init(void) {
+    // CPUID.1:EDX[9]: on-chip APIC
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & (1u << 9))) {
+        serial_write_string("LAPIC: not present\n");
+        return false;
+    }
+
+    uint64_t base = rdmsr(MSR_IA32_APIC_BASE);
+    lapic = (volatile uint32_t*)vmm_map_mmio(base & APIC_BASE_MASK, PAGE_SIZE, PTE_CACHE_UC);
+    if (lapic == NULL) {
+        serial_write_string("LAPIC: could not map the registers\n");
+        return false;
+    }
+    lapic_init_cpu();
+
+    // Count down from the top for a while and see how far the timer got
+    uint64_t tsc_hz = pit_get_tsc_hz();
+    if (tsc_hz != 0) {
+        lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+        lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+        uint64_t wait = tsc_hz * LAPIC_CALIBRATE_MS / 1000;
+        lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+        uint64_t start = rdtsc();
+        while (rdtsc() - start < wait) {
+            cpu_relax();
+        }
+        uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_COUNT);
+        lapic_write(LAPIC_REG_TIMER_INIT, 0);
+        lapic_timer_hz = (uint64_t)elapsed * 1000 / LAPIC_CALIBRATE_MS;
+    }
+
+    serial_write_string("LAPIC: enabled\n");
+    return true;
+}
+
+void lapic_init_cpu(void) {
+    uint64_t base = rdmsr(MSR_IA32_APIC_BASE);
+    if (!(base & APIC_BASE_ENABLE)) {
+        wrmsr(MSR_IA32_APIC_BASE, base | APIC_BASE_ENABLE);
+    }
+    lapic_write(LAPIC_REG_SPURIOUS, LAPIC_SPURIOUS_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    cpu_local()->lapic_id = lapic_id(); // Where IPIs for this CPU go
+}
+
+bool lapic_available(void) {
+    return lapic != NULL;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+bool lapic_timer_init_oneshot(void) {
+    if (lapic_timer_hz == 0) {
+        return false;
+    }
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR); // One-shot
+    return true;
+}
+
+void lapic_timer_arm(uint64_t tsc_cycles) {
+    // Longer waits just fire early and get re-armed
+    uint64_t tsc_hz = pit_get_tsc_hz();
+    uint64_t limit = tsc_hz * LAPIC_ARM_MAX_S;
+    if (tsc_cycles > limit) {
+        tsc_cycles = limit;
+    }
+    // Round up: firing a little late beats firing just before the deadline
+    uint64_t count = (tsc_cycles * lapic_timer_hz + tsc_hz - 1) / tsc_hz;
+    if (count == 0) {
+        count = 1; // 0 would stop the timer
+    } else if (count > 0xFFFFFFFF) {
+        count = 0xFFFFFFFF;
+    }
+    lapic_write(LAPIC_REG_TIMER_INIT, (uint32_t)count);
+}
+
+void lapic_timer_disarm(void) {
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    uint64_t irq = irq_save();
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        cpu_relax();
+    }
+    lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, vector); // Fixed delivery, physical destination
+    irq_restore(irq);
+}
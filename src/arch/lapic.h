@@ -0,0 +1,80 @@
+#ifndef __LAPIC_H__
+#define __LAPIC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- Local APIC ---
+// Every CPU has one. It delivers the per-CPU timer interrupt and the
+// inter-processor interrupts (IPIs) CPUs use to poke each other.
+// Accessed through MMIO (xAPIC mode), mapped once and shared by all CPUs
+// (each CPU sees its own APIC at the same address).
+
+// Interrupt vectors (above the PIC's 32-47)
+#define LAPIC_TIMER_VECTOR    0x40
+#define RESCHED_VECTOR        0x41  // IPI: a task became ready on this CPU
+#define TLB_SHOOTDOWN_VECTOR  0x42  // IPI: kernel page tables changed, flush the TLB
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// Register offsets
+#define LAPIC_REG_ID          0x020
+#define LAPIC_REG_EOI         0x0B0
+#define LAPIC_REG_SPURIOUS    0x0F0
+#define LAPIC_REG_ICR_LOW     0x300
+#define LAPIC_REG_ICR_HIGH    0x310
+#define LAPIC_REG_LVT_TIMER   0x320
+#define LAPIC_REG_TIMER_INIT  0x380
+#define LAPIC_REG_TIMER_COUNT 0x390
+#define LAPIC_REG_TIMER_DIV   0x3E0
+
+#define LAPIC_SPURIOUS_ENABLE (1u << 8)
+#define LAPIC_LVT_MASKED      (1u << 16)
+#define LAPIC_TIMER_DIV_16    0x3
+#define LAPIC_ICR_PENDING     (1u << 12)
+
+/**
+ * @brief Maps the local APIC, enables it on the boot CPU and measures
+ * its timer against the TSC. Call after pit_calibrate_tsc().
+ * @return false if the CPU has no APIC (or it could not be mapped).
+ */
+bool lapic_init(void);
+
+/**
+ * @brief Enables the calling CPU's local APIC and records its ID in
+ * the CPU's per-CPU block. lapic_init() does this for the boot CPU.
+ */
+void lapic_init_cpu(void);
+
+bool lapic_available(void);
+
+uint32_t lapic_id(void);
+
+/**
+ * @brief Signals the end of the current interrupt to this CPU's APIC.
+ */
+void lapic_eoi(void);
+
+/**
+ * @brief Puts this CPU's timer in one-shot mode on LAPIC_TIMER_VECTOR,
+ * disarmed.
+ * @return false if the timer could not be calibrated.
+ */
+bool lapic_timer_init_oneshot(void);
+
+/**
+ * @brief Fires LAPIC_TIMER_VECTOR once, `tsc_cycles` TSC cycles from
+ * now (replacing any earlier deadline).
+ */
+void lapic_timer_arm(uint64_t tsc_cycles);
+
+/**
+ * @brief Cancels this CPU's pending timer interrupt.
+ */
+void lapic_timer_disarm(void);
+
+/**
+ * @brief Sends interrupt `vector` to the CPU with APIC ID `apic_id`.
+ */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+#endif // __LAPIC_H__
@@ -9,6 +9,19 @@
 // We will map all physical memory to this virtual offset
 #define VIRTUAL_MEMORY_OFFSET 0xffff800000000000ull
 
+// Convert between physical addresses and their HHDM virtual alias
+#define PHYS_TO_VIRT(phys) ((void*)((uint64_t)(phys) + VIRTUAL_MEMORY_OFFSET))
+#define VIRT_TO_PHYS(virt) ((uint64_t)(virt) - VIRTUAL_MEMORY_OFFSET)
+
+// Runtime kernel mappings made with vmm_map() (vmalloc, MMIO) live here
+#define VMALLOC_BASE 0xffffc00000000000ull
+
+// The first 1GiB of it is a fixed scratch window for tests and
+// benchmarks (vmtest, ctxbench); nothing else is ever mapped there
+#define VMM_TEST_BASE VMALLOC_BASE
+// Device memory mapped with vmm_map_mmio() is placed from here upwards
+#define MMIO_BASE (VMALLOC_BASE + 0x4000000000ull)
+
 // The kernel will be mapped to this virtual base address
 // (This should match your linker script)
 #define KERNEL_VIRTUAL_BASE 0xffffffff80000000ull
@@ -22,12 +35,34 @@
 #define PTE_CACHE_DISABLE (1ull << 4)  // Disable caching
 #define PTE_ACCESSED      (1ull << 5)  // Page was accessed
 #define PTE_DIRTY         (1ull << 6)  // Page was written to (for page directory)
-#define PTE_HUGE_PAGE     (1ull << 7)  // Page is 2MiB (for page directory)
+#define PTE_HUGE_PAGE     (1ull << 7)  // Page is 2MiB/1GiB (for PD/PDPT entries)
 #define PTE_GLOBAL        (1ull << 8)  // Page is global (not flushed from TLB)
 #define PTE_NO_EXECUTE    (1ull << 63) // Page cannot be executed (if NXE bit set in EFER)
 
+// In 2MiB/1GiB entries bit 12 is the PAT bit instead of an address bit
+#define PTE_PAT_HUGE      (1ull << 12)
+
+// --- Memory Types ---
+// PWT and PCD select one of the first four PAT entries. vmm_init()
+// programs the PAT as WB, WC, UC-, UC (then WB, WP, UC-, WT), so these
+// work for every page size without the PAT bit.
+#define PTE_CACHE_WB       0
+#define PTE_CACHE_WC       PTE_WRITE_THROUGH
+#define PTE_CACHE_UC_MINUS PTE_CACHE_DISABLE
+#define PTE_CACHE_UC       (PTE_WRITE_THROUGH | PTE_CACHE_DISABLE)
+#define PTE_CACHE_MASK     (PTE_WRITE_THROUGH | PTE_CACHE_DISABLE)
+
+// IA32_PAT value for the layout above (one byte per entry, PAT0 lowest)
+#define PAT_LAYOUT 0x0407050600070106ull
+
 // Mask to get the physical address from an entry
 #define PTE_ADDR_MASK     0x000FFFFFFFFFF000ull
+#define PTE_ADDR_MASK_2M  0x000FFFFFFFE00000ull
+#define PTE_ADDR_MASK_1G  0x000FFFFFC0000000ull
+
+// Sizes of the three page granularities
+#define PAGE_SIZE_2M 0x200000ull
+#define PAGE_SIZE_1G 0x40000000ull
 
 // --- Paging Structures ---
 // Each table has 512 entries, and each entry is 8 bytes (64 bits)
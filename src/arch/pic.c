@@ -57,3 +57,14 @@ void pic_send_eoi(uint8_t irq) {
     // Always send EOI to master
     outb(PIC1_COMMAND, PIC_EOI);
 }
+
+void pic_mask(uint8_t irq) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1u << (irq & 7)));
+}
+
+void pic_disable(void) {
+    // Still remapped, so a spurious IRQ lands on 32-47, not on an exception
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
@@ -24,4 +24,14 @@ void pic_remap_and_init(void);
  */
 void pic_send_eoi(uint8_t irq);
 
+/**
+ * @brief Masks IRQ `irq` (0-15).
+ */
+void pic_mask(uint8_t irq);
+
+/**
+ * @brief Masks every IRQ on both PICs (when the I/O APIC takes over).
+ */
+void pic_disable(void);
+
 #endif // __PIC_H__
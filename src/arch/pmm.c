@@ -1,39 +1,208 @@
 #include "pmm.h"
+#include "paging.h"       // For PAGE_SIZE and PHYS_TO_VIRT
 #include <limine.h>       // For the Limine requests
 #include <serialport.h>   // For debugging output
 #include "string.h"       // For memset
+#include "cpu.h"          // For rdtsc, cpu_id
+#include "spinlock.h"
+#include <stdbool.h>
 
-// We will be managing memory in 4KiB pages.
-#define PAGE_SIZE 4096
+// --- Buddy Free Lists ---
+// Every free block stores its list links in its first page (accessed via
+// the HHDM); its order and PG_BUDDY flag live in the page database.
+// A block of order N covers 2^N pages and is always aligned to 2^N
+// pages, so the "buddy" of a block is found by flipping bit N of its
+// page index.
+typedef struct free_block {
+    struct free_block* next;
+    struct free_block* prev;
+} free_block_t;
+
+static free_block_t* free_lists[PMM_MAX_ORDER + 1];
+
+// Protects the free lists, the bitmap and free_pages
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+// --- Per-CPU Page Cache State ---
+// Each CPU's cache sits on its own cache lines so the fast path never
+// touches memory shared with another CPU.
+typedef struct {
+    uint64_t pages[PMM_PCP_CAPACITY]; // Stack of free physical pages
+    unsigned int count;
+    unsigned int low;   // Drain down to this many pages...
+    unsigned int high;  // ...once the cache reaches this many
+    unsigned int batch; // Pages taken from the buddy lists per refill
+    pmm_cache_stats_t stats;
+} __attribute__((aligned(64))) pmm_cpu_cache_t;
+
+static pmm_cpu_cache_t cpu_caches[MAX_CPUS];
+
+// --- Pre-Zeroed Page Pool ---
+// Filled by the idle task so pmm_alloc_zeroed_page() rarely has to
+// clear a page on the caller's hot path.
+static uint64_t zero_pool[PMM_ZERO_POOL_SIZE];
+static unsigned int zero_pool_count = 0;
+static spinlock_t zero_pool_lock = SPINLOCK_INIT;
+static pmm_zero_pool_stats_t zero_stats;
 
 // --- PMM State ---
-static uint8_t* bitmap = NULL;
+// The bitmap tracks every page: 1 = used (or not RAM), 0 = free.
+// The buddy allocator uses it to check whether a buddy is free.
+// It is stored as 64-bit words so it can be scanned a word at a time.
+static uint64_t* bitmap = NULL;
+// One bit per bitmap word: 1 = that word is completely used.
+// Lets a scan skip 64 * 64 = 4096 full pages per summary word.
+static uint64_t* summary = NULL;
+static uint64_t bitmap_words = 0;
+static uint64_t summary_words = 0;
 static uint64_t total_pages = 0;
+static uint64_t free_pages = 0;
 static uint64_t highest_address = 0;
-static uint64_t last_free_page = 0;
 static uint64_t bitmap_size_in_bytes = 0;
 
+// --- Page Frame Database ---
+// One page_t per page below highest_address, indexed by page number.
+static page_t* page_array = NULL;
+
 // --- Bitmap Helper Functions ---
 
-// Set a bit (page) in the bitmap to 1 (used)
-static void bitmap_set(uint64_t page_index) {
-    uint64_t byte_index = page_index / 8;
-    uint8_t bit_index = page_index % 8;
-    bitmap[byte_index] |= (1 << bit_index);
+// Test if a bit (page) in the bitmap is 1 (used)
+static int bitmap_test(uint64_t page_index) {
+    return (bitmap[page_index / 64] & (1ull << (page_index % 64))) != 0;
 }
 
-// Clear a bit (page) in the bitmap to 0 (free)
-static void bitmap_clear(uint64_t page_index) {
-    uint64_t byte_index = page_index / 8;
-    uint8_t bit_index = page_index % 8;
-    bitmap[byte_index] &= ~(1 << bit_index);
+// --- Range Helpers ---
+// Set/clear bits [start, end) of a word array. Only the ragged first and
+// last words are masked; the words in between are filled with memset.
+
+static void bits_set_range(uint64_t* words, uint64_t start, uint64_t end) {
+    if (start >= end) return;
+    uint64_t first = start / 64;
+    uint64_t last = (end - 1) / 64;
+    uint64_t head_mask = ~0ull << (start % 64);
+    uint64_t tail_mask = ~0ull >> (63 - ((end - 1) % 64));
+
+    if (first == last) {
+        words[first] |= head_mask & tail_mask;
+        return;
+    }
+    words[first] |= head_mask;
+    memset(&words[first + 1], 0xFF, (last - first - 1) * sizeof(uint64_t));
+    words[last] |= tail_mask;
 }
 
-// Test if a bit (page) in the bitmap is 1 (used)
-static int bitmap_test(uint64_t page_index) {
-    uint64_t byte_index = page_index / 8;
-    uint8_t bit_index = page_index % 8;
-    return (bitmap[byte_index] & (1 << bit_index)) != 0;
+static void bits_clear_range(uint64_t* words, uint64_t start, uint64_t end) {
+    if (start >= end) return;
+    uint64_t first = start / 64;
+    uint64_t last = (end - 1) / 64;
+    uint64_t head_mask = ~0ull << (start % 64);
+    uint64_t tail_mask = ~0ull >> (63 - ((end - 1) % 64));
+
+    if (first == last) {
+        words[first] &= ~(head_mask & tail_mask);
+        return;
+    }
+    words[first] &= ~head_mask;
+    memset(&words[first + 1], 0, (last - first - 1) * sizeof(uint64_t));
+    words[last] &= ~tail_mask;
+}
+
+// Mark pages [start, end) as used, keeping the summary in sync
+static void bitmap_set_range(uint64_t start, uint64_t end) {
+    if (start >= end) return;
+    bits_set_range(bitmap, start, end);
+
+    // Interior words are now full; the edge words may or may not be.
+    uint64_t first = start / 64;
+    uint64_t last = (end - 1) / 64;
+    if (last > first + 1) {
+        bits_set_range(summary, first + 1, last);
+    }
+    if (bitmap[first] == ~0ull) {
+        summary[first / 64] |= 1ull << (first % 64);
+    }
+    if (bitmap[last] == ~0ull) {
+        summary[last / 64] |= 1ull << (last % 64);
+    }
+}
+
+// Mark pages [start, end) as free, keeping the summary in sync
+static void bitmap_clear_range(uint64_t start, uint64_t end) {
+    if (start >= end) return;
+    bits_clear_range(bitmap, start, end);
+    // Every word touched now has at least one free bit
+    bits_clear_range(summary, start / 64, (end - 1) / 64 + 1);
+}
+
+/**
+ * @brief Finds the first free page at or after `start`.
+ * Uses the summary to skip full words, then bsf/tzcnt inside the word.
+ * @return The page index, or total_pages if there is none.
+ */
+static uint64_t bitmap_find_free(uint64_t start) {
+    if (start >= total_pages) {
+        return total_pages;
+    }
+
+    // 1. The (partial) word that contains `start`
+    uint64_t word_index = start / 64;
+    uint64_t free_bits = ~bitmap[word_index] & (~0ull << (start % 64));
+    if (free_bits != 0) {
+        uint64_t page = word_index * 64 + __builtin_ctzll(free_bits);
+        return page < total_pages ? page : total_pages;
+    }
+
+    // 2. Walk the summary for the next word that is not completely used
+    word_index++;
+    uint64_t summary_index = word_index / 64;
+    if (summary_index >= summary_words) {
+        return total_pages;
+    }
+    uint64_t not_full = ~summary[summary_index] & (~0ull << (word_index % 64));
+    while (not_full == 0) {
+        summary_index++;
+        if (summary_index >= summary_words) {
+            return total_pages;
+        }
+        not_full = ~summary[summary_index];
+    }
+
+    word_index = summary_index * 64 + __builtin_ctzll(not_full);
+    uint64_t page = word_index * 64 + __builtin_ctzll(~bitmap[word_index]);
+    return page < total_pages ? page : total_pages;
+}
+
+/**
+ * @brief Finds the first used page at or after `start`.
+ * @return The page index, or total_pages if there is none.
+ */
+static uint64_t bitmap_find_used(uint64_t start) {
+    if (start >= total_pages) {
+        return total_pages;
+    }
+
+    uint64_t word_index = start / 64;
+    uint64_t used_bits = bitmap[word_index] & (~0ull << (start % 64));
+    while (used_bits == 0) {
+        word_index++;
+        if (word_index >= bitmap_words) {
+            return total_pages;
+        }
+        used_bits = bitmap[word_index];
+    }
+
+    uint64_t page = word_index * 64 + __builtin_ctzll(used_bits);
+    return page < total_pages ? page : total_pages;
+}
+
+// The original one-bit-per-iteration scan, kept as the benchmark baseline.
+static uint64_t bitmap_find_free_bitwise(uint64_t start) {
+    for (uint64_t i = start; i < total_pages; i++) {
+        if (!bitmap_test(i)) {
+            return i;
+        }
+    }
+    return total_pages;
 }
 
 // Helper function (you can remove this later)
@@ -46,12 +215,126 @@ static void serial_print_hex(uint64_t n) {
     }
 }
 
+static void serial_print_uint(uint64_t n) {
+    char buffer[21];
+    int i = 20;
+    buffer[i] = '\0';
+    do {
+        buffer[--i] = (n % 10) + '0';
+        n /= 10;
+    } while (n > 0);
+    serial_write_string(&buffer[i]);
+}
+
+// --- Free List Helpers ---
+
+static free_block_t* block_from_index(uint64_t page_index) {
+    return (free_block_t*)PHYS_TO_VIRT(page_index * PAGE_SIZE);
+}
+
+static uint64_t index_from_block(free_block_t* block) {
+    return VIRT_TO_PHYS(block) / PAGE_SIZE;
+}
+
+static void free_list_push(uint64_t page_index, unsigned int order) {
+    free_block_t* block = block_from_index(page_index);
+    page_array[page_index].flags |= PG_BUDDY;
+    page_array[page_index].order = order;
+    block->prev = NULL;
+    block->next = free_lists[order];
+    if (free_lists[order] != NULL) {
+        free_lists[order]->prev = block;
+    }
+    free_lists[order] = block;
+}
+
+static void free_list_remove(free_block_t* block) {
+    page_t* page = &page_array[index_from_block(block)];
+    page->flags &= ~PG_BUDDY;
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        free_lists[page->order] = block->next;
+    }
+    if (block->next != NULL) {
+        block->next->prev = block->prev;
+    }
+}
+
+/**
+ * @brief Returns a block of pages to the free lists, merging it with
+ * its buddy for as long as the buddy is also free and of the same order.
+ * The block's pages must already be marked free in the bitmap.
+ */
+static void buddy_insert(uint64_t page_index, unsigned int order) {
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy_index = page_index ^ (1ull << order);
+        if (buddy_index + (1ull << order) > total_pages) {
+            break;
+        }
+
+        // The buddy can only be merged if it heads a free block that is
+        // whole (same order), not split into smaller free pieces.
+        page_t* buddy = &page_array[buddy_index];
+        if (!(buddy->flags & PG_BUDDY) || buddy->order != order) {
+            break;
+        }
+
+        free_list_remove(block_from_index(buddy_index));
+        if (buddy_index < page_index) {
+            page_index = buddy_index;
+        }
+        order++;
+    }
+
+    free_list_push(page_index, order);
+}
+
+/**
+ * @brief Sets page_array[start, end) to `value`.
+ * page_t is 8 bytes, so this is a single rep stosq per range rather than
+ * a per-page loop; pmm_init() runs it once per memmap range.
+ */
+static void page_array_fill(uint64_t start, uint64_t end, page_t value) {
+    _Static_assert(sizeof(page_t) == sizeof(uint64_t), "page_t must fill one quadword");
+    if (start >= end) return;
+    uint64_t pattern;
+    memcpy(&pattern, &value, sizeof(pattern));
+    void* dst = &page_array[start];
+    uint64_t count = end - start;
+    __asm__ volatile ("rep stosq"
+                      : "+D"(dst), "+c"(count)
+                      : "a"(pattern)
+                      : "memory");
+}
+
+/**
+ * @brief Hands a run of free pages [start, end) to the buddy allocator,
+ * split into the largest naturally aligned blocks that fit.
+ * The run must be maximal (bounded by used pages), so no two of these
+ * blocks can be buddies and they are pushed without coalescing. Pages
+ * further along the bitmap have no valid header yet.
+ */
+static void buddy_add_range(uint64_t start, uint64_t end) {
+    while (start < end) {
+        unsigned int order = PMM_MAX_ORDER;
+        while (order > 0 &&
+               ((start & ((1ull << order) - 1)) != 0 || start + (1ull << order) > end)) {
+            order--;
+        }
+        free_list_push(start, order);
+        start += 1ull << order;
+    }
+}
+
 void pmm_init(struct limine_memmap_response *memmap_response) {
     if (memmap_response == NULL) {
         // serial_write_string("ERROR: No memory map from Limine.\n");
         return;
     }
 
+    uint64_t init_start = rdtsc();
+
     // --- 1. Loop 1: Find the highest memory address ---
     // This is needed to determine how big our bitmap needs to be.
     for (uint64_t i = 0; i < memmap_response->entry_count; i++) {
@@ -65,17 +348,26 @@ void pmm_init(struct limine_memmap_response *memmap_response) {
     }
 
     total_pages = highest_address / PAGE_SIZE;
-    // We need 1 bit per page. 8 bits per byte.
-    bitmap_size_in_bytes = (total_pages / 8) + 1;
+    // We need 1 bit per page, 64 bits per word, plus 1 summary bit per word.
+    bitmap_words = (total_pages + 63) / 64;
+    summary_words = (bitmap_words + 63) / 64;
+    bitmap_size_in_bytes = (bitmap_words + summary_words) * sizeof(uint64_t);
+    // The page database follows the bitmap, starting on a cache line
+    uint64_t page_array_offset = (bitmap_size_in_bytes + 63) & ~63ull;
+    uint64_t metadata_size = page_array_offset + total_pages * sizeof(page_t);
 
     // --- 2. Loop 2: Find a large enough [Usable] region to store the bitmap ---
+    uint64_t bitmap_phys = 0;
     for (uint64_t i = 0; i < memmap_response->entry_count; i++) {
         struct limine_memmap_entry *entry = memmap_response->entries[i];
-        if (entry->type == LIMINE_MEMMAP_USABLE && entry->length >= bitmap_size_in_bytes) {
+        if (entry->type == LIMINE_MEMMAP_USABLE && entry->length >= metadata_size) {
             // We found a place for our bitmap!
-            bitmap = (uint8_t*)entry->base;
-            
-            // Mark the entire bitmap as "used" (all 1s) by default
+            bitmap_phys = entry->base;
+            bitmap = (uint64_t*)PHYS_TO_VIRT(bitmap_phys);
+            summary = bitmap + bitmap_words;
+            page_array = (page_t*)((uint8_t*)bitmap + page_array_offset);
+
+            // Mark the entire bitmap (and summary) as "used" (all 1s) by default
             memset(bitmap, 0xFF, bitmap_size_in_bytes);
             break;
         }
@@ -95,49 +387,266 @@ void pmm_init(struct limine_memmap_response *memmap_response) {
             uint64_t top_page = (entry->base + entry->length) / PAGE_SIZE;
 
             if (top_page > base_page) {
-                for (uint64_t j = base_page; j < top_page; j++) {
-                    bitmap_clear(j); // Mark this page as FREE
-                }
+                bitmap_clear_range(base_page, top_page); // Mark these pages as FREE
             }
         }
     }
 
-    // --- 4. Mark the bitmap itself as USED ---
-    uint64_t bitmap_pages = (bitmap_size_in_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
-    uint64_t bitmap_base_page = (uint64_t)bitmap / PAGE_SIZE;
-    for (uint64_t i = 0; i < bitmap_pages; i++) {
-        bitmap_set(bitmap_base_page + i);
+    // --- 4. Mark the bitmap and page database themselves as USED ---
+    uint64_t bitmap_pages = (metadata_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint64_t bitmap_base_page = bitmap_phys / PAGE_SIZE;
+    bitmap_set_range(bitmap_base_page, bitmap_base_page + bitmap_pages);
+
+    // Page 0 is never handed out: a NULL return means "out of memory".
+    bitmap_set_range(0, 1);
+
+    // --- 5. Build the page database ---
+    // Every page starts out reserved (held by its owner, refcount 1);
+    // the free ones are reset below as they enter the buddy lists.
+    page_array_fill(0, total_pages,
+                    (page_t){ .refcount = 1, .flags = PG_RESERVED, .owner = PAGE_OWNER_FIRMWARE });
+    for (uint64_t i = 0; i < memmap_response->entry_count; i++) {
+        struct limine_memmap_entry *entry = memmap_response->entries[i];
+        uint8_t owner;
+        switch (entry->type) {
+        case LIMINE_MEMMAP_KERNEL_AND_MODULES:      owner = PAGE_OWNER_KERNEL_IMAGE; break;
+        case LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE:  owner = PAGE_OWNER_BOOTLOADER; break;
+        case LIMINE_MEMMAP_FRAMEBUFFER:             owner = PAGE_OWNER_DEVICE; break;
+        default:                                    continue;
+        }
+        uint64_t base_page = entry->base / PAGE_SIZE;
+        uint64_t top_page = (entry->base + entry->length + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (top_page > total_pages) {
+            top_page = total_pages;
+        }
+        page_array_fill(base_page, top_page,
+                        (page_t){ .refcount = 1, .flags = PG_RESERVED, .owner = owner });
+    }
+    page_array_fill(bitmap_base_page, bitmap_base_page + bitmap_pages,
+                    (page_t){ .refcount = 1, .flags = PG_RESERVED, .owner = PAGE_OWNER_PMM });
+
+    uint64_t bitmap_done = rdtsc();
+
+    // --- 6. Build the buddy free lists from the runs of free pages ---
+    uint64_t run_start = bitmap_find_free(0);
+    while (run_start < total_pages) {
+        uint64_t run_end = bitmap_find_used(run_start);
+        page_array_fill(run_start, run_end,
+                        (page_t){ .refcount = 0, .flags = 0, .owner = PAGE_OWNER_NONE });
+        buddy_add_range(run_start, run_end);
+        free_pages += run_end - run_start;
+        run_start = bitmap_find_free(run_end);
     }
 
-    // serial_write_string("PMM: Bitmap initialized. Free pages are now marked.\n");
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        cpu_caches[cpu].low = PMM_PCP_DEFAULT_LOW;
+        cpu_caches[cpu].high = PMM_PCP_DEFAULT_HIGH;
+        cpu_caches[cpu].batch = PMM_PCP_DEFAULT_BATCH;
+    }
+
+    uint64_t init_end = rdtsc();
+
+    // Report the boot-time cost so it can be tracked across RAM sizes
+    serial_write_string("PMM: ");
+    serial_print_uint(free_pages * PAGE_SIZE / (1024 * 1024));
+    serial_write_string(" MiB free of ");
+    serial_print_uint(total_pages);
+    serial_write_string(" pages. Init took ");
+    serial_print_uint(init_end - init_start);
+    serial_write_string(" cycles (bitmap ");
+    serial_print_uint(bitmap_done - init_start);
+    serial_write_string(", free lists ");
+    serial_print_uint(init_end - bitmap_done);
+    serial_write_string(")\n");
 }
 
 /**
- * @brief Allocates a single 4KiB page of physical memory.
+ * @brief Allocates 2^order pages from the buddy free lists.
+ * The caller must hold pmm_lock.
  */
-void* pmm_alloc_page(void) {
-    // Start searching from the last page we freed (or 0)
-    for (uint64_t i = last_free_page; i < total_pages; i++) {
-        if (!bitmap_test(i)) {
-            // Found a free page!
-            bitmap_set(i);
-            last_free_page = i + 1;
-            return (void*)(i * PAGE_SIZE);
+static void* buddy_alloc(unsigned int order) {
+    // Find the smallest free block that is big enough
+    unsigned int current = order;
+    while (current <= PMM_MAX_ORDER && free_lists[current] == NULL) {
+        current++;
+    }
+    if (current > PMM_MAX_ORDER) {
+        // No free blocks
+        return NULL;
+    }
+
+    free_block_t* block = free_lists[current];
+    free_list_remove(block);
+    uint64_t page_index = index_from_block(block);
+
+    // Split it down, giving the upper halves back to the free lists
+    while (current > order) {
+        current--;
+        free_list_push(page_index + (1ull << current), current);
+    }
+
+    uint64_t count = 1ull << order;
+    bitmap_set_range(page_index, page_index + count);
+    free_pages -= count;
+
+    page_t* page = &page_array[page_index];
+    page->refcount = 1;
+    page->order = order;
+    page->owner = PAGE_OWNER_KERNEL;
+
+    return (void*)(page_index * PAGE_SIZE);
+}
+
+/**
+ * @brief Returns 2^order pages to the buddy free lists.
+ * The caller must hold pmm_lock.
+ */
+static void buddy_free(void* p, unsigned int order) {
+    uint64_t page_index = (uint64_t)p / PAGE_SIZE;
+    uint64_t count = 1ull << order;
+    if (page_index + count > total_pages || (page_index & (count - 1)) != 0 ||
+        (page_array[page_index].flags & PG_RESERVED)) {
+        serial_write_string("PMM: Bad free of ");
+        serial_print_hex((uint64_t)p);
+        serial_write_string("\n");
+        return;
+    }
+
+    // Every page of the block must be in use: a free one means a double
+    // free, or an order larger than the block that was allocated
+    if (bitmap_find_free(page_index) < page_index + count) {
+        serial_write_string("PMM: Double free or wrong order of ");
+        serial_print_hex((uint64_t)p);
+        serial_write_string("\n");
+        return;
+    }
+
+    bitmap_clear_range(page_index, page_index + count);
+    free_pages += count;
+
+    page_t* page = &page_array[page_index];
+    page->refcount = 0;
+    page->owner = PAGE_OWNER_NONE;
+
+    buddy_insert(page_index, order);
+}
+
+/**
+ * @brief Allocates 2^order physically contiguous, naturally aligned pages.
+ */
+void* pmm_alloc_pages(unsigned int order) {
+    if (order > PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    void* p = buddy_alloc(order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return p;
+}
+
+/**
+ * @brief Frees a block of 2^order pages and coalesces it with its buddies.
+ */
+void pmm_free_pages(void* p, unsigned int order) {
+    if (p == NULL || order > PMM_MAX_ORDER) return;
+
+    // Same claim as pmm_free_page(): the head must hold exactly one
+    // reference, which is dropped atomically so a second free is caught.
+    page_t* page = pmm_phys_to_page((uint64_t)p);
+    uint32_t expected = 1;
+    if (page == NULL || (page->flags & PG_RESERVED) ||
+        !__atomic_compare_exchange_n(&page->refcount, &expected, 0,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        serial_write_string("PMM: Bad or double free of ");
+        serial_print_hex((uint64_t)p);
+        serial_write_string("\n");
+        return;
+    }
+    if (page->order != order) {
+        // The rest of the block would be freed with it (or be left out):
+        // put the reference back and leave the block alone
+        __atomic_store_n(&page->refcount, 1, __ATOMIC_RELEASE);
+        serial_write_string("PMM: Wrong order in free of ");
+        serial_print_hex((uint64_t)p);
+        serial_write_string("\n");
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    buddy_free(p, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// --- Per-CPU Page Caches ---
+// Single pages are served from a per-CPU stack of free frames. Only
+// refills (when empty) and drains (when above the high watermark) take
+// pmm_lock, and both move a whole batch of pages at once.
+
+// Move `batch` pages from the buddy allocator into the cache
+static void pcp_refill(pmm_cpu_cache_t* cache) {
+    spin_lock(&pmm_lock);
+    while (cache->count < cache->batch) {
+        void* p = buddy_alloc(0);
+        if (p == NULL) {
+            break;
         }
+        // Cached pages are free as far as the page database is concerned
+        page_array[(uint64_t)p / PAGE_SIZE].refcount = 0;
+        page_array[(uint64_t)p / PAGE_SIZE].owner = PAGE_OWNER_NONE;
+        cache->pages[cache->count++] = (uint64_t)p;
     }
+    spin_unlock(&pmm_lock);
+    cache->stats.refills++;
+}
 
-    // If we wrapped around, try searching from the beginning
-    for (uint64_t i = 0; i < last_free_page; i++) {
-        if (!bitmap_test(i)) {
-            // Found a free page!
-            bitmap_set(i);
-            last_free_page = i + 1;
-            return (void*)(i * PAGE_SIZE);
+// Give the oldest pages back to the buddy allocator, down to `low`
+static void pcp_drain(pmm_cpu_cache_t* cache, unsigned int low) {
+    if (cache->count <= low) {
+        return;
+    }
+    unsigned int drop = cache->count - low;
+
+    spin_lock(&pmm_lock);
+    for (unsigned int i = 0; i < drop; i++) {
+        buddy_free((void*)cache->pages[i], 0);
+    }
+    spin_unlock(&pmm_lock);
+
+    // Keep the most recently freed (cache-hot) pages
+    for (unsigned int i = 0; i < low; i++) {
+        cache->pages[i] = cache->pages[i + drop];
+    }
+    cache->count = low;
+    cache->stats.drains++;
+}
+
+/**
+ * @brief Allocates a single 4KiB page of physical memory.
+ */
+void* pmm_alloc_page(void) {
+    uint64_t flags = irq_save();
+    pmm_cpu_cache_t* cache = &cpu_caches[cpu_id()];
+
+    if (cache->count == 0) {
+        cache->stats.alloc_misses++;
+        pcp_refill(cache);
+        if (cache->count == 0) {
+            irq_restore(flags);
+            return NULL;
         }
+    } else {
+        cache->stats.alloc_hits++;
     }
 
-    // No free pages
-    return NULL;
+    void* p = (void*)cache->pages[--cache->count];
+    irq_restore(flags);
+
+    page_t* page = &page_array[(uint64_t)p / PAGE_SIZE];
+    page->refcount = 1;
+    page->order = 0;
+    page->owner = PAGE_OWNER_KERNEL;
+    return p;
 }
 
 /**
@@ -147,13 +656,308 @@ void pmm_free_page(void* p) {
     if (p == NULL) return;
 
     uint64_t page_index = (uint64_t)p / PAGE_SIZE;
-    if (page_index >= total_pages) {
+    if (((uint64_t)p & (PAGE_SIZE - 1)) != 0 || page_index >= total_pages ||
+        (page_array[page_index].flags & PG_RESERVED) || page_array[page_index].order != 0) {
+        serial_write_string("PMM: Bad free of ");
+        serial_print_hex((uint64_t)p);
+        serial_write_string("\n");
+        return;
+    }
+
+    // Claim the page by dropping its single reference. Two CPUs freeing
+    // the same page cannot both succeed, and a page that is already free
+    // (refcount 0) or still shared is rejected before it reaches a cache.
+    uint32_t expected = 1;
+    if (!__atomic_compare_exchange_n(&page_array[page_index].refcount, &expected, 0,
+                                     false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        serial_write_string("PMM: Double free of ");
+        serial_print_hex((uint64_t)p);
+        serial_write_string("\n");
+        return;
+    }
+    page_array[page_index].owner = PAGE_OWNER_NONE;
+
+    uint64_t flags = irq_save();
+    pmm_cpu_cache_t* cache = &cpu_caches[cpu_id()];
+
+    cache->pages[cache->count++] = (uint64_t)p;
+    if (cache->count >= cache->high) {
+        cache->stats.free_misses++;
+        pcp_drain(cache, cache->low);
+    } else {
+        cache->stats.free_hits++;
+    }
+    irq_restore(flags);
+}
+
+void pmm_cache_set_watermarks(unsigned int low, unsigned int high, unsigned int batch) {
+    if (high > PMM_PCP_CAPACITY || low >= high || batch == 0 || batch > high) {
+        return;
+    }
+
+    // Only this CPU touches its cache, with interrupts off
+    uint64_t flags = irq_save();
+    pmm_cpu_cache_t* cache = &cpu_caches[cpu_id()];
+    cache->low = low;
+    cache->high = high;
+    cache->batch = batch;
+    if (cache->count >= high) {
+        pcp_drain(cache, low);
+    }
+    irq_restore(flags);
+}
+
+void pmm_cache_get_stats(unsigned int cpu, pmm_cache_stats_t* stats) {
+    if (cpu >= MAX_CPUS) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    pmm_cpu_cache_t* cache = &cpu_caches[cpu];
+    *stats = cache->stats;
+    stats->cached = cache->count;
+    stats->low = cache->low;
+    stats->high = cache->high;
+    stats->batch = cache->batch;
+}
+
+// --- Zeroed Pages ---
+
+/**
+ * @brief Zeroes `pages` pages with non-temporal stores.
+ * movnti bypasses the cache, so clearing a page does not evict the
+ * working set of whatever runs next. General-purpose registers only:
+ * vector registers would make the idle task take the lazily switched
+ * FPU state (see fpu.h) from the task that last used it.
+ */
+static void zero_pages_nt(void* p, uint64_t pages) {
+    uint64_t* dst = (uint64_t*)PHYS_TO_VIRT(p);
+    uint64_t words = pages * (PAGE_SIZE / sizeof(uint64_t));
+    for (uint64_t i = 0; i < words; i += 8) {
+        __asm__ volatile (
+            "movnti %1, 0(%0)\n\t"
+            "movnti %1, 8(%0)\n\t"
+            "movnti %1, 16(%0)\n\t"
+            "movnti %1, 24(%0)\n\t"
+            "movnti %1, 32(%0)\n\t"
+            "movnti %1, 40(%0)\n\t"
+            "movnti %1, 48(%0)\n\t"
+            "movnti %1, 56(%0)"
+            :: "r"(&dst[i]), "r"(0ull) : "memory");
+    }
+    // Make the streaming stores visible before the page is handed out
+    __asm__ volatile ("sfence" ::: "memory");
+}
+
+void* pmm_alloc_zeroed_page(void) {
+    void* p = NULL;
+
+    uint64_t flags = spin_lock_irqsave(&zero_pool_lock);
+    if (zero_pool_count > 0) {
+        p = (void*)zero_pool[--zero_pool_count];
+        zero_stats.hits++;
+    } else {
+        zero_stats.misses++;
+    }
+    spin_unlock_irqrestore(&zero_pool_lock, flags);
+
+    if (p == NULL) {
+        // Pool is empty: clear the page synchronously
+        p = pmm_alloc_page();
+        if (p != NULL) {
+            memset(PHYS_TO_VIRT(p), 0, PAGE_SIZE);
+        }
+    } else {
+        page_t* page = &page_array[(uint64_t)p / PAGE_SIZE];
+        page->refcount = 1;
+        page->owner = PAGE_OWNER_KERNEL;
+    }
+    return p;
+}
+
+void* pmm_alloc_zeroed_pages(unsigned int order) {
+    if (order == 0) {
+        return pmm_alloc_zeroed_page();
+    }
+
+    void* p = pmm_alloc_pages(order);
+    if (p != NULL) {
+        zero_pages_nt(p, 1ull << order);
+    }
+    return p;
+}
+
+unsigned int pmm_zero_pool_refill(unsigned int max_pages) {
+    unsigned int added = 0;
+
+    while (added < max_pages) {
+        // Check for room before doing any work
+        if (zero_pool_count >= PMM_ZERO_POOL_SIZE) {
+            break;
+        }
+
+        void* p = pmm_alloc_page();
+        if (p == NULL) {
+            break;
+        }
+        zero_pages_nt(p, 1);
+
+        uint64_t flags = spin_lock_irqsave(&zero_pool_lock);
+        int stored = zero_pool_count < PMM_ZERO_POOL_SIZE;
+        if (stored) {
+            // Pooled pages are free until handed out, but stay out of
+            // the "free" count in the page database
+            page_t* page = &page_array[(uint64_t)p / PAGE_SIZE];
+            page->refcount = 0;
+            page->owner = PAGE_OWNER_ZERO_POOL;
+            zero_pool[zero_pool_count++] = (uint64_t)p;
+            zero_stats.zeroed_in_idle++;
+        }
+        spin_unlock_irqrestore(&zero_pool_lock, flags);
+
+        if (!stored) {
+            // Someone else filled the pool while we were zeroing
+            pmm_free_page(p);
+            break;
+        }
+        added++;
+    }
+    return added;
+}
+
+void pmm_zero_pool_get_stats(pmm_zero_pool_stats_t* stats) {
+    uint64_t flags = spin_lock_irqsave(&zero_pool_lock);
+    *stats = zero_stats;
+    stats->pooled = zero_pool_count;
+    spin_unlock_irqrestore(&zero_pool_lock, flags);
+}
+
+uint64_t pmm_get_free_pages(void) {
+    uint64_t count = free_pages + zero_pool_count;
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        count += cpu_caches[cpu].count;
+    }
+    return count;
+}
+
+uint64_t pmm_get_total_pages(void) {
+    return total_pages;
+}
+
+// --- Page Frame Database ---
+
+page_t* pmm_phys_to_page(uint64_t phys) {
+    uint64_t page_index = phys / PAGE_SIZE;
+    if (page_array == NULL || page_index >= total_pages) {
+        return NULL;
+    }
+    return &page_array[page_index];
+}
+
+uint64_t pmm_page_to_phys(const page_t* page) {
+    return (uint64_t)(page - page_array) * PAGE_SIZE;
+}
+
+void pmm_set_page_owner(void* p, uint8_t owner) {
+    page_t* page = pmm_phys_to_page((uint64_t)p);
+    if (page != NULL) {
+        page->owner = owner;
+    }
+}
+
+void get_page(page_t* page) {
+    __atomic_add_fetch(&page->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void put_page(page_t* page) {
+    if (page->flags & PG_RESERVED) {
+        // Boot-time reservations are never handed to the allocator
+        __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    uint32_t refs = __atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL);
+    if (refs != 0) {
+        return;
+    }
+
+    // Last reference dropped: give the whole block back
+    void* p = (void*)pmm_page_to_phys(page);
+    page->refcount = 1; // pmm_free_page(s) expects a live page
+    if (page->order == 0) {
+        pmm_free_page(p);
+    } else {
+        pmm_free_pages(p, page->order);
+    }
+}
+
+void pmm_count_owners(uint64_t counts[PAGE_OWNER_COUNT]) {
+    memset(counts, 0, sizeof(uint64_t) * PAGE_OWNER_COUNT);
+    for (uint64_t i = 0; i < total_pages; i++) {
+        uint8_t owner = page_array[i].owner;
+        if (owner < PAGE_OWNER_COUNT) {
+            counts[owner]++;
+        }
+    }
+}
+
+// --- Benchmark ---
+
+// Pages taken by the benchmark are chained through their first word.
+static uint64_t bench_fill(uint64_t target_free) {
+    uint64_t chain = 0;
+    while (pmm_get_free_pages() > target_free) {
+        void* p = pmm_alloc_page();
+        if (p == NULL) {
+            break;
+        }
+        *(uint64_t*)PHYS_TO_VIRT(p) = chain;
+        chain = (uint64_t)p;
+    }
+    return chain;
+}
+
+static void bench_release(uint64_t chain) {
+    while (chain != 0) {
+        uint64_t next = *(uint64_t*)PHYS_TO_VIRT(chain);
+        pmm_free_page((void*)chain);
+        chain = next;
+    }
+}
+
+#define PMM_BENCH_ITERATIONS 64
+
+void pmm_benchmark(unsigned int percent_used, pmm_bench_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    if (bitmap == NULL || percent_used > 100) {
         return;
     }
 
-    if (!bitmap_test(page_index)) {
+    // Fill memory until `percent_used` of the managed pages are in use
+    uint64_t target_free = total_pages - (total_pages * percent_used) / 100;
+    uint64_t chain = bench_fill(target_free);
+    result->free_pages = pmm_get_free_pages();
+
+    volatile uint64_t sink = 0;
+    uint64_t flags = spin_lock_irqsave(&pmm_lock);
+    uint64_t start = rdtsc();
+    for (int i = 0; i < PMM_BENCH_ITERATIONS; i++) {
+        sink += bitmap_find_free_bitwise(0);
+    }
+    result->bitwise_cycles = (rdtsc() - start) / PMM_BENCH_ITERATIONS;
+
+    start = rdtsc();
+    for (int i = 0; i < PMM_BENCH_ITERATIONS; i++) {
+        sink += bitmap_find_free(0);
+    }
+    result->word_cycles = (rdtsc() - start) / PMM_BENCH_ITERATIONS;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    start = rdtsc();
+    for (int i = 0; i < PMM_BENCH_ITERATIONS; i++) {
+        pmm_free_page(pmm_alloc_page());
     }
+    result->alloc_cycles = (rdtsc() - start) / PMM_BENCH_ITERATIONS;
+    (void)sink;
 
-    bitmap_clear(page_index);
-    last_free_page = page_index;
-}
\ No newline at end of file
+    bench_release(chain);
+}
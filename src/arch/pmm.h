@@ -2,12 +2,80 @@
 #define __PMM_H__
 
 #include <stdint.h>
+#include <stddef.h>
 #include <limine.h>
 
+// The buddy allocator hands out blocks of 2^order pages.
+// Order 0 is a single 4KiB page, order 9 is 2MiB, order 10 is 4MiB.
+#define PMM_MAX_ORDER 10
+
+// Per-CPU single-page caches sit in front of the buddy allocator.
+#define PMM_PCP_CAPACITY      128 // Maximum pages a CPU can cache
+#define PMM_PCP_DEFAULT_HIGH  128 // Drain once this many pages are cached
+#define PMM_PCP_DEFAULT_LOW   64  // ...down to this many
+#define PMM_PCP_DEFAULT_BATCH 32  // Pages fetched per refill
+
+// --- Page Frame Database ---
+// One page_t per physical page, built by pmm_init() from the memmap.
+// 8 bytes each, so a 64-byte cache line describes 8 neighbouring pages.
+typedef struct page {
+    uint32_t refcount; // References held; the block is freed when it drops to 0
+    uint8_t flags;     // PG_* flags
+    uint8_t order;     // Order of the block this page heads
+    uint8_t owner;     // PAGE_OWNER_* of the current user
+    uint8_t reserved;
+} page_t;
+
+// page_t flags
+#define PG_RESERVED (1 << 0) // Not managed by the allocator (firmware, kernel, PMM)
+#define PG_BUDDY    (1 << 1) // Heads a free block on the buddy free lists
+
+// Who a page belongs to
+typedef enum {
+    PAGE_OWNER_NONE = 0,     // Free
+    PAGE_OWNER_KERNEL,       // Generic kernel allocation
+    PAGE_OWNER_PMM,          // The PMM's own bitmap and page database
+    PAGE_OWNER_KERNEL_IMAGE, // Kernel image and boot modules (initrd)
+    PAGE_OWNER_BOOTLOADER,   // Bootloader-reclaimable memory
+    PAGE_OWNER_FIRMWARE,     // Reserved / ACPI / bad memory and holes
+    PAGE_OWNER_DEVICE,       // Framebuffer and other MMIO
+    PAGE_OWNER_PAGE_TABLE,   // Paging structures
+    PAGE_OWNER_STACK,        // Kernel task stacks
+    PAGE_OWNER_HEAP,         // Kernel heap (large kmalloc blocks)
+    PAGE_OWNER_SLAB,         // Kernel heap slabs (every page of the slab)
+    PAGE_OWNER_ARENA,        // Scratch arenas (arena.c)
+    PAGE_OWNER_SHARED,       // Mapped into more than one place
+    PAGE_OWNER_ZERO_POOL,    // Free, pre-zeroed and waiting in the zero pool
+    PAGE_OWNER_COUNT
+} page_owner_t;
+
+// Pages kept pre-zeroed for pmm_alloc_zeroed_page()
+#define PMM_ZERO_POOL_SIZE 64
+
+// Zeroed page pool counters, see pmm_zero_pool_get_stats()
+typedef struct {
+    uint64_t hits;           // Requests served from the pool
+    uint64_t misses;         // Requests that had to zero synchronously
+    uint64_t zeroed_in_idle; // Pages zeroed by the idle task
+    unsigned int pooled;     // Pages currently in the pool
+} pmm_zero_pool_stats_t;
+
+// Per-CPU page cache counters, see pmm_cache_get_stats()
+typedef struct {
+    uint64_t alloc_hits;   // pmm_alloc_page() served from the cache
+    uint64_t alloc_misses; // pmm_alloc_page() that had to refill
+    uint64_t free_hits;    // pmm_free_page() absorbed by the cache
+    uint64_t free_misses;  // pmm_free_page() that triggered a drain
+    uint64_t refills;      // Batches taken from the buddy allocator
+    uint64_t drains;       // Batches given back to the buddy allocator
+    unsigned int cached;   // Pages currently in the cache
+    unsigned int low, high, batch;
+} pmm_cache_stats_t;
+
 /**
  * @brief Initializes the Physical Memory Manager (PMM).
  * This function finds the available memory from the bootloader and
- * sets up the bitmap allocator.
+ * sets up the buddy allocator.
  */
 void pmm_init(struct limine_memmap_response *memmap);
 
@@ -24,4 +92,133 @@ void* pmm_alloc_page(void);
  */
 void pmm_free_page(void* p);
 
-#endif // __PMM_H__
\ No newline at end of file
+/**
+ * @brief Allocates 2^order physically contiguous pages.
+ * The returned block is naturally aligned to its own size
+ * (e.g. an order 9 block is 2MiB aligned).
+ * @param order The block order (0 to PMM_MAX_ORDER).
+ * @return The physical address of the block, or NULL on failure.
+ */
+void* pmm_alloc_pages(unsigned int order);
+
+/**
+ * @brief Frees a block previously returned by pmm_alloc_pages().
+ * @param p The physical address of the block.
+ * @param order The order the block was allocated with.
+ */
+void pmm_free_pages(void* p, unsigned int order);
+
+/**
+ * @brief Allocates a single 4KiB page that is filled with zeroes.
+ * Served from the pre-zeroed pool when possible.
+ * @return The physical address of the page, or NULL on failure.
+ */
+void* pmm_alloc_zeroed_page(void);
+
+/**
+ * @brief Allocates 2^order contiguous pages filled with zeroes.
+ * Free with pmm_free_pages() (or pmm_free_page() for order 0).
+ */
+void* pmm_alloc_zeroed_pages(unsigned int order);
+
+/**
+ * @brief Zeroes up to `max_pages` free pages into the zeroed pool.
+ * Called from the idle task; uses non-temporal stores.
+ * @return The number of pages added (0 once the pool is full).
+ */
+unsigned int pmm_zero_pool_refill(unsigned int max_pages);
+
+/**
+ * @brief Copies the zeroed page pool counters into `stats`.
+ */
+void pmm_zero_pool_get_stats(pmm_zero_pool_stats_t* stats);
+
+/**
+ * @brief Tunes the calling CPU's page cache.
+ * @param low Pages kept after a drain.
+ * @param high Cache size that triggers a drain (at most PMM_PCP_CAPACITY).
+ * @param batch Pages taken from the buddy allocator per refill.
+ */
+void pmm_cache_set_watermarks(unsigned int low, unsigned int high, unsigned int batch);
+
+/**
+ * @brief Copies one CPU's page cache counters into `stats`.
+ */
+void pmm_cache_get_stats(unsigned int cpu, pmm_cache_stats_t* stats);
+
+/**
+ * @brief Returns the number of free 4KiB pages (including per-CPU caches).
+ */
+uint64_t pmm_get_free_pages(void);
+
+/**
+ * @brief Returns the number of 4KiB pages managed by the PMM.
+ */
+uint64_t pmm_get_total_pages(void);
+
+// Per-occupancy results of pmm_benchmark(), in TSC cycles per operation.
+typedef struct {
+    uint64_t free_pages;     // Free pages left while measuring
+    uint64_t bitwise_cycles; // Old bit-at-a-time first-fit scan
+    uint64_t word_cycles;    // 64-bit word scan with the summary index
+    uint64_t alloc_cycles;   // pmm_alloc_page() + pmm_free_page() pair (cached)
+} pmm_bench_result_t;
+
+/**
+ * @brief Measures allocation latency with `percent_used` of memory in use.
+ * Temporarily allocates pages to reach the target occupancy.
+ */
+void pmm_benchmark(unsigned int percent_used, pmm_bench_result_t* result);
+
+/**
+ * @brief Returns the page_t describing a physical address, or NULL.
+ */
+page_t* pmm_phys_to_page(uint64_t phys);
+
+/**
+ * @brief Returns the physical address described by a page_t.
+ */
+uint64_t pmm_page_to_phys(const page_t* page);
+
+/**
+ * @brief Records who owns an allocated page (a PAGE_OWNER_* value).
+ */
+void pmm_set_page_owner(void* p, uint8_t owner);
+
+/**
+ * @brief Takes an extra reference on an allocated block's head page.
+ */
+void get_page(page_t* page);
+
+/**
+ * @brief Drops a reference; the block is freed when the last one goes.
+ * Pages shared with get_page() must be released this way rather than
+ * with pmm_free_page(s)().
+ */
+void put_page(page_t* page);
+
+/**
+ * @brief Counts pages per owner type.
+ */
+void pmm_count_owners(uint64_t counts[PAGE_OWNER_COUNT]);
+
+// The largest block the buddy allocator hands out, in bytes
+#define PMM_MAX_BLOCK_SIZE ((size_t)4096 << PMM_MAX_ORDER)
+
+/**
+ * @brief Returns the smallest order whose block holds `size` bytes.
+ * @return The order, or PMM_MAX_ORDER + 1 (which pmm_alloc_pages()
+ * rejects) if `size` is larger than PMM_MAX_BLOCK_SIZE.
+ */
+static inline unsigned int pmm_size_to_order(size_t size) {
+    if (size > PMM_MAX_BLOCK_SIZE) {
+        return PMM_MAX_ORDER + 1;
+    }
+    unsigned int order = 0;
+    while (((size_t)4096 << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+#endif // __PMM_H__
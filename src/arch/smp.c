@@ -0,0 +1,161 @@
+#include "smp.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "vmm.h"
+#include "fpu.h"
+#include "lapic.h"
+#include "task.h"
+#include "tick.h"
+#include "pit.h"        // For the TSC frequency
+#include "serialport.h"
+#include "spinlock.h"
+
+// How long smp_init() waits for the APs to check in
+#define SMP_START_TIMEOUT_MS 1000
+
+cpu_local_t cpu_locals[MAX_CPUS] __attribute__((aligned(64)));
+
+// APs that finished ap_entry()'s setup
+static volatile uint32_t started_cpus = 0;
+
+// CPUs that take part in TLB shootdowns (bit = CPU index), the boot
+// CPU from the start
+static volatile uint32_t tlb_cpus = 1;
+
+// CPUs that have yet to act on the current shootdown
+static volatile uint32_t tlb_pending = 0;
+static volatile bool tlb_write_back = false;
+
+// One shootdown at a time
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+
+static void set_cpu_local(uint32_t id, uint32_t apic_id) {
+    cpu_local_t* local = &cpu_locals[id];
+    local->self = local;
+    local->id = id;
+    local->lapic_id = apic_id;
+    wrmsr(MSR_GS_BASE, (uint64_t)local);
+}
+
+void smp_init_bsp(void) {
+    set_cpu_local(0, 0); // The APIC ID is filled in by lapic_init()
+}
+
+/**
+ * @brief First code an AP runs (on a stack from the bootloader, with
+ * interrupts off). Never returns: it ends up in the idle loop.
+ */
+static void ap_entry(struct limine_smp_info* info) {
+    uint32_t id = (uint32_t)info->extra_argument;
+
+    gdt_init_cpu(id);
+    set_cpu_local(id, info->lapic_id);
+    idt_load();
+    vmm_init_cpu();
+    fpu_init_cpu();
+    lapic_init_cpu();
+
+    // Take part in shootdowns from now on, and drop whatever changed
+    // since vmm_init_cpu() loaded the page map
+    __atomic_or_fetch(&tlb_cpus, 1u << id, __ATOMIC_SEQ_CST);
+    vmm_flush_tlb_local(false);
+
+    task_init_cpu();
+    tick_init_cpu();
+
+    __atomic_add_fetch(&started_cpus, 1, __ATOMIC_RELEASE);
+
+    // The boot context becomes this CPU's idle task
+    __asm__ volatile ("sti");
+    task_run_idle();
+}
+
+bool smp_init(struct limine_smp_response* smp) {
+    // The other CPUs need their local APIC timers (see tick.h)
+    if (smp == NULL || !lapic_available() || !tick_oneshot()) {
+        serial_write_string("SMP: running on the boot CPU only\n");
+        return false;
+    }
+
+    uint32_t next_id = 1;
+    for (uint64_t i = 0; i < smp->cpu_count && next_id < MAX_CPUS; i++) {
+        struct limine_smp_info* info = smp->cpus[i];
+        if (info->lapic_id == smp->bsp_lapic_id) {
+            continue;
+        }
+        info->extra_argument = next_id++;
+        // Writing the address is what releases the AP
+        __atomic_store_n(&info->goto_address, ap_entry, __ATOMIC_RELEASE);
+    }
+
+    uint32_t expected = next_id - 1;
+    uint64_t timeout = pit_get_tsc_hz() * SMP_START_TIMEOUT_MS / 1000;
+    uint64_t start = rdtsc();
+    while (__atomic_load_n(&started_cpus, __ATOMIC_ACQUIRE) < expected &&
+           rdtsc() - start < timeout) {
+        cpu_relax();
+    }
+
+    uint32_t started = __atomic_load_n(&started_cpus, __ATOMIC_ACQUIRE);
+    uint32_t online = started + 1; // At most MAX_CPUS: two digits
+    serial_write_string("SMP: ");
+    if (online >= 10) {
+        serial_putchar('0' + online / 10);
+    }
+    serial_putchar('0' + online % 10);
+    serial_write_string(" CPUs online\n");
+    if (started < expected) {
+        serial_write_string("SMP: some CPUs did not start\n");
+    }
+    return true;
+}
+
+// --- TLB Shootdown ---
+
+// Acts on the current shootdown if it is waiting for this CPU.
+// Interrupts must be off.
+static void tlb_shootdown_poll(void) {
+    uint32_t bit = 1u << cpu_id();
+    if (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) & bit) {
+        vmm_flush_tlb_local(tlb_write_back);
+        __atomic_and_fetch(&tlb_pending, ~bit, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief TLB_SHOOTDOWN_VECTOR handler. An IPI can arrive after its
+ * request was already answered by tlb_shootdown_poll(); that is harmless.
+ */
+void smp_tlb_shootdown_ipi(void) {
+    lapic_eoi();
+    tlb_shootdown_poll();
+}
+
+void smp_flush_tlb_others(bool write_back) {
+    uint64_t irq = irq_save();
+
+    // Another CPU may be waiting for us to flush with interrupts off
+    // (or for the lock with them off): keep answering while we wait
+    while (!spin_trylock(&tlb_lock)) {
+        tlb_shootdown_poll();
+        cpu_relax();
+    }
+
+    uint32_t others = __atomic_load_n(&tlb_cpus, __ATOMIC_SEQ_CST) & ~(1u << cpu_id());
+    if (others != 0) {
+        tlb_write_back = write_back;
+        __atomic_store_n(&tlb_pending, others, __ATOMIC_RELEASE);
+        for (uint32_t i = 0; i < MAX_CPUS; i++) {
+            if (others & (1u << i)) {
+                lapic_send_ipi(cpu_locals[i].lapic_id, TLB_SHOOTDOWN_VECTOR);
+            }
+        }
+        while (__atomic_load_n(&tlb_pending, __ATOMIC_ACQUIRE) != 0) {
+            cpu_relax();
+        }
+    }
+
+    spin_unlock(&tlb_lock);
+    irq_restore(irq);
+}
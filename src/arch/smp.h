@@ -0,0 +1,42 @@
+#ifndef __SMP_H__
+#define __SMP_H__
+
+#include <stdbool.h>
+#include <limine.h>
+
+// --- Multiprocessor Startup ---
+// The bootloader parks the application processors (APs) and starts each
+// one at an address we give it. Every AP then sets up its own GDT/TSS,
+// per-CPU block, page map, FPU and local APIC, gets an idle task and
+// joins the scheduler with its local APIC timer running.
+
+/**
+ * @brief Points the boot CPU's GS base at cpu_locals[0]. Call right
+ * after gdt_init(), before anything uses cpu_id().
+ */
+void smp_init_bsp(void);
+
+/**
+ * @brief Starts the application processors (at most MAX_CPUS CPUs in
+ * total) and waits for them to come up. Call after task_init() and
+ * tick_init().
+ * @return false if there is no SMP response or the CPUs cannot have
+ * their own timers (the kernel then runs on the boot CPU only).
+ */
+bool smp_init(struct limine_smp_response* smp);
+
+// --- TLB Shootdown ---
+// Kernel-half mappings are shared, and global, on every CPU: changing
+// or removing one leaves stale translations in the other CPUs' TLBs
+// until they are told to flush.
+
+/**
+ * @brief Makes every other online CPU flush its whole TLB (and, with
+ * `write_back`, write back and invalidate its caches first), and waits
+ * until they all have. Does nothing before the APs are started.
+ * Call with no spinlocks held: a CPU spinning on one with interrupts
+ * off would never answer.
+ */
+void smp_flush_tlb_others(bool write_back);
+
+#endif // __SMP_H__
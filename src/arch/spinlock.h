@@ -0,0 +1,44 @@
+#ifndef __SPINLOCK_H__
+#define __SPINLOCK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+// A simple test-and-test-and-set spinlock
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(spinlock_t* lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) != 0) {
+        while (lock->locked) {
+            cpu_relax();
+        }
+    }
+}
+
+// Take the lock only if it is free; returns whether it was taken
+static inline bool spin_trylock(spinlock_t* lock) {
+    return lock->locked == 0 && __atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+// Take the lock with interrupts disabled, returning the old RFLAGS
+static inline uint64_t spin_lock_irqsave(spinlock_t* lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif // __SPINLOCK_H__
@@ -2,6 +2,7 @@
 #include "serialport.h"   // For debugging
 #include "framebuffer.h"  // For fb_print
 #include "string.h"   // For strlen (or just a simple one)
+#include "fpu.h"      // The caller's vector registers are not saved
 
 // A simple strlen just for this test
 static size_t simple_strlen(const char* s) {
@@ -22,6 +23,9 @@ void __attribute__((used)) syscall_handler(struct registers* regs) {
     uint64_t syscall_num = regs->rax;
     uint64_t ret_val = 0;
 
+    // Like an interrupt handler: SSE use here must not clobber the caller
+    fpu_irq_enter();
+
     switch (syscall_num) {
 
         /**
@@ -63,6 +67,8 @@ void __attribute__((used)) syscall_handler(struct registers* regs) {
         break;
     }
 
+    fpu_irq_exit();
+
     // The return value is passed back to the caller in RAX
     regs->rax = ret_val;
 }
\ No newline at end of file
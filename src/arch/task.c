@@ -1,145 +1,1173 @@
 #include "task.h"
 #include "pmm.h"
 #include "vmm.h"
+#include "slab.h"
 #include "heap.h"
 #include "serialport.h"
 #include "string.h"
 #include "framebuffer.h"
 #include "timer.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "fpu.h"
+#include "lapic.h"
+#include "tick.h"
 
-// The currently running task
-volatile task_t* current_task = NULL;
+// --- Run Queues ---
+// One per CPU: a FIFO per priority plus a bitmap of the non-empty ones,
+// so the scheduler finds the highest ready priority with one bit scan
+// however many tasks exist. Only READY tasks are queued: the running
+// task, sleeping and dead ones are not. A task belongs to the run queue
+// of task->cpu, whose lock also guards its state.
+//
+// A CPU that is about to idle steals half of the ready tasks of the
+// busiest other CPU (see rq_steal()).
+typedef struct {
+    spinlock_t lock;
+    task_t* head[TASK_NUM_PRIORITIES];
+    task_t* tail[TASK_NUM_PRIORITIES];
+    uint32_t bitmap;            // Bit p set: head[p] != NULL
+    uint32_t count;
+    uint32_t nr_tasks;          // Tasks on this CPU (any state but DEAD), for placement
+    task_t* idle;               // Runs when no other task is ready; never queued
+    uint64_t steals;            // Tasks this CPU took from others
+    uint64_t stolen;            // Tasks others took from this CPU
+    uint64_t steal_attempts;    // Times it went looking for work
+} __attribute__((aligned(KMEM_CACHE_LINE))) run_queue_t;
 
-// The head of the "run queue" (linked list of ready tasks)
-static task_t* task_queue = NULL;
+static run_queue_t run_queues[MAX_CPUS];
 
+// CPUs that run tasks (bit n: CPU n has its idle task)
+static uint32_t online_cpus = 0;
+
+// Taken atomically: every CPU creates tasks
 static int64_t next_pid = 0;
 
+// task_t objects, cache-line aligned and kept zeroed while free
+static kmem_cache_t* task_cache = NULL;
+
+static void task_ctor(void* obj) {
+    memset(obj, 0, sizeof(task_t));
+}
+
+// --- Context Switch ---
+// A switched-out task's RSP points at this frame, pushed by
+// switch_context(). The rip slot sits at the top of a new task's
+// stack, so the trampoline starts with the stack 16-byte aligned.
+struct switch_frame {
+    uint64_t r15, r14, r13, r12, rbx, rbp;
+    uint64_t rip;
+};
+
+extern void switch_context(uint64_t* old_rsp, uint64_t new_rsp);
+extern void task_trampoline(void);
+
+// The task each CPU last switched away from, for task_switch_finish()
+static task_t* switched_from[MAX_CPUS];
+
+// Tick up to which each CPU charged its running task's time slice
+static uint64_t slice_tick[MAX_CPUS];
+
+// How often (in ticks) the idle task hands cached slab objects back
+#define IDLE_REAP_TICKS 100
+
+// Tick at which each CPU's idle task reaps next; a tickless idle CPU
+// sets its timer for it
+static uint64_t idle_next_reap[MAX_CPUS];
+
+// --- Dead Tasks ---
+// A task cannot free the stack it is running on, so task_exit() only
+// marks it dead; the task that runs next queues it here once the switch
+// is done, and the reaper task frees it.
+// Freed stacks are kept (most recent first) for the next create_task(),
+// which then skips the PMM and gets a stack that is likely still cached.
+#define TASK_STACK_CACHE_SIZE 32
+
+static task_t* dead_tasks = NULL;          // Linked by `next`
+static spinlock_t dead_lock = SPINLOCK_INIT;
+static wait_queue_t reaper_wq = WAIT_QUEUE_INIT;
+
+static uint8_t* stack_cache[TASK_STACK_CACHE_SIZE];
+static uint32_t stack_cache_count = 0;
+static spinlock_t stack_cache_lock = SPINLOCK_INIT;
+
+static task_stats_t task_stats;            // Updated with atomics
+
+static void rq_push(run_queue_t* rq, task_t* task) {
+    unsigned int prio = task->priority;
+    task->next = NULL;
+    task->prev = rq->tail[prio];
+    if (rq->tail[prio] != NULL) {
+        rq->tail[prio]->next = task;
+    } else {
+        rq->head[prio] = task;
+        rq->bitmap |= 1u << prio;
+    }
+    rq->tail[prio] = task;
+    rq->count++;
+}
+
+static void rq_remove(run_queue_t* rq, task_t* task) {
+    unsigned int prio = task->priority;
+    if (task->prev != NULL) {
+        task->prev->next = task->next;
+    } else {
+        rq->head[prio] = task->next;
+    }
+    if (task->next != NULL) {
+        task->next->prev = task->prev;
+    } else {
+        rq->tail[prio] = task->prev;
+    }
+    if (rq->head[prio] == NULL) {
+        rq->bitmap &= ~(1u << prio);
+    }
+    task->next = task->prev = NULL;
+    rq->count--;
+}
+
+// Highest priority with a ready task, or -1
+static int rq_top_priority(const run_queue_t* rq) {
+    return rq->bitmap ? 31 - __builtin_clz(rq->bitmap) : -1;
+}
+
+// Takes the first task of the highest ready priority, or NULL
+static task_t* rq_pop(run_queue_t* rq) {
+    int prio = rq_top_priority(rq);
+    if (prio < 0) {
+        return NULL;
+    }
+    task_t* task = rq->head[prio];
+    rq_remove(rq, task);
+    return task;
+}
+
+/**
+ * @brief Locks the run queue `task` belongs to, with interrupts off.
+ * Only READY tasks change CPU, under the lock of their old queue, so
+ * check the CPU again once the lock is held.
+ */
+static run_queue_t* task_rq_lock(task_t* task, uint64_t* irq) {
+    for (;;) {
+        uint32_t cpu = __atomic_load_n(&task->cpu, __ATOMIC_RELAXED);
+        run_queue_t* rq = &run_queues[cpu];
+        *irq = spin_lock_irqsave(&rq->lock);
+        if (__atomic_load_n(&task->cpu, __ATOMIC_RELAXED) == cpu) {
+            return rq;
+        }
+        spin_unlock_irqrestore(&rq->lock, *irq);
+    }
+}
+
+/**
+ * @brief Locks the run queue of `task` and that of CPU `cpu` (once if
+ * they are the same), lower CPU first so two CPUs doing this at the
+ * same time cannot deadlock.
+ * @return The queue `task` belongs to.
+ */
+static run_queue_t* task_rq_lock_with(task_t* task, uint32_t cpu, uint64_t* irq) {
+    *irq = irq_save();
+    for (;;) {
+        uint32_t from = __atomic_load_n(&task->cpu, __ATOMIC_RELAXED);
+        uint32_t first = from < cpu ? from : cpu;
+        uint32_t second = from < cpu ? cpu : from;
+        spin_lock(&run_queues[first].lock);
+        if (second != first) {
+            spin_lock(&run_queues[second].lock);
+        }
+        if (__atomic_load_n(&task->cpu, __ATOMIC_RELAXED) == from) {
+            return &run_queues[from];
+        }
+        if (second != first) {
+            spin_unlock(&run_queues[second].lock);
+        }
+        spin_unlock(&run_queues[first].lock);
+    }
+}
+
+static void rq_unlock_with(run_queue_t* rq, uint32_t cpu, uint64_t irq) {
+    if (rq != &run_queues[cpu]) {
+        spin_unlock(&run_queues[cpu].lock);
+    }
+    spin_unlock_irqrestore(&rq->lock, irq);
+}
+
+/**
+ * @brief Moves a task that is not on a CPU from `from` to CPU `cpu`.
+ * Both queues must be locked.
+ */
+static void rq_migrate(run_queue_t* from, uint32_t cpu, task_t* task) {
+    run_queue_t* to = &run_queues[cpu];
+    bool ready = (task->state == TASK_STATE_READY);
+    if (ready) {
+        rq_remove(from, task);
+    }
+    from->nr_tasks--;
+    __atomic_store_n(&task->cpu, cpu, __ATOMIC_RELAXED);
+    to->nr_tasks++;
+    if (ready) {
+        rq_push(to, task);
+    }
+}
+
+/**
+ * @brief Takes about half of the ready tasks of the busiest other CPU,
+ * highest priorities first, skipping tasks whose affinity excludes this
+ * CPU. Called by a CPU about to idle, with its own queue locked; the
+ * victim's lock is only tried, so CPUs stealing from each other cannot
+ * deadlock (a busy victim is simply tried again later).
+ * @return The number of tasks taken.
+ */
+static uint32_t rq_steal(run_queue_t* rq, uint32_t cpu) {
+    uint32_t online = __atomic_load_n(&online_cpus, __ATOMIC_ACQUIRE);
+    uint32_t victim = cpu, most = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (i == cpu || !(online & (1u << i))) {
+            continue;
+        }
+        uint32_t queued = __atomic_load_n(&run_queues[i].count, __ATOMIC_RELAXED);
+        if (queued > most) {
+            victim = i;
+            most = queued;
+        }
+    }
+    if (victim == cpu) {
+        return 0;
+    }
+
+    run_queue_t* from = &run_queues[victim];
+    rq->steal_attempts++;
+    if (!spin_trylock(&from->lock)) {
+        return 0;
+    }
+    uint32_t want = (from->count + 1) / 2;
+    uint32_t taken = 0;
+    for (int prio = TASK_NUM_PRIORITIES - 1; prio >= 0 && taken < want; prio--) {
+        // From the back: those would have waited longest over there
+        task_t* task = from->tail[prio];
+        while (task != NULL && taken < want) {
+            task_t* before = task->prev;
+            if (task->affinity & (1u << cpu)) {
+                rq_migrate(from, cpu, task);
+                taken++;
+            }
+            task = before;
+        }
+    }
+    from->stolen += taken;
+    spin_unlock(&from->lock);
+    rq->steals += taken;
+    return taken;
+}
+
+/**
+ * @brief Makes CPU `cpu` look at its run queue now, after a task became
+ * ready there, if it is idling or running something less important
+ * (this CPU too: the IPI arrives once interrupts are back on). If it
+ * stays busy, an idle CPU is woken to steal the task instead. Without
+ * a local APIC the next tick does all this.
+ */
+static void rq_kick(uint32_t cpu, const task_t* ready) {
+    if (!lapic_available()) {
+        return;
+    }
+    task_t* running = __atomic_load_n(&cpu_locals[cpu].current_task, __ATOMIC_RELAXED);
+    if (running == run_queues[cpu].idle || running == NULL || running->priority < ready->priority) {
+        lapic_send_ipi(cpu_locals[cpu].lapic_id, RESCHED_VECTOR);
+        return;
+    }
+    if (ready->affinity == (1u << cpu)) {
+        return; // Nobody else may run it
+    }
+    uint32_t online = __atomic_load_n(&online_cpus, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (i == cpu || !(online & (1u << i)) || !(ready->affinity & (1u << i))) {
+            continue;
+        }
+        if (__atomic_load_n(&cpu_locals[i].current_task, __ATOMIC_RELAXED) == run_queues[i].idle) {
+            lapic_send_ipi(cpu_locals[i].lapic_id, RESCHED_VECTOR);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Picks the online CPU in `mask` with the fewest tasks. Ties go
+ * round-robin, so a burst of new tasks spreads out.
+ */
+static uint32_t pick_cpu(uint32_t mask) {
+    static uint32_t rotor = 0;
+    uint32_t online = __atomic_load_n(&online_cpus, __ATOMIC_ACQUIRE) & mask;
+    uint32_t start = __atomic_fetch_add(&rotor, 1, __ATOMIC_RELAXED);
+    uint32_t best = 0, best_tasks = UINT32_MAX;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        uint32_t cpu = (start + i) % MAX_CPUS;
+        if (!(online & (1u << cpu))) {
+            continue;
+        }
+        uint32_t tasks = __atomic_load_n(&run_queues[cpu].nr_tasks, __ATOMIC_RELAXED);
+        if (tasks < best_tasks) {
+            best = cpu;
+            best_tasks = tasks;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Queues a READY task that may not stay on this CPU on the
+ * least loaded one it may run on. Called with this CPU's queue locked;
+ * the other lock is only tried.
+ * @return false if that failed (the caller keeps it here for now).
+ */
+static bool rq_push_away(run_queue_t* rq, task_t* task) {
+    uint32_t allowed = task->affinity & __atomic_load_n(&online_cpus, __ATOMIC_ACQUIRE);
+    if (allowed == 0) {
+        return false;
+    }
+    uint32_t cpu = pick_cpu(allowed);
+    run_queue_t* to = &run_queues[cpu];
+    if (!spin_trylock(&to->lock)) {
+        return false;
+    }
+    rq->nr_tasks--;
+    __atomic_store_n(&task->cpu, cpu, __ATOMIC_RELAXED);
+    to->nr_tasks++;
+    rq_push(to, task);
+    spin_unlock(&to->lock);
+    rq_kick(cpu, task);
+    return true;
+}
+
 // A simple kernel "idle task"
+// When there is nothing else to do it pre-zeroes pages for
+// pmm_alloc_zeroed_page(), trims the slab caches now and then, and halts
+// once the pool is full.
 static void idle_task_body(void) {
     serial_write_string("Idle task started.\n");
+    uint32_t cpu = cpu_id(); // Idle tasks never move
     for (;;) {
-        __asm__ volatile ("sti; hlt");
+        if (get_ticks() >= idle_next_reap[cpu]) {
+            kmem_cache_reap();
+            idle_next_reap[cpu] = get_ticks() + IDLE_REAP_TICKS;
+        }
+        if (pmm_zero_pool_refill(1) == 0) {
+            __asm__ volatile ("sti; hlt");
+        }
     }
 }
 
 /**
- * @brief Creates a new kernel task (shares kernel page map)
+ * @brief Takes a kernel stack (physical address), preferring a cached one.
  */
-task_t* create_task(void (*entry_point)(void)) {
-    // Allocate the task_t structure
-    task_t* task = (task_t*)kmalloc(sizeof(task_t));
-    if (task == NULL) return NULL;
+static uint8_t* stack_alloc(void) {
+    uint8_t* stack = NULL;
+    uint64_t irq = spin_lock_irqsave(&stack_cache_lock);
+    if (stack_cache_count > 0) {
+        stack = stack_cache[--stack_cache_count];
+    }
+    spin_unlock_irqrestore(&stack_cache_lock, irq);
 
-    memset(task, 0, sizeof(task_t));
+    if (stack != NULL) {
+        __atomic_add_fetch(&task_stats.stack_hits, 1, __ATOMIC_RELAXED);
+        return stack;
+    }
+    __atomic_add_fetch(&task_stats.stack_misses, 1, __ATOMIC_RELAXED);
+    stack = (uint8_t*)pmm_alloc_zeroed_pages(KERNEL_STACK_ORDER);
+    if (stack != NULL) {
+        pmm_set_page_owner(stack, PAGE_OWNER_STACK);
+    }
+    return stack;
+}
+
+static void stack_free(uint8_t* stack) {
+    uint64_t irq = spin_lock_irqsave(&stack_cache_lock);
+    if (stack_cache_count < TASK_STACK_CACHE_SIZE) {
+        stack_cache[stack_cache_count++] = stack;
+        stack = NULL;
+    }
+    spin_unlock_irqrestore(&stack_cache_lock, irq);
+
+    if (stack != NULL) {
+        pmm_free_pages(stack, KERNEL_STACK_ORDER);
+    }
+}
+
+/**
+ * @brief Builds a task (stack, initial frame) without making it runnable.
+ */
+static task_t* task_alloc(void (*entry_point)(void)) {
+    // Take a (constructed, zeroed) task_t from the cache
+    task_t* task = (task_t*)kmem_cache_alloc(task_cache);
+    if (task == NULL) return NULL;
 
-    // Allocate a kernel stack
-    task->kernel_stack = (uint8_t*)pmm_alloc_page();
+    // Get a kernel stack (fresh pages are zeroed, cached ones are not)
+    task->kernel_stack = stack_alloc();
     if (task->kernel_stack == NULL) {
-        kfree(task);
+        kmem_cache_free(task_cache, task);
         return NULL;
     }
 
-    // Stack grows downwards. Set the pointer to the *top* of the stack.
-    // Add VIRTUAL_MEMORY_OFFSET to get the virtual address.
-    task->kernel_stack_ptr = (uint64_t)task->kernel_stack + KERNEL_STACK_SIZE + VIRTUAL_MEMORY_OFFSET;
-
-    // Set up the initial stack frame for 'iretq'
-    // Move stack pointer down to make space for a struct registers
-    task->kernel_stack_ptr -= sizeof(struct registers);
+    // Save area for the vector registers, loaded on first use
+    task->fpu_state = fpu_state_alloc();
+    if (task->fpu_state == NULL) {
+        stack_free(task->kernel_stack);
+        memset(task, 0, sizeof(task_t));
+        kmem_cache_free(task_cache, task);
+        return NULL;
+    }
 
-    // 2. Get a pointer * to this new stack frame *
-    struct registers* frame = (struct registers*)task->kernel_stack_ptr;
+    // Stack grows downwards: build the first switch frame at the top.
+    // Add VIRTUAL_MEMORY_OFFSET to get the virtual address.
+    uint64_t stack_top = (uint64_t)task->kernel_stack + KERNEL_STACK_SIZE + VIRTUAL_MEMORY_OFFSET;
+    struct switch_frame* frame = (struct switch_frame*)(stack_top - sizeof(struct switch_frame));
 
-    // 3. Zero out the entire frame to avoid garbage values
-    memset(frame, 0, sizeof(struct registers));
+    // A reused stack holds old data: clear the frame
+    memset(frame, 0, sizeof(*frame));
 
-    // 4. Now, write the values for 'iretq' *directly to the stack*
-    frame->rip = (uint64_t)entry_point; // Set instruction pointer
-    frame->rflags = 0x202; // Enable interrupts (IF flag)
-    frame->cs = 0x08; // Kernel Code Segment
-    frame->ss = 0x10; // Kernel Data Segment
-    frame->rsp = task->kernel_stack_ptr + sizeof(struct registers);
+    // switch_context() pops the registers and returns into the
+    // trampoline, which calls the entry function (in rbx) with
+    // interrupts on, and task_exit() if it returns
+    frame->rip = (uint64_t)task_trampoline;
+    frame->rbx = (uint64_t)entry_point;
+    task->kernel_stack_ptr = (uint64_t)frame;
 
     // Set other fields
-    task->pid = next_pid++;
+    task->pid = __atomic_fetch_add(&next_pid, 1, __ATOMIC_RELAXED);
     task->state = TASK_STATE_READY;
-    task->pml4 = vmm_get_kernel_pml4(); // All kernel tasks share Paging
+    task->space = vmm_get_kernel_space(); // All kernel tasks share Paging
+    task->priority = TASK_PRIORITY_DEFAULT;
+    task->affinity = TASK_AFFINITY_ALL;
+    task->time_slice = TASK_TIME_SLICE_DEFAULT;
+    task->slice_left = task->time_slice;
+
+    __atomic_add_fetch(&task_stats.created, 1, __ATOMIC_RELAXED);
+    return task;
+}
+
+/**
+ * @brief Gives a dead task's stack and task_t back. It must be off the CPU.
+ */
+static void task_free(task_t* task) {
+    stack_free(task->kernel_stack);
+    fpu_state_free(task->fpu_state);
+
+    // task_t objects go back to the cache zeroed
+    memset(task, 0, sizeof(task_t));
+    kmem_cache_free(task_cache, task);
+    __atomic_add_fetch(&task_stats.reaped, 1, __ATOMIC_RELAXED);
+}
+
+// Frees dead tasks, sleeping while there are none
+static void reaper_task_body(void) {
+    for (;;) {
+        wait_event(reaper_wq, __atomic_load_n(&dead_tasks, __ATOMIC_ACQUIRE) != NULL);
 
-    // Add to the task queue
-    if (task_queue == NULL) {
-        task_queue = task;
-        task->next = task; // Points to itself (circular)
+        uint64_t irq = spin_lock_irqsave(&dead_lock);
+        task_t* list = dead_tasks;
+        dead_tasks = NULL;
+        spin_unlock_irqrestore(&dead_lock, irq);
+
+        // task_switch_finish() queues a task only once it is off its stack
+        while (list != NULL) {
+            task_t* task = list;
+            list = task->next;
+            task_free(task);
+        }
     }
-    else {
-        task->next = task_queue->next;
-        task_queue->next = task;
+}
+
+/**
+ * @brief Queues a new task on CPU `cpu`.
+ */
+static void task_start(task_t* task, uint32_t cpu) {
+    task->cpu = cpu;
+    run_queue_t* rq = &run_queues[cpu];
+    uint64_t irq = spin_lock_irqsave(&rq->lock);
+    rq_push(rq, task);
+    rq->nr_tasks++;
+    spin_unlock_irqrestore(&rq->lock, irq);
+    rq_kick(cpu, task);
+}
+
+/**
+ * @brief Creates a new kernel task (shares kernel page map)
+ */
+task_t* create_task(void (*entry_point)(void)) {
+    task_t* task = task_alloc(entry_point);
+    if (task == NULL) {
+        return NULL;
     }
+    task_start(task, pick_cpu(TASK_AFFINITY_ALL));
+    return task;
+}
 
+task_t* create_task_on(void (*entry_point)(void), unsigned int cpu) {
+    if (cpu >= MAX_CPUS || !(__atomic_load_n(&online_cpus, __ATOMIC_ACQUIRE) & (1u << cpu))) {
+        cpu = pick_cpu(TASK_AFFINITY_ALL);
+    }
+    task_t* task = task_alloc(entry_point);
+    if (task == NULL) {
+        return NULL;
+    }
+    task->affinity = 1u << cpu;
+    task_start(task, cpu);
     return task;
 }
 
+bool task_set_affinity(task_t* task, uint32_t mask) {
+    if ((mask & __atomic_load_n(&online_cpus, __ATOMIC_ACQUIRE)) == 0) {
+        return false;
+    }
+    // Where it goes if it has to move (a CPU it may stay on is fine too)
+    uint32_t cpu = pick_cpu(mask);
+    uint64_t irq;
+    run_queue_t* rq = task_rq_lock_with(task, cpu, &irq);
+    bool moved = false;
+    if (task == rq->idle) {
+        rq_unlock_with(rq, cpu, irq);
+        return false;
+    }
+    task->affinity = mask;
+    // A task on a CPU moves at its next switch (see schedule())
+    if (!(mask & (1u << task->cpu)) && !task->on_cpu && task->state != TASK_STATE_DEAD) {
+        rq_migrate(rq, cpu, task);
+        moved = (task->state == TASK_STATE_READY);
+    }
+    rq_unlock_with(rq, cpu, irq);
+    if (moved) {
+        rq_kick(cpu, task);
+    }
+    return true;
+}
+
+void task_set_priority(task_t* task, unsigned int priority) {
+    if (priority >= TASK_NUM_PRIORITIES) {
+        return;
+    }
+    uint64_t irq;
+    run_queue_t* rq = task_rq_lock(task, &irq);
+    if (task == rq->idle) {
+        // Idle stays below everything
+    } else if (task->state == TASK_STATE_READY) {
+        // Move it to the queue of its new priority
+        rq_remove(rq, task);
+        task->priority = priority;
+        rq_push(rq, task);
+    } else {
+        task->priority = priority;
+    }
+    spin_unlock_irqrestore(&rq->lock, irq);
+}
+
+void task_set_time_slice(task_t* task, uint32_t ticks) {
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    uint64_t irq;
+    run_queue_t* rq = task_rq_lock(task, &irq);
+    task->time_slice = ticks;
+    if (task->slice_left > ticks) {
+        task->slice_left = ticks;
+    }
+    spin_unlock_irqrestore(&rq->lock, irq);
+}
+
+bool task_get_cpu_stats(unsigned int cpu, task_cpu_stats_t* stats) {
+    if (cpu >= MAX_CPUS || !(__atomic_load_n(&online_cpus, __ATOMIC_ACQUIRE) & (1u << cpu))) {
+        return false;
+    }
+    run_queue_t* rq = &run_queues[cpu];
+    uint64_t irq = spin_lock_irqsave(&rq->lock);
+    stats->queued = rq->count;
+    stats->tasks = rq->nr_tasks;
+    stats->steals = rq->steals;
+    stats->stolen = rq->stolen;
+    stats->steal_attempts = rq->steal_attempts;
+    spin_unlock_irqrestore(&rq->lock, irq);
+    return true;
+}
+
+unsigned int task_online_cpus(void) {
+    // No libgcc for __builtin_popcount(): clear the lowest bit until none are left
+    uint32_t online = __atomic_load_n(&online_cpus, __ATOMIC_ACQUIRE);
+    unsigned int count = 0;
+    for (; online != 0; online &= online - 1) {
+        count++;
+    }
+    return count;
+}
+
 /**
  * @brief Initializes the tasking system
  */
 void task_init(void) {
     serial_write_string("Initializing multitasking...\n");
 
-    // Create the idle task
-    task_t* idle_task = create_task(idle_task_body);
-    if (idle_task == NULL) {
+    task_cache = kmem_cache_create("task_t", sizeof(task_t), 0, task_ctor);
+    if (task_cache == NULL) {
+        serial_write_string("PANIC: Failed to create the task cache!\n");
+        for (;;) __asm__ volatile ("cli; hlt");
+    }
+
+    for (int i = 0; i < MAX_CPUS; i++) {
+        run_queues[i].lock = (spinlock_t)SPINLOCK_INIT;
+    }
+
+    // The boot context becomes CPU 0's idle task
+    task_init_cpu();
+
+    if (create_task_on(reaper_task_body, 0) == NULL) {
+        serial_write_string("PANIC: Failed to create the reaper task!\n");
+        for (;;) __asm__ volatile ("cli; hlt");
+    }
+
+    serial_write_string("Multitasking initialized.\n");
+}
+
+void task_init_cpu(void) {
+    uint32_t cpu = cpu_id();
+
+    // Create the idle task (it stays off the run queue)
+    task_t* idle = task_alloc(idle_task_body);
+    if (idle == NULL) {
         serial_write_string("PANIC: Failed to create idle task!\n");
         // We can't continue without a task
         for (;;) __asm__ volatile ("cli; hlt");
     }
+    idle->cpu = cpu;
+    idle->affinity = 1u << cpu;
+    idle->priority = 0;
+    run_queues[cpu].idle = idle;
 
     // Set it as the "running" task
-    current_task = idle_task;
-    current_task->state = TASK_STATE_RUNNING;
+    idle->state = TASK_STATE_RUNNING;
+    idle->on_cpu = true;
+    cpu_local()->current_task = idle;
+    fpu_set_boot_owner(idle);
 
-    serial_write_string("Multitasking initialized.\n");
+    // From now on create_task() may place tasks here
+    __atomic_fetch_or(&online_cpus, 1u << cpu, __ATOMIC_RELEASE);
 }
 
 /**
- * @brief The main scheduler function.
- * Called by the timer interrupt assembly stub.
- *
- * @param old_regs A pointer to the saved registers on the old task's stack.
- * @return The stack pointer (RSP) of the *new* task to switch to.
- */
-void* __attribute__((used)) schedule_and_switch(struct registers* old_regs) {
-    // Increment the global timer tick. This is the new home
-    // for this logic.
-    timer_tick();
-    if (current_task == NULL) {
+ * @brief Turns the boot context into the idle loop.
+ * The first switch away saves this context as the idle task's.
+ */
+void task_run_idle(void) {
+    idle_task_body();
+}
+
+/**
+ * @brief Asks for a timer interrupt when the running task's slice ends
+ * (none for the idle task). Interrupts off.
+ */
+static void schedule_arm_timer(void) {
+    uint32_t cpu = cpu_id();
+    task_t* current = cpu_local()->current_task;
+    if (current == run_queues[cpu].idle) {
+        // Wake the idle loop for its next slab reap (if that is overdue,
+        // it reaps before it halts again)
+        uint64_t soonest = get_ticks() + 1;
+        uint64_t reap = idle_next_reap[cpu];
+        tick_program(reap > soonest ? reap : soonest);
+    } else {
+        tick_program(slice_tick[cpu] + current->slice_left);
+    }
+}
+
+/**
+ * @brief Runs on the new task right after a switch: the old task's RSP
+ * is saved now, so it may run elsewhere or be freed.
+ */
+void __attribute__((used)) task_switch_finish(void) {
+    task_t* prev = switched_from[cpu_id()];
+    __atomic_store_n(&prev->switching, false, __ATOMIC_RELEASE);
+    if (prev->state == TASK_STATE_DEAD) {
+        // Nothing runs on its stack any more: hand it to the reaper
+        spin_lock(&dead_lock);
+        prev->next = dead_tasks;
+        dead_tasks = prev;
+        spin_unlock(&dead_lock);
+        wake_up(&reaper_wq);
+    }
+    schedule_arm_timer();
+}
+
+/**
+ * @brief Picks the task to run next and switches to it.
+ * Called with interrupts off. If it switches, it returns only when the
+ * current task is picked again.
+ * @param tick true from an interrupt (the timer or a reschedule IPI): the
+ * task is preempted only by a higher priority or at the end of its slice.
+ * false from task_yield().
+ */
+static void schedule(bool tick) {
+    uint32_t cpu = cpu_id();
+    run_queue_t* rq = &run_queues[cpu];
+    task_t* prev = cpu_local()->current_task;
+    if (prev == NULL) {
         // This should *never* happen if task_init() ran.
-        // But if it does, just return the same stack.
-        return (void*)old_regs;
+        return;
     }
 
-    // 1. Save the old task's context
-    // The assembly stub saved the registers *on the stack*.
-    // We just need to save the *pointer* to that stack frame.
-    current_task->regs = *old_regs;
-    current_task->kernel_stack_ptr = (uint64_t)old_regs;
+    spin_lock(&rq->lock);
+
+    if (tick && prev->state == TASK_STATE_SLEEPING) {
+        // Preempted between deciding to sleep and yielding (wait_event()
+        // checks its condition in that window): keep it runnable, the
+        // caller's loop decides again
+        prev->state = TASK_STATE_RUNNING;
+    }
 
-    // 2. Find the next task to run (simple round-robin)
-    task_t* next = current_task->next;
-    while (next->state != TASK_STATE_READY && next != current_task) {
-        // Note: This is a potential deadlock if all tasks are SLEEPING.
-        // For now, our idle_task is always READY.
-        next = next->next;
+    // Nothing left here but idling: look for work on the other CPUs
+    if (rq->count == 0 && (prev == rq->idle || prev->state != TASK_STATE_RUNNING)) {
+        rq_steal(rq, cpu);
     }
 
-    // 3. Update task states
-    if (current_task->state == TASK_STATE_RUNNING) {
-        current_task->state = TASK_STATE_READY;
+    // 1. Keep running until the slice is used up, unless a task of
+    // higher priority became ready (or the task gave up the CPU). The
+    // timer does not fire every tick: charge all ticks since the last look.
+    uint64_t now = get_ticks();
+    uint64_t elapsed = now - slice_tick[cpu];
+    slice_tick[cpu] = now;
+    prev->slice_left = (elapsed < prev->slice_left) ? prev->slice_left - (uint32_t)elapsed : 0;
+    bool running = (prev->state == TASK_STATE_RUNNING);
+    int top = rq_top_priority(rq);
+    bool switch_now;
+    if (!running) {
+        switch_now = true;                  // Sleeping or dead: must go
+    } else if (prev == rq->idle) {
+        switch_now = (top >= 0);            // Anything beats idle
+    } else if (!tick) {
+        switch_now = top >= (int)prev->priority;
+    } else {
+        switch_now = top > (int)prev->priority ||
+                     (prev->slice_left == 0 && top == (int)prev->priority);
+    }
+    if (running && prev->slice_left == 0) {
+        prev->slice_left = prev->time_slice;
+    }
+    if (!switch_now) {
+        spin_unlock(&rq->lock);
+        schedule_arm_timer();
+        return;
     }
 
+    // 2. Pick the highest-priority ready task (O(1)); the old one goes
+    // to the back of its queue
+    task_t* next = rq_pop(rq);
+    if (next == NULL) {
+        next = rq->idle;
+    }
+    // Set before `prev` is queued anywhere: another CPU may pick it up
+    // as soon as it is, and must wait until its RSP is saved
+    prev->switching = true;
+    prev->on_cpu = false;
+    if (running && prev != rq->idle) {
+        prev->state = TASK_STATE_READY;
+        prev->slice_left = prev->time_slice;
+        if (!(prev->affinity & (1u << cpu)) && rq_push_away(rq, prev)) {
+            // Its affinity changed while it ran here
+        } else {
+            rq_push(rq, prev);
+        }
+    } else if (running) {
+        prev->state = TASK_STATE_READY;
+    }
+    next->on_cpu = true;
     next->state = TASK_STATE_RUNNING;
-    current_task = next;
+    spin_unlock(&rq->lock);
+
+    // 3. A task that just left another CPU may not have saved its RSP yet
+    while (__atomic_load_n(&next->switching, __ATOMIC_ACQUIRE)) {
+        cpu_relax();
+    }
+
+    if (next->space != prev->space) {
+        vmm_switch_space(next->space);
+    }
+    cpu_local()->current_task = next;
+    switched_from[cpu] = prev;
+
+    // Saves prev's vector registers if they are loaded (task.c itself is
+    // built without them, see GNUmakefile)
+    fpu_switch(prev);
+
+    // 4. Save the callee-saved registers and RSP, resume `next`. The
+    // caller's interrupt frame (if any) stays on this task's stack.
+    switch_context(&prev->kernel_stack_ptr, next->kernel_stack_ptr);
+
+    // Picked again: back on our own stack
+    task_switch_finish();
+}
+
+/**
+ * @brief The main scheduler function.
+ * Called by the timer interrupt assembly stub, with the interrupted
+ * registers saved on the current task's stack.
+ */
+void __attribute__((used)) schedule_and_switch(void) {
+    // Count the tick and run expired timers (they may wake tasks)
+    tick_handle_pit();
+    schedule(true);
+}
+
+/**
+ * @brief Local APIC timer interrupt (one-shot, see tick.h). On the boot
+ * CPU it also runs the timers that expired.
+ */
+void __attribute__((used)) schedule_local_tick(void) {
+    tick_handle_timer();
+    schedule(true);
+}
+
+/**
+ * @brief Reschedule IPI: a task became ready here (or a timer was added
+ * that the boot CPU has to wake up for).
+ */
+void __attribute__((used)) schedule_ipi(void) {
+    tick_handle_ipi();
+    schedule(true);
+}
+
+// Where switch_bench_frame_switch() copies the frame (task_t.regs used
+// to hold it); volatile so that the copy is not optimised away
+static volatile struct registers switch_bench_regs;
+
+/**
+ * @brief Called by the switch benchmark stub (vector SWITCH_BENCH_VECTOR).
+ * Does what schedule_and_switch() did before switch_context(): copy the
+ * whole interrupt frame out of the stack, then pick the next task.
+ */
+void __attribute__((used)) switch_bench_frame_switch(struct registers* frame) {
+    switch_bench_regs = *frame;
+    schedule(false);
+}
+
+// --- Sleeping and Waking ---
+
+task_t* task_current(void) {
+    // One GS-relative load: cannot be split by a move to another CPU
+    task_t* task;
+    __asm__ volatile ("movq %%gs:%c1, %0" : "=r"(task) : "i"(offsetof(cpu_local_t, current_task)));
+    return task;
+}
+
+void task_yield(void) {
+    uint64_t irq = irq_save();
+    schedule(false);
+    irq_restore(irq);
+}
 
-    // 4. Return the new task's stack pointer
-    // The assembly stub will load this into RSP.
-    return (void*)current_task->kernel_stack_ptr;
-}
\ No newline at end of file
+void task_wake(task_t* task) {
+    // Normally it stays where it is; if its affinity changed while it
+    // ran, it moves now
+    uint32_t cpu = __atomic_load_n(&task->cpu, __ATOMIC_RELAXED);
+    if (!(task->affinity & (1u << cpu))) {
+        cpu = pick_cpu(task->affinity);
+    }
+    uint64_t irq;
+    run_queue_t* rq = task_rq_lock_with(task, cpu, &irq);
+    bool queued = false;
+    if (task->state == TASK_STATE_SLEEPING) {
+        if (task->on_cpu) {
+            // Has not switched away yet: it simply keeps running
+            task->state = TASK_STATE_RUNNING;
+        } else {
+            if (!(task->affinity & (1u << task->cpu))) {
+                rq_migrate(rq, cpu, task);
+            }
+            task->state = TASK_STATE_READY;
+            rq_push(&run_queues[task->cpu], task);
+            queued = true;
+        }
+    }
+    uint32_t target = task->cpu;
+    rq_unlock_with(rq, cpu, irq);
+    if (queued) {
+        rq_kick(target, task);
+    }
+}
+
+static void set_current_state(task_state_t state) {
+    task_t* self = task_current();
+    uint64_t irq;
+    run_queue_t* rq = task_rq_lock(self, &irq);
+    self->state = state;
+    spin_unlock_irqrestore(&rq->lock, irq);
+}
+
+static void sleep_timer_expired(ktimer_t* timer) {
+    task_wake((task_t*)timer->data);
+}
+
+void task_sleep_until(uint64_t tick) {
+    ktimer_t timer;
+    timer_init(&timer, sleep_timer_expired, task_current());
+
+    // Interrupts stay off from arming the timer to switching away, so
+    // the wakeup cannot come first
+    uint64_t irq = irq_save();
+    while (get_ticks() < tick) {
+        set_current_state(TASK_STATE_SLEEPING);
+        timer_add(&timer, tick);
+        task_yield();
+    }
+    timer_cancel(&timer);
+    irq_restore(irq);
+}
+
+void task_sleep_ticks(uint64_t ticks) {
+    task_sleep_until(get_ticks() + ticks);
+}
+
+// --- Exiting ---
+
+void task_exit(void) {
+    // Interrupts stay off until the switch: nothing may run this task
+    // again once it is DEAD
+    (void)irq_save();
+    task_t* self = task_current();
+    run_queue_t* rq = &run_queues[self->cpu];
+    if (self == rq->idle) {
+        serial_write_string("PANIC: The idle task cannot exit!\n");
+        for (;;) __asm__ volatile ("cli; hlt");
+    }
+
+    spin_lock(&rq->lock);
+    self->state = TASK_STATE_DEAD;
+    rq->nr_tasks--;
+    spin_unlock(&rq->lock);
+
+    // The task that runs next queues this one for the reaper
+    __atomic_add_fetch(&task_stats.exited, 1, __ATOMIC_RELAXED);
+    task_yield();
+
+    // The scheduler never picks a DEAD task
+    for (;;) __asm__ volatile ("cli; hlt");
+}
+
+void task_get_stats(task_stats_t* stats) {
+    stats->created = __atomic_load_n(&task_stats.created, __ATOMIC_RELAXED);
+    stats->exited = __atomic_load_n(&task_stats.exited, __ATOMIC_RELAXED);
+    stats->reaped = __atomic_load_n(&task_stats.reaped, __ATOMIC_RELAXED);
+    stats->stack_hits = __atomic_load_n(&task_stats.stack_hits, __ATOMIC_RELAXED);
+    stats->stack_misses = __atomic_load_n(&task_stats.stack_misses, __ATOMIC_RELAXED);
+
+    uint64_t irq = spin_lock_irqsave(&stack_cache_lock);
+    stats->cached_stacks = stack_cache_count;
+    spin_unlock_irqrestore(&stack_cache_lock, irq);
+}
+
+// --- Wait Queues ---
+
+void wait_queue_init(wait_queue_t* wq) {
+    wq->lock = (spinlock_t)SPINLOCK_INIT;
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+void prepare_to_wait(wait_queue_t* wq) {
+    task_t* self = task_current();
+    uint64_t irq = spin_lock_irqsave(&wq->lock);
+    if (self->wait_queue == NULL) {
+        self->wait_next = NULL;
+        if (wq->tail != NULL) {
+            wq->tail->wait_next = self;
+        } else {
+            wq->head = self;
+        }
+        wq->tail = self;
+        self->wait_queue = wq;
+    }
+    spin_unlock_irqrestore(&wq->lock, irq);
+    set_current_state(TASK_STATE_SLEEPING);
+}
+
+void finish_wait(wait_queue_t* wq) {
+    task_t* self = task_current();
+    set_current_state(TASK_STATE_RUNNING);
+
+    // Still queued if the condition came true without a wake_up()
+    uint64_t irq = spin_lock_irqsave(&wq->lock);
+    if (self->wait_queue == wq) {
+        task_t** link = &wq->head;
+        task_t* before = NULL;
+        while (*link != self) {
+            before = *link;
+            link = &(*link)->wait_next;
+        }
+        *link = self->wait_next;
+        if (wq->tail == self) {
+            wq->tail = before;
+        }
+        self->wait_queue = NULL;
+    }
+    spin_unlock_irqrestore(&wq->lock, irq);
+}
+
+static void wake_up_some(wait_queue_t* wq, bool all) {
+    uint64_t irq = spin_lock_irqsave(&wq->lock);
+    while (wq->head != NULL) {
+        task_t* task = wq->head;
+        wq->head = task->wait_next;
+        if (wq->head == NULL) {
+            wq->tail = NULL;
+        }
+        task->wait_queue = NULL;
+        task_wake(task);
+        if (!all) {
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&wq->lock, irq);
+}
+
+void wake_up(wait_queue_t* wq) {
+    wake_up_some(wq, true);
+}
+
+void wake_up_one(wait_queue_t* wq) {
+    wake_up_some(wq, false);
+}
+
+// --- Benchmark ---
+
+#define SCHED_BENCH_ROUNDS 1000
+
+bool task_sched_benchmark(uint32_t tasks, sched_bench_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    result->tasks = tasks;
+    if (tasks == 0) {
+        return false;
+    }
+
+    // Stand-ins: run queue fields only, no stacks
+    task_t** stand_ins = (task_t**)kmalloc(tasks * sizeof(task_t*));
+    if (stand_ins == NULL) {
+        return false;
+    }
+    uint32_t made = 0;
+    while (made < tasks) {
+        stand_ins[made] = (task_t*)kmem_cache_alloc(task_cache);
+        if (stand_ins[made] == NULL) {
+            break;
+        }
+        made++;
+    }
+
+    if (made == tasks) {
+        uint64_t irq = irq_save();
+
+        // Old scheduler: circular list of every task, one of them ready.
+        // Each pick walks past all the sleeping ones.
+        for (uint32_t i = 0; i < tasks; i++) {
+            stand_ins[i]->next = stand_ins[(i + 1) % tasks];
+            stand_ins[i]->state = TASK_STATE_SLEEPING;
+        }
+        task_t* current = stand_ins[0];
+        current->state = TASK_STATE_READY;
+        uint64_t start = rdtsc();
+        for (int round = 0; round < SCHED_BENCH_ROUNDS; round++) {
+            task_t* next = current->next;
+            while (next->state != TASK_STATE_READY && next != current) {
+                next = next->next;
+            }
+            current = next;
+        }
+        result->list_cycles = (rdtsc() - start) / SCHED_BENCH_ROUNDS;
+
+        // Bitmap run queue: same situation, only the ready task is queued
+        run_queue_t rq;
+        memset(&rq, 0, sizeof(rq));
+        stand_ins[0]->priority = TASK_PRIORITY_DEFAULT;
+        rq_push(&rq, stand_ins[0]);
+        start = rdtsc();
+        for (int round = 0; round < SCHED_BENCH_ROUNDS; round++) {
+            rq_push(&rq, rq_pop(&rq));
+        }
+        result->bitmap_cycles = (rdtsc() - start) / SCHED_BENCH_ROUNDS;
+
+        // Bitmap run queue with every task ready, spread over the priorities
+        memset(&rq, 0, sizeof(rq));
+        for (uint32_t i = 0; i < tasks; i++) {
+            stand_ins[i]->priority = i % TASK_NUM_PRIORITIES;
+            rq_push(&rq, stand_ins[i]);
+        }
+        start = rdtsc();
+        for (int round = 0; round < SCHED_BENCH_ROUNDS; round++) {
+            rq_push(&rq, rq_pop(&rq));
+        }
+        result->bitmap_busy_cycles = (rdtsc() - start) / SCHED_BENCH_ROUNDS;
+
+        irq_restore(irq);
+    }
+
+    // task_t objects go back to the cache zeroed
+    for (uint32_t i = 0; i < made; i++) {
+        memset(stand_ins[i], 0, sizeof(task_t));
+        kmem_cache_free(task_cache, stand_ins[i]);
+    }
+    kfree(stand_ins);
+    return made == tasks;
+}
+
+// Partner of task_switch_benchmark(): yields straight back, through
+// the path being measured, until told to stop
+static volatile bool switch_bench_frame = false;
+static volatile bool switch_bench_stop = false;
+
+static void switch_bench_partner(void) {
+    while (!switch_bench_stop) {
+        if (switch_bench_frame) {
+            __asm__ volatile ("int %0" :: "i"(SWITCH_BENCH_VECTOR) : "memory");
+        } else {
+            task_yield();
+        }
+    }
+}
+
+bool task_switch_benchmark(uint32_t rounds, switch_bench_result_t* result) {
+    memset(result, 0, sizeof(*result));
+    result->rounds = rounds;
+    if (rounds == 0) {
+        return false;
+    }
+
+    // Both tasks at the top priority on this CPU, so they only switch
+    // to each other
+    task_t* self = task_current();
+    uint32_t old_priority = self->priority;
+    switch_bench_frame = false;
+    switch_bench_stop = false;
+    task_t* partner = create_task_on(switch_bench_partner, self->cpu);
+    if (partner == NULL) {
+        return false;
+    }
+    task_set_priority(partner, TASK_NUM_PRIORITIES - 1);
+    task_set_priority(self, TASK_NUM_PRIORITIES - 1);
+    task_yield(); // Let the partner start
+
+    // Each round is two switches: there and back
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < rounds; i++) {
+        task_yield();
+    }
+    result->yield_cycles = (rdtsc() - start) / (2ull * rounds);
+
+    // Before: the same switches through the old frame-copying path
+    switch_bench_frame = true;
+    task_yield(); // The partner picks up the new mode
+    start = rdtsc();
+    for (uint32_t i = 0; i < rounds; i++) {
+        __asm__ volatile ("int %0" :: "i"(SWITCH_BENCH_VECTOR) : "memory");
+    }
+    result->frame_copy_cycles = (rdtsc() - start) / (2ull * rounds);
+
+    // The partner returns (and exits) on its next turn
+    switch_bench_stop = true;
+    task_yield();
+    task_set_priority(self, old_priority);
+    return true;
+}
@@ -3,36 +3,63 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "idt.h" // For struct registers
-#include "paging.h" // For page_table_t
+#include "vmm.h" // For vmm_space_t
+#include "spinlock.h"
 
-#define KERNEL_STACK_SIZE 4096 // 4KiB kernel stack per process
+#define KERNEL_STACK_ORDER 0 // Buddy order of each kernel stack (2^0 pages)
+#define KERNEL_STACK_SIZE (PAGE_SIZE << KERNEL_STACK_ORDER) // 4KiB kernel stack per process
+
+// Scheduling priorities: 0 (lowest) to TASK_NUM_PRIORITIES - 1. The
+// highest ready priority always runs; equal ones share the CPU round-robin.
+#define TASK_NUM_PRIORITIES     32
+#define TASK_PRIORITY_DEFAULT   16
+#define TASK_TIME_SLICE_DEFAULT 5  // Timer ticks a task runs before others of its priority get a turn
+
+// CPU affinity masks: bit n set means the task may run on CPU n
+#define TASK_AFFINITY_ALL 0xFFFFFFFFu
 
 typedef enum {
     TASK_STATE_READY,     // Ready to be scheduled
     TASK_STATE_RUNNING,   // Currently running
     TASK_STATE_SLEEPING,  // Waiting for an event
-    TASK_STATE_DEAD       // Marked for deletion
+    TASK_STATE_DEAD       // Exited, waiting for the reaper
 } task_state_t;
 
-typedef struct task {
-    // cpu registers saved during context switch
-    // must be the first element
-    struct registers regs;
+struct wait_queue;
 
+typedef struct task {
     // kernel stack info
     uint8_t* kernel_stack;
-    uint64_t kernel_stack_ptr; // The top of the kernel stack (RSP)
+    uint64_t kernel_stack_ptr; // Saved RSP while switched out (see switch_context())
 
     // process info 
     int64_t pid;                // Process ID
     task_state_t state;         // Current task state
 
     // paging info
-    page_table_t* pml4;         // Pointer to this task's page map
+    vmm_space_t* space;         // This task's address space
+
+    // FPU/SSE/AVX registers while not loaded (see fpu.h)
+    void* fpu_state;
 
-    // linked list for scheduler
+    // scheduling
+    uint32_t priority;          // 0 .. TASK_NUM_PRIORITIES - 1
+    uint32_t time_slice;        // Ticks per turn
+    uint32_t slice_left;        // Ticks left in the current turn
+    bool on_cpu;                // Executing (or about to switch away)
+    bool switching;             // Switched away but RSP not saved yet
+    uint32_t cpu;               // CPU whose run queue the task belongs to
+    uint32_t affinity;          // CPUs it may run on (TASK_AFFINITY_ALL by default)
+
+    // run queue links (only while READY; `next` links the dead list once DEAD)
     struct task* next;
+    struct task* prev;
+
+    // wait queue membership, see prepare_to_wait()
+    struct wait_queue* wait_queue;
+    struct task* wait_next;
 
 } task_t;
 
@@ -43,6 +70,38 @@ typedef struct task {
  */
 void task_init(void);
 
+/**
+ * @brief Gives the calling CPU its idle task and lets tasks be placed on
+ * it. Called with interrupts off, once per CPU (task_init() does the
+ * boot CPU).
+ */
+void task_init_cpu(void);
+
+/**
+ * @brief Number of CPUs running tasks.
+ */
+unsigned int task_online_cpus(void);
+
+// One CPU's run queue, see task_get_cpu_stats()
+typedef struct {
+    uint32_t queued;          // Ready tasks waiting for this CPU
+    uint32_t tasks;           // Tasks placed on it (running, ready or sleeping)
+    uint64_t steals;          // Tasks it took from other CPUs while idle
+    uint64_t stolen;          // Tasks other CPUs took from it
+    uint64_t steal_attempts;  // Times it went looking for work on a victim
+} task_cpu_stats_t;
+
+/**
+ * @brief Copies CPU `cpu`'s run queue counters into `stats`.
+ * @return false if that CPU is not online.
+ */
+bool task_get_cpu_stats(unsigned int cpu, task_cpu_stats_t* stats);
+
+
+/**
+ * @brief Returns the task running on this CPU (NULL before task_init()).
+ */
+task_t* task_current(void);
 
 /**
  * @brief Creates a new kernel task (shares kernel page map)
@@ -51,4 +110,158 @@ void task_init(void);
  */
 task_t* create_task(void (*entry_point)(void)); // <-- ADD THIS PROTOTYPE
 
+/**
+ * @brief Creates a new kernel task that only runs on CPU `cpu` (or on
+ * the least loaded CPU, if that one is not running tasks).
+ */
+task_t* create_task_on(void (*entry_point)(void), unsigned int cpu);
+
+/**
+ * @brief Restricts a task to the CPUs in `mask`. A task that is not
+ * running moves right away; a running one at its next switch.
+ * @return false if no CPU in `mask` is online, or for an idle task.
+ */
+bool task_set_affinity(task_t* task, uint32_t mask);
+
+/**
+ * @brief Ends the current task. Its stack and task_t are freed later by
+ * the reaper task. A task whose entry function returns ends up here.
+ */
+void task_exit(void) __attribute__((noreturn));
+
+// Task lifetime counters, see task_get_stats()
+typedef struct {
+    uint64_t created;
+    uint64_t exited;
+    uint64_t reaped;        // Dead tasks freed so far
+    uint64_t stack_hits;    // Stacks reused from the stack cache
+    uint64_t stack_misses;  // Stacks taken from the PMM
+    uint32_t cached_stacks; // Stacks in the cache now
+} task_stats_t;
+
+void task_get_stats(task_stats_t* stats);
+
+/**
+ * @brief Changes a task's priority (0 .. TASK_NUM_PRIORITIES - 1).
+ * Out-of-range values are ignored. Takes effect at the next tick.
+ */
+void task_set_priority(task_t* task, unsigned int priority);
+
+/**
+ * @brief Sets how many timer ticks a task may run before yielding to
+ * others of the same priority (at least 1).
+ */
+void task_set_time_slice(task_t* task, uint32_t ticks);
+
+// --- Sleeping and Waking ---
+// Everything here that blocks must be called from a task, not from an
+// interrupt handler (the shell runs in the keyboard interrupt).
+
+/**
+ * @brief Gives up the CPU to another ready task of at least the same
+ * priority. A task that marked itself SLEEPING stays off the CPU until
+ * task_wake(). Only the callee-saved registers are saved, not a full
+ * interrupt frame.
+ */
+void task_yield(void);
+
+/**
+ * @brief Makes a SLEEPING task runnable. Safe from interrupt handlers.
+ */
+void task_wake(task_t* task);
+
+/**
+ * @brief Sleeps until get_ticks() reaches `tick`.
+ */
+void task_sleep_until(uint64_t tick);
+
+/**
+ * @brief Sleeps for `ticks` timer ticks.
+ */
+void task_sleep_ticks(uint64_t ticks);
+
+// A list of tasks waiting for something, see wait_event()
+typedef struct wait_queue {
+    spinlock_t lock;
+    task_t* head;               // Waiters in arrival order, linked by wait_next
+    task_t* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL, NULL }
+
+void wait_queue_init(wait_queue_t* wq);
+
+/**
+ * @brief Queues the current task on `wq` and marks it SLEEPING. The
+ * caller then checks its condition and calls task_yield() if it is
+ * still false; a wake_up() in between just keeps it running.
+ */
+void prepare_to_wait(wait_queue_t* wq);
+
+/**
+ * @brief Ends a wait: the task is RUNNING and off `wq`.
+ */
+void finish_wait(wait_queue_t* wq);
+
+/**
+ * @brief Wakes every task waiting on `wq`. Safe from interrupt handlers.
+ */
+void wake_up(wait_queue_t* wq);
+
+/**
+ * @brief Wakes the task that has waited longest on `wq`.
+ */
+void wake_up_one(wait_queue_t* wq);
+
+// Sleeps on `wq` until `condition` is true. Whoever makes it true must
+// call wake_up(&wq) afterwards.
+#define wait_event(wq, condition)           \
+    do {                                    \
+        for (;;) {                          \
+            prepare_to_wait(&(wq));         \
+            if (condition) {                \
+                break;                      \
+            }                               \
+            task_yield();                   \
+        }                                   \
+        finish_wait(&(wq));                 \
+    } while (0)
+
+// Results of task_sched_benchmark(), in TSC cycles per scheduling decision
+typedef struct {
+    uint32_t tasks;
+    uint64_t list_cycles;        // Old circular-list walk, one task ready
+    uint64_t bitmap_cycles;      // Bitmap run queue, one task ready
+    uint64_t bitmap_busy_cycles; // Bitmap run queue, all tasks ready
+} sched_bench_result_t;
+
+/**
+ * @brief Measures the cost of picking the next task with `tasks` tasks
+ * in the system, for the old list walk and the bitmap run queue. Uses
+ * stand-in task_t objects, so nothing is actually scheduled.
+ * @return false if the stand-ins could not be allocated.
+ */
+bool task_sched_benchmark(uint32_t tasks, sched_bench_result_t* result);
+
+// Results of task_switch_benchmark(), in TSC cycles per task switch
+typedef struct {
+    uint32_t rounds;
+    uint64_t yield_cycles;      // After: task_yield(), callee-saved register swap
+    uint64_t frame_copy_cycles; // Before: interrupt frame, 22-word copy, iretq
+} switch_bench_result_t;
+
+/**
+ * @brief Measures task switch latency by ping-ponging between the
+ * current task and a helper task, both at the highest priority. Blocks,
+ * so it must be called from a task.
+ * @return false if the helper task could not be created.
+ */
+bool task_switch_benchmark(uint32_t rounds, switch_bench_result_t* result);
+
+/**
+ * @brief Runs the idle loop in the current (boot) context. Never returns.
+ * Must be called after task_init(), with the boot context as the idle task.
+ */
+void task_run_idle(void);
+
 #endif // __TASK_H__
\ No newline at end of file
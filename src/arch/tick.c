@@ -0,0 +1,113 @@
+#include "tick.h"
+#include "timer.h"
+#include "lapic.h"
+#include "irq.h"
+#include "pit.h"
+#include "fpu.h"
+#include "cpu.h"
+#include "serialport.h"
+
+static bool oneshot = false;
+
+// The boot CPU's deadline as the scheduler last asked for it, before the
+// wheel's is folded in (interrupts off)
+static uint64_t boot_deadline = TICK_NONE;
+
+// Updated only by the CPU itself, with interrupts off
+static tick_stats_t tick_stats[MAX_CPUS];
+
+bool tick_oneshot(void) {
+    return oneshot;
+}
+
+void tick_init(void) {
+    uint64_t tsc_hz = pit_get_tsc_hz();
+    if (tsc_hz != 0 && lapic_available() && lapic_timer_init_oneshot()) {
+        // The PIT may still run from firmware; it is not needed any more
+        irq_mask(0);
+        timer_use_tsc(tsc_hz);
+        oneshot = true;
+        tick_init_cpu();
+        serial_write_string("Tick: tickless (one-shot local APIC timer)\n");
+        return;
+    }
+    pit_init(TIMER_HZ);
+    serial_write_string("Tick: periodic PIT\n");
+}
+
+void tick_init_cpu(void) {
+    if (!oneshot || !lapic_timer_init_oneshot()) {
+        return;
+    }
+    // The first interrupt starts whatever was queued before
+    uint64_t irq = irq_save();
+    tick_program(get_ticks() + 1);
+    irq_restore(irq);
+}
+
+void tick_program(uint64_t deadline) {
+    if (!oneshot) {
+        return;
+    }
+    if (cpu_id() == 0) {
+        boot_deadline = deadline;
+        uint64_t wheel = timer_arm_next();
+        if (wheel < deadline) {
+            deadline = wheel;
+        }
+    }
+    if (deadline == TICK_NONE) {
+        lapic_timer_disarm(); // Nothing due: sleep until an interrupt
+        return;
+    }
+    uint64_t target = timer_tick_to_tsc(deadline);
+    uint64_t now = rdtsc();
+    lapic_timer_arm(target > now ? target - now : 0);
+}
+
+void tick_wheel_changed(void) {
+    if (!oneshot) {
+        return;
+    }
+    if (cpu_id() == 0) {
+        // Program the sooner of the running task's deadline and the wheel's
+        uint64_t irq = irq_save();
+        tick_program(boot_deadline);
+        irq_restore(irq);
+    } else {
+        lapic_send_ipi(cpu_locals[0].lapic_id, RESCHED_VECTOR);
+    }
+}
+
+void tick_handle_pit(void) {
+    tick_stats[cpu_id()].timer++;
+    fpu_irq_enter();
+    timer_tick();
+    fpu_irq_exit();
+}
+
+void tick_handle_timer(void) {
+    lapic_eoi();
+    unsigned int cpu = cpu_id();
+    tick_stats[cpu].timer++;
+    if (cpu == 0) {
+        // Timer callbacks may wake tasks (and use vector registers)
+        fpu_irq_enter();
+        timer_run();
+        fpu_irq_exit();
+    }
+}
+
+void tick_handle_ipi(void) {
+    lapic_eoi();
+    tick_stats[cpu_id()].ipi++;
+}
+
+bool tick_get_stats(unsigned int cpu, tick_stats_t* stats) {
+    if (cpu >= MAX_CPUS) {
+        return false;
+    }
+    stats->timer = __atomic_load_n(&tick_stats[cpu].timer, __ATOMIC_RELAXED);
+    stats->ipi = __atomic_load_n(&tick_stats[cpu].ipi, __ATOMIC_RELAXED);
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef __TICK_H__
+#define __TICK_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// --- Scheduler Tick ---
+// With a calibrated local APIC timer the kernel is tickless: ticks are
+// counted by the TSC (see timer_use_tsc()), and each CPU programs a
+// one-shot timer interrupt for the next thing it has to do, namely the end of
+// the running task's time slice, or (on the boot CPU, which runs the timer
+// wheel) the earliest pending timer. An idle CPU sleeps until its
+// next slab reap, unless an interrupt or a reschedule IPI brings work.
+//
+// Without one, the PIT interrupts the boot CPU TIMER_HZ times a second
+// and the kernel runs on that CPU only.
+
+#define TICK_NONE UINT64_MAX
+
+/**
+ * @brief Picks the tick source and starts it on the boot CPU. Call after
+ * irq_init() and task_init().
+ */
+void tick_init(void);
+
+/**
+ * @brief Sets up the one-shot timer of an application processor.
+ */
+void tick_init_cpu(void);
+
+/**
+ * @brief True when CPUs use one-shot local APIC timers (tickless).
+ */
+bool tick_oneshot(void);
+
+/**
+ * @brief Programs this CPU's next timer interrupt: at tick `deadline`
+ * (TICK_NONE: none needed by the running task), or earlier if the timer
+ * wheel needs it. Does nothing with the periodic PIT. Interrupts off.
+ */
+void tick_program(uint64_t deadline);
+
+/**
+ * @brief A timer was added that is due before the wheel's owner planned
+ * to wake up (called by timer_add()).
+ */
+void tick_wheel_changed(void);
+
+// Interrupt bookkeeping, called by the scheduler's interrupt handlers
+void tick_handle_pit(void);     // PIT tick: advance ticks, run the wheel
+void tick_handle_timer(void);   // Local APIC timer: EOI, wheel on the boot CPU
+void tick_handle_ipi(void);     // Reschedule IPI: EOI
+
+// Interrupts that woke a CPU, see tick_get_stats()
+typedef struct {
+    uint64_t timer;  // Timer interrupts (PIT or local APIC)
+    uint64_t ipi;    // Reschedule IPIs
+} tick_stats_t;
+
+/**
+ * @brief Copies CPU `cpu`'s interrupt counts into `stats`.
+ * @return false if `cpu` is out of range.
+ */
+bool tick_get_stats(unsigned int cpu, tick_stats_t* stats);
+
+#endif // __TICK_H__
@@ -2,36 +2,55 @@
 #include "pmm.h"
 #include "serialport.h"
 #include "string.h" // For memset
+#include "cpu.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "smp.h"        // For TLB shootdowns
 #include <stddef.h>     // For NULL
 #include <limine.h>
 
+// Serializes changes to the page tables made through vmm_map/vmm_unmap
+static spinlock_t vmm_lock = SPINLOCK_INIT;
+
+// Whether the CPU supports 1GiB pages (CPUID pdpe1gb)
+static bool gb_pages_supported = false;
+
+// CPU features enabled by vmm_init()
+static bool pge_enabled = false;
+static bool pcid_enabled = false;
+
+// Bumped whenever the lower half of an inactive address space changes.
+// Its PCID may hold stale entries, so the next switch into it flushes.
+static uint64_t lower_half_generation = 0;
+
+// PCID allocator: a set bit means in use / used before (needs a flush)
+static uint64_t pcid_used[VMM_PCID_COUNT / 64];
+static uint64_t pcid_dirty[VMM_PCID_COUNT / 64];
+
 
 // --- Page Tables ---
+// Only the PML4 is static. Everything below it is allocated from the
+// PMM by vmm_map(), so the tables scale with the memory actually present.
 __attribute__((aligned(PAGE_SIZE)))
 static page_table_t pml4;
 
-__attribute__((aligned(PAGE_SIZE)))
-static page_table_t pdpt; // For the identity map (0x0...)
+static uint64_t table_phys(const void* table);
+static uint64_t* get_next_table(uint64_t* entry, uint64_t huge_size, uint64_t virt, bool flush);
 
-__attribute__((aligned(PAGE_SIZE)))
-static page_table_t pdpt_high; // For the higher-half kernel map (0xffffffff8...)
+// Kernel image bounds, from the linker script
+extern char __kernel_start[], __kernel_end[];
 
-__attribute__((aligned(PAGE_SIZE)))
-static page_table_t pdpt_hhdm; // For the HHDM (0xffff8...)
+// How vmm_init() laid out the kernel image, for vmm_get_layout()
+static vmm_layout_t layout;
 
-// --- Page Directories ---
-// 32 PDs to map 64GiB (32 * 2MiB * 512 entries = 64GiB)
-__attribute__((aligned(PAGE_SIZE)))
-static page_table_t pd[32];
+// The kernel address space (PCID 0), shared by all kernel tasks
+static vmm_space_t kernel_space;
 
-// We need ONE PD for the kernel map (to map 1GiB)
-__attribute__((aligned(PAGE_SIZE)))
-static page_table_t pd_kernel;
+// vmm_space_t objects for vmm_create_space()
+static kmem_cache_t* space_cache = NULL;
 
-// --- Page Tables (PTs) ---
-// 512 PTs to map 1GiB (512 * 4KiB * 512 entries = 1GiB)
-__attribute__((aligned(PAGE_SIZE)))
-static page_table_t pt_kernel[512];
+// Next free address in the MMIO window, see vmm_map_mmio()
+static uint64_t mmio_next = MMIO_BASE;
 
 /**
  * @brief Returns the virtual address of the kernel's PML4 page map.
@@ -41,82 +60,840 @@ page_table_t* vmm_get_kernel_pml4(void) {
     return &pml4;
 }
 
+// Stops the boot: the kernel page tables could not be built
+static void vmm_out_of_memory(void) {
+    serial_write_string("VMM: Out of memory building the kernel page tables!\n");
+    for (;;) {
+        __asm__ volatile ("cli; hlt");
+    }
+}
+
+static void vmm_map_or_die(uint64_t virt, uint64_t phys, uint64_t flags, uint64_t size) {
+    if (!vmm_map(&pml4, virt, phys, flags, size)) {
+        vmm_out_of_memory();
+    }
+}
+
+// Drops every TLB entry on this CPU, global ones and other PCIDs included
+static void flush_tlb_all(void) {
+    uint64_t cr4 = read_cr4();
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+/**
+ * @brief Loads PAT_LAYOUT into IA32_PAT on this CPU.
+ * Follows the SDM sequence for changing memory types: caching disabled
+ * and the caches and TLBs flushed before and after the write, so no
+ * line or translation of the old types survives. Interrupts must be off.
+ */
+static void pat_program(void) {
+    uint64_t cr0 = read_cr0();
+    write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+    __asm__ volatile ("wbinvd" ::: "memory");
+    flush_tlb_all();
+
+    wrmsr(MSR_IA32_PAT, PAT_LAYOUT);
+
+    __asm__ volatile ("wbinvd" ::: "memory");
+    flush_tlb_all();
+    write_cr0(cr0);
+}
 
 void vmm_init(void) {
-    // --- 1. Clear all tables ---
+    // Check for 1GiB page support (CPUID.80000001h:EDX[26])
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000001) {
+        cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        gb_pages_supported = (edx & (1u << 26)) != 0;
+    }
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    bool pge_supported = (edx & (1u << 13)) != 0;
+    bool pcid_supported = (ecx & (1u << 17)) != 0;
+    bool pat_supported = (edx & (1u << 16)) != 0;
+
+    // --- 0. Page Attribute Table ---
+    // Make PWT alone select write-combining (see PTE_CACHE_*). Done before
+    // any of our tables are live.
+    if (pat_supported) {
+        pat_program();
+        layout.pat = true;
+    }
+
+    // --- 1. Clear the PML4 ---
+    // The PMM is already up (running on the bootloader's HHDM), so
+    // vmm_map() can allocate the lower-level tables as it goes.
     memset(&pml4, 0, sizeof(page_table_t));
-    memset(&pdpt, 0, sizeof(page_table_t));
-    memset(&pdpt_high, 0, sizeof(page_table_t));
-    memset(&pdpt_hhdm, 0, sizeof(page_table_t));
-    memset(&pd, 0, sizeof(page_table_t) * 32);
-    memset(&pd_kernel, 0, sizeof(page_table_t));
-    memset(&pt_kernel, 0, sizeof(page_table_t) * 512);
-
-    // --- Get physical addresses ---
+
+    // --- 2. HIGHER-HALF DIRECT MAP (HHDM) (for 0xffff8...) ---
+    // Cover everything up to the end of the highest memmap entry, with
+    // 1GiB pages if the CPU has them and 2MiB pages otherwise.
+    struct limine_memmap_response* memmap = vmm_get_memmap();
+    uint64_t top = 0;
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        uint64_t end = memmap->entries[i]->base + memmap->entries[i]->length;
+        if (end > top) {
+            top = end;
+        }
+    }
+    uint64_t granule = gb_pages_supported ? PAGE_SIZE_1G : PAGE_SIZE_2M;
+    top = (top + granule - 1) & ~(granule - 1);
+    vmm_map_or_die(VIRTUAL_MEMORY_OFFSET, 0, PTE_WRITE | PTE_USER, top);
+
+    // --- 3. IDENTITY MAP (for 0x0...) ---
+    // Shares the HHDM's PDPTs, like the old static tables shared their PDs.
+    uint64_t hhdm_pml4_index = PML4_INDEX(VIRTUAL_MEMORY_OFFSET); // 256
+    for (uint64_t i = 0; i < (top + (1ull << 39) - 1) >> 39; i++) {
+        pml4.entries[i] = pml4.entries[hhdm_pml4_index + i];
+    }
+
+    // --- 4. KERNEL MAP (for 0xffffffff8...) ---
+    // If the image's virtual and physical bases agree modulo 2MiB, round
+    // it out to 2MiB boundaries so it is covered by 2MiB pages. Otherwise
+    // map exactly the image with 4KiB pages.
     struct limine_kernel_address_response* kaddr = vmm_get_kernel_address();
+    uint64_t kernel_virt = (uint64_t)__kernel_start;
+    uint64_t kernel_phys = (kernel_virt - kaddr->virtual_base) + kaddr->physical_base;
+    uint64_t kernel_size = (((uint64_t)__kernel_end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1)) - kernel_virt;
+
+    layout.kernel_large_pages = ((kernel_virt ^ kernel_phys) & (PAGE_SIZE_2M - 1)) == 0;
+    if (layout.kernel_large_pages) {
+        uint64_t offset = kernel_virt & (PAGE_SIZE_2M - 1);
+        kernel_virt -= offset;
+        kernel_phys -= offset;
+        kernel_size = (kernel_size + offset + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
+    }
+    vmm_map_or_die(kernel_virt, kernel_phys, PTE_WRITE | PTE_USER, kernel_size);
+
+    // --- 5. VMALLOC region ---
+    // Create its PDPT now so address spaces made later by copying the
+    // kernel half see everything mapped there afterwards.
+    if (get_next_table(&pml4.entries[PML4_INDEX(VMALLOC_BASE)], 0, VMALLOC_BASE, false) == NULL) {
+        vmm_out_of_memory();
+    }
+
+    // --- 6. Load the new Page Map ---
+    kernel_space.pml4 = &pml4;
+    kernel_space.pml4_phys = table_phys(&pml4);
+    kernel_space.pcid = 0;
+    pcid_used[0] = 1; // PCID 0 is the kernel's
+    write_cr3(kernel_space.pml4_phys);
+
+    // --- 7. Global pages and PCIDs ---
+    // Toggling PGE also flushes any global entries left by the bootloader.
+    // PCIDE may only be set while CR3[11:0] is 0, which it is (PCID 0).
+    if (pge_supported) {
+        write_cr4(read_cr4() & ~CR4_PGE);
+        write_cr4(read_cr4() | CR4_PGE);
+        pge_enabled = true;
+    }
+    if (pcid_supported) {
+        write_cr4(read_cr4() | CR4_PCIDE);
+        pcid_enabled = true;
+        kernel_space.has_pcid = true;
+    }
+
+    layout.hhdm_size = top;
+    layout.kernel_virt = kernel_virt;
+    layout.kernel_size = kernel_size;
+    layout.gb_pages = gb_pages_supported;
+    layout.global_pages = pge_enabled;
+    layout.pcid = pcid_enabled;
+}
+
+void vmm_init_cpu(void) {
+    // Same PAT, page map and CR4 features as vmm_init() set on the boot CPU
+    if (layout.pat) {
+        pat_program();
+    }
+    write_cr3(kernel_space.pml4_phys);
+    if (pge_enabled) {
+        write_cr4(read_cr4() & ~CR4_PGE);
+        write_cr4(read_cr4() | CR4_PGE);
+    }
+    if (pcid_enabled) {
+        write_cr4(read_cr4() | CR4_PCIDE);
+    }
+}
+
+void vmm_flush_tlb_local(bool write_back) {
+    if (write_back) {
+        __asm__ volatile ("wbinvd" ::: "memory");
+    }
+    flush_tlb_all();
+}
+
+void vmm_get_layout(vmm_layout_t* out) {
+    *out = layout;
+}
+
+// --- Dynamic Mappings ---
+
+/**
+ * @brief Returns the physical address of a page table.
+ * Tables are either static (in the kernel image) or PMM frames (HHDM).
+ */
+static uint64_t table_phys(const void* table) {
+    if ((uint64_t)table >= KERNEL_VIRTUAL_BASE) {
+        struct limine_kernel_address_response* kaddr = vmm_get_kernel_address();
+        return ((uint64_t)table - kaddr->virtual_base) + kaddr->physical_base;
+    }
+    return VIRT_TO_PHYS(table);
+}
+
+// Is `pml4` the address space the CPU is currently using?
+static bool is_active(page_table_t* pml4) {
+    return (read_cr3() & PTE_ADDR_MASK) == table_phys(pml4);
+}
+
+/**
+ * @brief Replaces a huge page entry with a table of the next smaller
+ * page size that maps exactly the same memory.
+ * @param entry The PDPT (1GiB) or PD (2MiB) entry to split.
+ * @param huge_size PAGE_SIZE_1G or PAGE_SIZE_2M.
+ * @param virt Any address inside the huge page.
+ * @param flush Whether the address space is live in this CPU's TLB.
+ * @return The new table, or NULL if out of memory.
+ */
+static uint64_t* split_huge_page(uint64_t* entry, uint64_t huge_size, uint64_t virt, bool flush) {
+    void* phys = pmm_alloc_page();
+    if (phys == NULL) {
+        return NULL;
+    }
+    pmm_set_page_owner(phys, PAGE_OWNER_PAGE_TABLE);
+    uint64_t* table = (uint64_t*)PHYS_TO_VIRT(phys);
+
+    uint64_t old = *entry;
+    uint64_t addr_mask = (huge_size == PAGE_SIZE_1G) ? PTE_ADDR_MASK_1G : PTE_ADDR_MASK_2M;
+    uint64_t base = old & addr_mask;
+    uint64_t flags = old & ~addr_mask;
+
+    uint64_t step;
+    if (huge_size == PAGE_SIZE_1G) {
+        // 512 x 2MiB, still huge pages: flags (including PAT) carry over
+        step = PAGE_SIZE_2M;
+    } else {
+        // 512 x 4KiB: bit 7 becomes the PAT bit instead of "huge"
+        step = PAGE_SIZE;
+        flags &= ~(PTE_HUGE_PAGE | PTE_PAT_HUGE);
+        if (old & PTE_PAT_HUGE) {
+            flags |= PTE_HUGE_PAGE; // Bit 7 = PAT in a 4KiB PTE
+        }
+    }
+
+    for (int i = 0; i < ENTRIES_PER_TABLE; i++) {
+        table[i] = (base + i * step) | flags;
+    }
+
+    *entry = (uint64_t)phys | PTE_PRESENT | PTE_WRITE | PTE_USER;
+
+    // The old large-page translation may still be cached, and holding it
+    // alongside the new smaller ones is undefined: drop all of it.
+    if (!flush) {
+        lower_half_generation++;
+    } else if (huge_size == PAGE_SIZE_1G) {
+        flush_tlb_all();
+    } else {
+        uint64_t start = virt & ~(PAGE_SIZE_2M - 1);
+        for (uint64_t offset = 0; offset < PAGE_SIZE_2M; offset += PAGE_SIZE) {
+            invlpg(start + offset);
+        }
+    }
+    return table;
+}
+
+/**
+ * @brief Returns the table an entry points to, creating it if needed.
+ * @param huge_size Size of a huge page at this entry's level (0 for PML4).
+ * @param virt, flush Passed to split_huge_page() if the entry is huge.
+ */
+static uint64_t* get_next_table(uint64_t* entry, uint64_t huge_size, uint64_t virt, bool flush) {
+    if (*entry & PTE_PRESENT) {
+        if (huge_size != 0 && (*entry & PTE_HUGE_PAGE)) {
+            return split_huge_page(entry, huge_size, virt, flush);
+        }
+        return (uint64_t*)PHYS_TO_VIRT(*entry & PTE_ADDR_MASK);
+    }
+
+    void* phys = pmm_alloc_zeroed_page();
+    if (phys == NULL) {
+        return NULL;
+    }
+    pmm_set_page_owner(phys, PAGE_OWNER_PAGE_TABLE);
+    *entry = (uint64_t)phys | PTE_PRESENT | PTE_WRITE | PTE_USER;
+    return (uint64_t*)PHYS_TO_VIRT(phys);
+}
+
+// Can a huge page go in this slot? Not if it already holds a table.
+static bool can_place_huge(uint64_t entry) {
+    return !(entry & PTE_PRESENT) || (entry & PTE_HUGE_PAGE);
+}
+
+// Would get_next_table() have to split this entry?
+static bool is_huge(uint64_t entry) {
+    return (entry & (PTE_PRESENT | PTE_HUGE_PAGE)) == (PTE_PRESENT | PTE_HUGE_PAGE);
+}
+
+bool vmm_map(page_table_t* pml4, uint64_t virt, uint64_t phys, uint64_t flags, uint64_t size) {
+    if (((virt | phys | size) & (PAGE_SIZE - 1)) != 0 || virt + size < virt) {
+        return false;
+    }
+
+    flags |= PTE_PRESENT;
+    uint64_t end = virt + size;
+    bool ok = true;
+
+    // The kernel half is shared by every address space: make it global
+    // and always flush it, on the other CPUs too if an existing
+    // translation changed. The lower half is only flushed if active.
+    bool kernel_half = virt >= VIRTUAL_MEMORY_OFFSET;
+    bool flush = kernel_half || is_active(pml4);
+    bool shootdown = false;
+    if (kernel_half) {
+        flags |= PTE_GLOBAL;
+    }
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    while (virt < end) {
+        uint64_t remaining = end - virt;
+        uint64_t step;
+        uint64_t* leaf;
+
+        uint64_t* pdpt = get_next_table(&pml4->entries[PML4_INDEX(virt)], 0, virt, flush);
+        if (pdpt == NULL) { ok = false; break; }
+        uint64_t* pdpte = &pdpt[PDPT_INDEX(virt)];
+
+        if (gb_pages_supported && ((virt | phys) & (PAGE_SIZE_1G - 1)) == 0 &&
+            remaining >= PAGE_SIZE_1G && can_place_huge(*pdpte)) {
+            // 1GiB page
+            step = PAGE_SIZE_1G;
+            leaf = pdpte;
+            flags |= PTE_HUGE_PAGE;
+        } else {
+            shootdown |= kernel_half && is_huge(*pdpte);
+            uint64_t* pd = get_next_table(pdpte, PAGE_SIZE_1G, virt, flush);
+            if (pd == NULL) { ok = false; break; }
+            uint64_t* pde = &pd[PD_INDEX(virt)];
+
+            if (((virt | phys) & (PAGE_SIZE_2M - 1)) == 0 &&
+                remaining >= PAGE_SIZE_2M && can_place_huge(*pde)) {
+                // 2MiB page
+                step = PAGE_SIZE_2M;
+                leaf = pde;
+                flags |= PTE_HUGE_PAGE;
+            } else {
+                // 4KiB page
+                shootdown |= kernel_half && is_huge(*pde);
+                uint64_t* pt = get_next_table(pde, PAGE_SIZE_2M, virt, flush);
+                if (pt == NULL) { ok = false; break; }
+                step = PAGE_SIZE;
+                leaf = &pt[PT_INDEX(virt)];
+                flags &= ~PTE_HUGE_PAGE;
+            }
+        }
+
+        bool was_present = (*leaf & PTE_PRESENT) != 0;
+        *leaf = phys | flags;
+        if (was_present) {
+            if (flush) {
+                invlpg(virt);
+            } else {
+                lower_half_generation++;
+            }
+            shootdown |= kernel_half;
+        }
+
+        virt += step;
+        phys += step;
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    if (shootdown) {
+        smp_flush_tlb_others(false);
+    }
+    return ok;
+}
+
+/**
+ * @brief Frees a PMM-allocated table once nothing in it is mapped,
+ * and clears the entry pointing to it. Static tables are left alone.
+ */
+static void free_table_if_empty(uint64_t* parent_entry) {
+    uint64_t phys = *parent_entry & PTE_ADDR_MASK;
+    page_t* page = pmm_phys_to_page(phys);
+    if (page == NULL || page->owner != PAGE_OWNER_PAGE_TABLE) {
+        return;
+    }
+
+    uint64_t* table = (uint64_t*)PHYS_TO_VIRT(phys);
+    for (int i = 0; i < ENTRIES_PER_TABLE; i++) {
+        if (table[i] != 0) {
+            return;
+        }
+    }
+
+    *parent_entry = 0;
+    pmm_free_page((void*)phys);
+}
+
+void vmm_unmap(page_table_t* pml4, uint64_t virt, uint64_t size) {
+    if (size == 0) {
+        return;
+    }
+    virt &= ~(uint64_t)(PAGE_SIZE - 1);
+    // The last byte of the range, so a range that runs to the very top of
+    // the address space (end == 2^64) does not wrap to an empty one
+    uint64_t last = virt + size - 1;
+    if (last < virt) {
+        last = UINT64_MAX;
+    }
+    bool kernel_half = virt >= VIRTUAL_MEMORY_OFFSET;
+    bool flush = kernel_half || is_active(pml4);
+    bool changed = false;
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    if (!flush) {
+        lower_half_generation++;
+    }
+    while (virt <= last) {
+        uint64_t remaining = last - virt; // Bytes left, minus one
+        uint64_t next;
+
+        uint64_t* pml4e = &pml4->entries[PML4_INDEX(virt)];
+        if (!(*pml4e & PTE_PRESENT)) {
+            // Nothing mapped in this 512GiB region
+            next = (virt + (1ull << 39)) & ~((1ull << 39) - 1);
+        } else {
+            uint64_t* pdpt = (uint64_t*)PHYS_TO_VIRT(*pml4e & PTE_ADDR_MASK);
+            uint64_t* pdpte = &pdpt[PDPT_INDEX(virt)];
+
+            if (!(*pdpte & PTE_PRESENT)) {
+                next = (virt + PAGE_SIZE_1G) & ~(PAGE_SIZE_1G - 1);
+            } else if (*pdpte & PTE_HUGE_PAGE) {
+                if ((virt & (PAGE_SIZE_1G - 1)) != 0 || remaining < PAGE_SIZE_1G - 1) {
+                    // Unmapping part of it: split, then retry at this address
+                    if (split_huge_page(pdpte, PAGE_SIZE_1G, virt, flush) == NULL) {
+                        break;
+                    }
+                    changed = true;
+                    continue;
+                }
+                *pdpte = 0;
+                if (flush) invlpg(virt);
+                changed = true;
+                next = virt + PAGE_SIZE_1G;
+            } else {
+                uint64_t* pd = (uint64_t*)PHYS_TO_VIRT(*pdpte & PTE_ADDR_MASK);
+                uint64_t* pde = &pd[PD_INDEX(virt)];
+
+                if (!(*pde & PTE_PRESENT)) {
+                    next = (virt + PAGE_SIZE_2M) & ~(PAGE_SIZE_2M - 1);
+                } else if (*pde & PTE_HUGE_PAGE) {
+                    if ((virt & (PAGE_SIZE_2M - 1)) != 0 || remaining < PAGE_SIZE_2M - 1) {
+                        if (split_huge_page(pde, PAGE_SIZE_2M, virt, flush) == NULL) {
+                            break;
+                        }
+                        changed = true;
+                        continue;
+                    }
+                    *pde = 0;
+                    if (flush) invlpg(virt);
+                    changed = true;
+                    next = virt + PAGE_SIZE_2M;
+                    if (PD_INDEX(next) == 0 || next - 1 >= last) {
+                        free_table_if_empty(pdpte);
+                    }
+                } else {
+                    uint64_t* pt = (uint64_t*)PHYS_TO_VIRT(*pde & PTE_ADDR_MASK);
+
+                    changed |= pt[PT_INDEX(virt)] != 0;
+                    pt[PT_INDEX(virt)] = 0;
+                    if (flush) invlpg(virt);
+                    next = virt + PAGE_SIZE;
+
+                    // Leaving this page table (or done): release it if now empty
+                    if (PT_INDEX(next) == 0 || next - 1 >= last) {
+                        free_table_if_empty(pde);
+                        if (!(*pde & PTE_PRESENT)) {
+                            free_table_if_empty(pdpte);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Stepping past the top of the address space wraps to 0
+        if (next <= virt) {
+            break;
+        }
+        virt = next;
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    // Other CPUs may still translate the kernel-half range the old way
+    if (changed && kernel_half) {
+        smp_flush_tlb_others(false);
+    }
+}
+
+/**
+ * @brief Gives the HHDM's mapping of [phys, phys + size) the memory type
+ * `cache_flags`. The HHDM covers device memory below the highest memmap
+ * entry too, and two mappings of the same memory with different types
+ * are undefined, so every MMIO mapping keeps its alias in agreement.
+ * Large HHDM pages are split as needed.
+ */
+static bool retype_hhdm_alias(uint64_t phys, uint64_t size, uint64_t cache_flags) {
+    if (phys >= layout.hhdm_size) {
+        return true; // Not covered by the HHDM
+    }
+    if (size > layout.hhdm_size - phys) {
+        size = layout.hhdm_size - phys;
+    }
+    if (!vmm_map(&pml4, (uint64_t)PHYS_TO_VIRT(phys), phys,
+                 PTE_WRITE | PTE_USER | (cache_flags & PTE_CACHE_MASK), size)) {
+        return false;
+    }
+    // Write back and drop anything cached under the old type, on every
+    // CPU (vmm_map() already flushed their TLBs, but not their caches)
+    __asm__ volatile ("wbinvd" ::: "memory");
+    smp_flush_tlb_others(true);
+    return true;
+}
+
+void* vmm_map_mmio(uint64_t phys, uint64_t size, uint64_t cache_flags) {
+    uint64_t offset = phys & (PAGE_SIZE - 1);
+    phys -= offset;
+    size = (size + offset + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+
+    // Keep the same offset within a 2MiB page as `phys` so large
+    // regions can use 2MiB pages
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    uint64_t virt = (mmio_next + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
+    virt += phys & (PAGE_SIZE_2M - 1);
+    mmio_next = virt + size;
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    if (!retype_hhdm_alias(phys, size, cache_flags) ||
+        !vmm_map(&pml4, virt, phys, PTE_WRITE | (cache_flags & PTE_CACHE_MASK), size)) {
+        return NULL;
+    }
+    return (void*)(virt + offset);
+}
+
+bool vmm_set_mmio_cache(void* mapping, uint64_t size, uint64_t cache_flags) {
+    uint64_t virt = (uint64_t)mapping;
+    uint64_t offset = virt & (PAGE_SIZE - 1);
+    virt -= offset;
+    size = (size + offset + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+
+    uint64_t phys = vmm_virt_to_phys(&pml4, virt);
+    if (phys == 0) {
+        return false;
+    }
+    // An MMIO window mapping is retyped itself; an HHDM one via its alias
+    if (virt != (uint64_t)PHYS_TO_VIRT(phys) &&
+        !vmm_map(&pml4, virt, phys, PTE_WRITE | (cache_flags & PTE_CACHE_MASK), size)) {
+        return false;
+    }
+    return retype_hhdm_alias(phys, size, cache_flags);
+}
+
+uint64_t vmm_virt_to_phys(page_table_t* pml4, uint64_t virt) {
+    uint64_t entry = pml4->entries[PML4_INDEX(virt)];
+    if (!(entry & PTE_PRESENT)) return 0;
+
+    entry = ((uint64_t*)PHYS_TO_VIRT(entry & PTE_ADDR_MASK))[PDPT_INDEX(virt)];
+    if (!(entry & PTE_PRESENT)) return 0;
+    if (entry & PTE_HUGE_PAGE) {
+        return (entry & PTE_ADDR_MASK_1G) + (virt & (PAGE_SIZE_1G - 1));
+    }
 
-    uint64_t pml4_phys = ((uint64_t)&pml4 - kaddr->virtual_base) + kaddr->physical_base;
-    uint64_t pdpt_phys = ((uint64_t)&pdpt - kaddr->virtual_base) + kaddr->physical_base;
-    uint64_t pdpt_high_phys = ((uint64_t)&pdpt_high - kaddr->virtual_base) + kaddr->physical_base;
-    uint64_t pdpt_hhdm_phys = ((uint64_t)&pdpt_hhdm - kaddr->virtual_base) + kaddr->physical_base;
-    uint64_t pd_phys = ((uint64_t)&pd - kaddr->virtual_base) + kaddr->physical_base;
-    uint64_t pd_kernel_phys = ((uint64_t)&pd_kernel - kaddr->virtual_base) + kaddr->physical_base;
-    uint64_t pt_kernel_phys = ((uint64_t)&pt_kernel - kaddr->virtual_base) + kaddr->physical_base;
+    entry = ((uint64_t*)PHYS_TO_VIRT(entry & PTE_ADDR_MASK))[PD_INDEX(virt)];
+    if (!(entry & PTE_PRESENT)) return 0;
+    if (entry & PTE_HUGE_PAGE) {
+        return (entry & PTE_ADDR_MASK_2M) + (virt & (PAGE_SIZE_2M - 1));
+    }
 
+    entry = ((uint64_t*)PHYS_TO_VIRT(entry & PTE_ADDR_MASK))[PT_INDEX(virt)];
+    if (!(entry & PTE_PRESENT)) return 0;
+    return (entry & PTE_ADDR_MASK) + OFFSET_INDEX(virt);
+}
 
-    // --- 2. IDENTITY MAP (for 0x0...) ---
-    // This map is shared with the HHDM.
-    pml4.entries[0] = pdpt_phys | PTE_PRESENT | PTE_WRITE | PTE_USER;
+// Counts the leaf entries below one PML4 slot by page size
+static void count_leaves(uint64_t pml4e, uint64_t counts[3], uint64_t* tables) {
+    if (!(pml4e & PTE_PRESENT)) {
+        return;
+    }
+    (*tables)++;
+    uint64_t* pdpt = (uint64_t*)PHYS_TO_VIRT(pml4e & PTE_ADDR_MASK);
+    for (int i = 0; i < ENTRIES_PER_TABLE; i++) {
+        if (!(pdpt[i] & PTE_PRESENT)) continue;
+        if (pdpt[i] & PTE_HUGE_PAGE) { counts[2]++; continue; }
 
-    uint64_t current_phys_addr = 0;
-    for (int i = 0; i < 32; i++) {
-        // Link the PDPT -> PDPT
-        pdpt.entries[i] = (pd_phys + (i * PAGE_SIZE)) | PTE_PRESENT | PTE_WRITE | PTE_USER;
+        (*tables)++;
+        uint64_t* pd = (uint64_t*)PHYS_TO_VIRT(pdpt[i] & PTE_ADDR_MASK);
+        for (int j = 0; j < ENTRIES_PER_TABLE; j++) {
+            if (!(pd[j] & PTE_PRESENT)) continue;
+            if (pd[j] & PTE_HUGE_PAGE) { counts[1]++; continue; }
 
-        // Fill the PD with 2MiB huge pages
-        for (int j = 0; j < 512; j++) {
-            pd[i].entries[j] = current_phys_addr | PTE_PRESENT | PTE_WRITE | PTE_HUGE_PAGE | PTE_USER;
-            current_phys_addr += 0x200000; // 2MiB
+            (*tables)++;
+            uint64_t* pt = (uint64_t*)PHYS_TO_VIRT(pd[j] & PTE_ADDR_MASK);
+            for (int k = 0; k < ENTRIES_PER_TABLE; k++) {
+                if (pt[k] & PTE_PRESENT) counts[0]++;
+            }
         }
     }
+}
 
-    // --- 3. KERNEL MAP (for 0xffffffff8...) ---
-    // This map is SEPARATE and uses 4KiB pages.
+void vmm_get_region_stats(page_table_t* pml4, uint64_t start, uint64_t end, vmm_region_stats_t* stats) {
+    memset(stats, 0, sizeof(*stats));
+    uint64_t counts[3] = { 0, 0, 0 };
 
-    uint64_t kernel_pml4_index = (kaddr->virtual_base >> 39) & 0x1FF; // 511
-    uint64_t kernel_pdpt_index = (kaddr->virtual_base >> 30) & 0x1FF; // 510
+    uint64_t first = PML4_INDEX(start);
+    uint64_t last = PML4_INDEX(end - 1);
+    for (uint64_t i = first; i <= last; i++) {
+        count_leaves(pml4->entries[i], counts, &stats->tables);
+    }
 
-    // Link PML4[511] -> pdpt_high
-    pml4.entries[kernel_pml4_index] = pdpt_high_phys | PTE_PRESENT | PTE_WRITE | PTE_USER;
+    stats->pages_4k = counts[0];
+    stats->pages_2m = counts[1];
+    stats->pages_1g = counts[2];
+}
 
-    // Link PDPT_HIGH[510] -> pd_kernel
-    pdpt_high.entries[kernel_pdpt_index] = pd_kernel_phys | PTE_PRESENT | PTE_WRITE | PTE_USER;
+// --- Address Spaces ---
 
-    // Fill the kernel tables (1GiB)
-    // This correctly maps virt 0xffffffff80000000 -> phys kaddr->physical_base
-    uint64_t current_kern_phys = kaddr->physical_base;
-    for (int i = 0; i < 512; i++) { // For each of the 512 PTs
-        // Link the PD_KERNEL -> PT
-        pd_kernel.entries[i] = (pt_kernel_phys + (i * PAGE_SIZE)) | PTE_PRESENT | PTE_WRITE | PTE_USER;
+vmm_space_t* vmm_get_kernel_space(void) {
+    return &kernel_space;
+}
 
-        // Fill the PT with 4KiB pages
-        for (int j = 0; j < 512; j++) {
-            pt_kernel[i].entries[j] = current_kern_phys | PTE_PRESENT | PTE_WRITE | PTE_USER;
-            current_kern_phys += PAGE_SIZE; // 4KiB
+// Takes a free PCID. Returns false when all of them are in use.
+// `dirty` is set if any CPU may still hold entries from a previous user.
+static bool pcid_alloc(uint16_t* pcid, bool* dirty) {
+    for (unsigned int w = 0; w < VMM_PCID_COUNT / 64; w++) {
+        if (pcid_used[w] == ~0ull) {
+            continue;
         }
+        unsigned int bit = __builtin_ctzll(~pcid_used[w]);
+        pcid_used[w] |= 1ull << bit;
+        *dirty = (pcid_dirty[w] >> bit) & 1;
+        *pcid = (uint16_t)(w * 64 + bit);
+        return true;
     }
+    return false;
+}
 
-    // --- 4. HIGHER-HALF IDENTITY MAP (HHDM) (for 0xffff8...) ---
-    uint64_t hhdm_pml4_index = (VIRTUAL_MEMORY_OFFSET >> 39) & 0x1FF; // 256
+// Returns a PCID. Its TLB entries may survive, so the next user flushes.
+static void pcid_free(uint16_t pcid) {
+    pcid_used[pcid / 64] &= ~(1ull << (pcid % 64));
+    pcid_dirty[pcid / 64] |= 1ull << (pcid % 64);
+}
 
-    // Link PML4[256] -> pdpt_hhdm
-    pml4.entries[hhdm_pml4_index] = pdpt_hhdm_phys | PTE_PRESENT | PTE_WRITE | PTE_USER;
+vmm_space_t* vmm_create_space(void) {
+    if (space_cache == NULL) {
+        space_cache = kmem_cache_create("vmm_space_t", sizeof(vmm_space_t), 0, NULL);
+        if (space_cache == NULL) {
+            return NULL;
+        }
+    }
+
+    vmm_space_t* space = (vmm_space_t*)kmem_cache_alloc(space_cache);
+    if (space == NULL) {
+        return NULL;
+    }
+    memset(space, 0, sizeof(vmm_space_t));
 
-    // Re-use the *same* `pd` tables from the identity map
-    for (int i = 0; i < 32; i++) {
-        pdpt_hhdm.entries[i] = (pd_phys + (i * PAGE_SIZE)) | PTE_PRESENT | PTE_WRITE | PTE_USER;
+    void* phys = pmm_alloc_zeroed_page();
+    if (phys == NULL) {
+        kmem_cache_free(space_cache, space);
+        return NULL;
     }
+    pmm_set_page_owner(phys, PAGE_OWNER_PAGE_TABLE);
+    space->pml4 = (page_table_t*)PHYS_TO_VIRT(phys);
+    space->pml4_phys = (uint64_t)phys;
 
-    // --- 5. Load the new Page Map ---
-    __asm__ volatile ("mov %0, %%cr3" :: "r"(pml4_phys));
-}
\ No newline at end of file
+    // Share the kernel half and the identity map (which the heap uses)
+    for (int i = 0; i < ENTRIES_PER_TABLE; i++) {
+        if (i >= ENTRIES_PER_TABLE / 2 || i < (int)((layout.hhdm_size + (1ull << 39) - 1) >> 39)) {
+            space->pml4->entries[i] = pml4.entries[i];
+        }
+    }
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    if (pcid_enabled) {
+        bool dirty = false;
+        space->has_pcid = pcid_alloc(&space->pcid, &dirty);
+        // Which CPUs used the PCID is not tracked: all of them flush it
+        space->stale_cpus = dirty ? ~0u : 0;
+    }
+    for (int i = 0; i < MAX_CPUS; i++) {
+        space->lower_gen[i] = lower_half_generation;
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    return space;
+}
+
+// Frees the private tables under one entry; level 3 = PDPT, 2 = PD, 1 = PT
+static void free_tables(uint64_t entry, int level) {
+    if (!(entry & PTE_PRESENT) || (entry & PTE_HUGE_PAGE)) {
+        return;
+    }
+    uint64_t phys = entry & PTE_ADDR_MASK;
+    if (level > 1) {
+        uint64_t* table = (uint64_t*)PHYS_TO_VIRT(phys);
+        for (int i = 0; i < ENTRIES_PER_TABLE; i++) {
+            free_tables(table[i], level - 1);
+        }
+    }
+    pmm_free_page((void*)phys);
+}
+
+void vmm_destroy_space(vmm_space_t* space) {
+    if (space == &kernel_space) {
+        return;
+    }
+
+    // Only the lower-half entries not copied from the kernel are private
+    for (int i = 0; i < ENTRIES_PER_TABLE / 2; i++) {
+        if (space->pml4->entries[i] != pml4.entries[i]) {
+            free_tables(space->pml4->entries[i], 3);
+        }
+    }
+    pmm_free_page((void*)space->pml4_phys);
+
+    uint64_t irq = spin_lock_irqsave(&vmm_lock);
+    if (space->has_pcid) {
+        pcid_free(space->pcid);
+    }
+    spin_unlock_irqrestore(&vmm_lock, irq);
+
+    kmem_cache_free(space_cache, space);
+}
+
+/**
+ * @brief Writes CR3 for `space`.
+ * @param keep_tlb Use the no-flush bit if the PCID's entries are valid.
+ * Each CPU has its own TLB, so whether they are is tracked per CPU.
+ * Interrupts must be off.
+ */
+static void load_space(vmm_space_t* space, bool keep_tlb) {
+    uint64_t cr3 = space->pml4_phys;
+    if (space->has_pcid) {
+        unsigned int cpu = cpu_id();
+        uint32_t bit = 1u << cpu;
+        uint64_t gen = __atomic_load_n(&lower_half_generation, __ATOMIC_RELAXED);
+        cr3 |= space->pcid;
+        if (keep_tlb && !(__atomic_load_n(&space->stale_cpus, __ATOMIC_RELAXED) & bit) &&
+            space->lower_gen[cpu] == gen) {
+            cr3 |= CR3_NOFLUSH;
+        }
+        __atomic_fetch_and(&space->stale_cpus, ~bit, __ATOMIC_RELAXED);
+        space->lower_gen[cpu] = gen;
+    }
+    write_cr3(cr3);
+}
+
+void vmm_switch_space(vmm_space_t* space) {
+    load_space(space, true);
+}
+
+// --- Context Switch Benchmark ---
+
+#define CTX_BENCH_PAGES 64   // Per half: this many kernel and user pages
+#define CTX_BENCH_ITERATIONS 256
+#define CTX_BENCH_USER_BASE 0x00007f0000000000ull // Lower half, not global
+
+// Reads one word from each page of both working sets
+static void touch_working_set(void) {
+    for (unsigned int i = 0; i < CTX_BENCH_PAGES; i++) {
+        (void)*(volatile uint64_t*)(VMM_TEST_BASE + (uint64_t)i * PAGE_SIZE);
+        (void)*(volatile uint64_t*)(CTX_BENCH_USER_BASE + (uint64_t)i * PAGE_SIZE);
+    }
+}
+
+// Switches a -> b -> a repeatedly, timing the switches and the refill
+static void ctx_bench_run(vmm_space_t* a, vmm_space_t* b, bool keep_tlb, vmm_ctx_bench_mode_t* out) {
+    uint64_t switch_total = 0, refill_total = 0;
+    load_space(a, false);
+    touch_working_set();
+    for (unsigned int i = 0; i < CTX_BENCH_ITERATIONS; i++) {
+        uint64_t t0 = rdtsc();
+        load_space(b, keep_tlb);
+        load_space(a, keep_tlb);
+        uint64_t t1 = rdtsc();
+        touch_working_set();
+        uint64_t t2 = rdtsc();
+        switch_total += t1 - t0;
+        refill_total += t2 - t1;
+    }
+    out->switch_cycles = switch_total / (CTX_BENCH_ITERATIONS * 2);
+    out->refill_cycles = refill_total / CTX_BENCH_ITERATIONS;
+}
+
+void vmm_ctx_benchmark(vmm_ctx_bench_t* result) {
+    memset(result, 0, sizeof(*result));
+    result->pages = CTX_BENCH_PAGES * 2;
+    result->pge_supported = pge_enabled;
+    result->pcid_supported = pcid_enabled;
+
+    // Working set: CTX_BENCH_PAGES global kernel pages (VMALLOC) and as
+    // many non-global pages in the lower half of space `a`, all backed
+    // by one frame so the data stays in cache and only the TLB misses.
+    void* frame = pmm_alloc_zeroed_page();
+    vmm_space_t* a = vmm_create_space();
+    vmm_space_t* b = vmm_create_space();
+    bool ok = frame != NULL && a != NULL && b != NULL;
+    for (unsigned int i = 0; ok && i < CTX_BENCH_PAGES; i++) {
+        ok = vmm_map(a->pml4, VMM_TEST_BASE + (uint64_t)i * PAGE_SIZE, (uint64_t)frame, 0, PAGE_SIZE) &&
+             vmm_map(a->pml4, CTX_BENCH_USER_BASE + (uint64_t)i * PAGE_SIZE, (uint64_t)frame, 0, PAGE_SIZE);
+    }
+
+    if (ok) {
+        uint64_t irq = irq_save();
+        uint64_t cr4 = read_cr4();
+
+        // Baseline: no switches at all
+        load_space(a, false);
+        touch_working_set();
+        uint64_t t0 = rdtsc();
+        for (unsigned int i = 0; i < CTX_BENCH_ITERATIONS; i++) {
+            touch_working_set();
+        }
+        result->warm_cycles = (rdtsc() - t0) / CTX_BENCH_ITERATIONS;
+
+        // No global pages: kernel entries are flushed too
+        if (pge_enabled) {
+            write_cr4(cr4 & ~CR4_PGE);
+        }
+        ctx_bench_run(a, b, false, &result->flush);
+        write_cr4(cr4);
+
+        if (pge_enabled) {
+            ctx_bench_run(a, b, false, &result->global);
+        }
+        if (pcid_enabled) {
+            ctx_bench_run(a, b, true, &result->pcid);
+        }
+
+        load_space(&kernel_space, false);
+        irq_restore(irq);
+    }
+
+    if (a != NULL) {
+        vmm_unmap(a->pml4, VMM_TEST_BASE, CTX_BENCH_PAGES * PAGE_SIZE);
+        vmm_destroy_space(a);
+    }
+    if (b != NULL) {
+        vmm_destroy_space(b);
+    }
+    if (frame != NULL) {
+        pmm_free_page(frame);
+    }
+}
@@ -2,6 +2,8 @@
 #define __VMM_H__
 
 #include "paging.h"
+#include "cpu.h"
+#include <stdbool.h>
 #include <limine.h> // <-- ADD THIS
 
 // These functions will be implemented in main.c
@@ -9,12 +11,82 @@ struct limine_memmap_response* vmm_get_memmap(void);
 struct limine_kernel_address_response* vmm_get_kernel_address(void);
 struct limine_framebuffer* vmm_get_framebuffer(void);
 
+// Number of PCIDs (CR3[11:0]); PCID 0 belongs to the kernel address space
+#define VMM_PCID_COUNT 4096
+
+// An address space: a PML4 plus the PCID that tags its TLB entries
+typedef struct vmm_space {
+    page_table_t* pml4;
+    uint64_t pml4_phys;
+    uint16_t pcid;        // Only meaningful if has_pcid
+    bool has_pcid;        // False when PCIDs are off or ran out: every switch flushes
+    uint32_t stale_cpus;  // CPUs that may hold old entries for the PCID; they flush on the next switch
+    uint64_t lower_gen[MAX_CPUS]; // lower_half_generation seen at each CPU's last switch
+} vmm_space_t;
+
+// Results of vmm_ctx_benchmark(), in TSC cycles
+typedef struct {
+    uint64_t switch_cycles; // One CR3 write
+    uint64_t refill_cycles; // Touching the working set right after switching back
+} vmm_ctx_bench_mode_t;
+
+typedef struct {
+    unsigned int pages;          // Pages in the working set (half kernel, half user)
+    uint64_t warm_cycles;        // Touching the working set without switching
+    vmm_ctx_bench_mode_t flush;  // CR4.PGE off: every switch flushes everything
+    vmm_ctx_bench_mode_t global; // Global kernel pages, CR3 writes flush the rest
+    vmm_ctx_bench_mode_t pcid;   // Global kernel pages plus PCID no-flush switches
+    bool pge_supported;
+    bool pcid_supported;
+} vmm_ctx_bench_t;
+
+// How vmm_init() laid out the kernel address space
+typedef struct {
+    uint64_t hhdm_size;       // Bytes of physical memory in the HHDM/identity map
+    uint64_t kernel_virt;     // Start of the kernel image mapping
+    uint64_t kernel_size;     // Size of the kernel image mapping
+    bool kernel_large_pages;  // Kernel image rounded out to 2MiB pages
+    bool gb_pages;            // CPU supports 1GiB pages
+    bool global_pages;        // CR4.PGE enabled, kernel-half mappings are global
+    bool pcid;                // CR4.PCIDE enabled
+    bool pat;                 // IA32_PAT programmed with PAT_LAYOUT (WC available)
+} vmm_layout_t;
+
+// Leaf mappings found in one region, see vmm_get_region_stats()
+typedef struct {
+    uint64_t pages_4k;
+    uint64_t pages_2m;
+    uint64_t pages_1g;
+    uint64_t tables; // PDPTs, PDs and PTs reached from the region
+} vmm_region_stats_t;
+
 /**
  * @brief Initializes the Virtual Memory Manager (VMM).
- * ... (rest of comment) ...
+ * Builds the kernel page tables with vmm_map(): the HHDM and identity
+ * map over all memory in the memmap (1GiB pages where supported) and
+ * the kernel image (2MiB pages where alignment allows). Enables global
+ * pages and PCIDs when the CPU has them.
+ * Must run after pmm_init().
  */
 void vmm_init(void);
 
+/**
+ * @brief Switches an application processor to the kernel page tables,
+ * with the same PAT and CR4 features as the boot CPU.
+ */
+void vmm_init_cpu(void);
+
+/**
+ * @brief Copies the layout chosen by vmm_init() into `out`.
+ */
+void vmm_get_layout(vmm_layout_t* out);
+
+/**
+ * @brief Counts the pages mapped in [start, end) of `pml4` by size.
+ * Works at PML4-entry (512GiB) granularity.
+ */
+void vmm_get_region_stats(page_table_t* pml4, uint64_t start, uint64_t end, vmm_region_stats_t* stats);
+
 /**
  * @brief Retrieves the kernel's PML4 page table.
  *
@@ -22,4 +94,92 @@ void vmm_init(void);
  */
 page_table_t* vmm_get_kernel_pml4(void); // <-- ADD THIS LINE
 
+/**
+ * @brief Returns the kernel address space (the kernel PML4, PCID 0).
+ */
+vmm_space_t* vmm_get_kernel_space(void);
+
+/**
+ * @brief Creates an address space that shares the kernel half (and the
+ * identity map) with the kernel PML4, and gives it a PCID if possible.
+ * @return The new address space, or NULL if out of memory.
+ */
+vmm_space_t* vmm_create_space(void);
+
+/**
+ * @brief Frees an address space's private page tables and its PCID.
+ * Frames mapped into its lower half belong to the caller.
+ * Must not be the active address space.
+ */
+void vmm_destroy_space(vmm_space_t* space);
+
+/**
+ * @brief Loads `space` into CR3.
+ * With PCIDs the switch keeps the TLB entries tagged with the space's
+ * PCID (CR3 no-flush bit) unless they may be stale.
+ * Part of the task switch path, so it must not touch vector registers.
+ */
+void vmm_switch_space(vmm_space_t* space) __attribute__((target("general-regs-only")));
+
+/**
+ * @brief Drops this CPU's whole TLB, global entries and all PCIDs
+ * included. With `write_back`, writes back and invalidates the caches
+ * first. The receiving end of smp_flush_tlb_others().
+ */
+void vmm_flush_tlb_local(bool write_back);
+
+/**
+ * @brief Measures CR3 switch cost and the TLB refill that follows,
+ * with no global pages, with global pages, and with global pages + PCID.
+ * Runs with interrupts disabled and returns in the kernel address space.
+ */
+void vmm_ctx_benchmark(vmm_ctx_bench_t* result);
+
+/**
+ * @brief Maps [virt, virt + size) to [phys, phys + size) in `pml4`.
+ * Intermediate tables are allocated from the PMM on demand. Each step
+ * uses the largest page (1GiB, 2MiB or 4KiB) that the alignment of
+ * virt/phys and the remaining size allow. Existing huge pages that
+ * only partly overlap the range are split. Kernel-half mappings are
+ * made PTE_GLOBAL, since every address space shares them; replacing
+ * one makes the other CPUs flush too, so call with no spinlocks held.
+ * @param flags PTE_* flags for the leaf entries (PTE_PRESENT is implied).
+ * @return true on success, false on bad alignment or out of memory.
+ */
+bool vmm_map(page_table_t* pml4, uint64_t virt, uint64_t phys, uint64_t flags, uint64_t size);
+
+/**
+ * @brief Removes the mappings for [virt, virt + size) from `pml4`.
+ * Flushes each unmapped page with invlpg (if `pml4` is active) and
+ * frees page tables that become empty. Kernel-half ranges are also
+ * flushed on the other CPUs, so call with no spinlocks held.
+ */
+void vmm_unmap(page_table_t* pml4, uint64_t virt, uint64_t size);
+
+/**
+ * @brief Maps device memory into the kernel's MMIO window.
+ * The HHDM alias of the range, if there is one, gets the same type.
+ * @param phys Physical base (rounded down to a page).
+ * @param size Size in bytes (rounded up to pages).
+ * @param cache_flags A PTE_CACHE_* memory type.
+ * @return The virtual address corresponding to `phys`, or NULL on failure.
+ */
+void* vmm_map_mmio(uint64_t phys, uint64_t size, uint64_t cache_flags);
+
+/**
+ * @brief Changes the memory type of a mapping made by vmm_map_mmio()
+ * (or of an HHDM range), keeping the HHDM alias in agreement.
+ * @param mapping The virtual address of the mapping.
+ * @param size Size in bytes (rounded up to pages).
+ * @param cache_flags The new PTE_CACHE_* memory type.
+ * @return false if `mapping` is not mapped or out of memory.
+ */
+bool vmm_set_mmio_cache(void* mapping, uint64_t size, uint64_t cache_flags);
+
+/**
+ * @brief Translates a virtual address through `pml4`.
+ * @return The physical address, or 0 if `virt` is not mapped.
+ */
+uint64_t vmm_virt_to_phys(page_table_t* pml4, uint64_t virt);
+
 #endif // __VMM_H__
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "framebuffer.h"
 #include "font.h"       // Includes font_8x16.h and defines FONT_WIDTH/HEIGHT
 #include "string.h"     // For memcpy and memset
+#include "cpu.h"        // For rdtsc()
 #include <stddef.h>     // For NULL
 
 // --- Framebuffer State ---
@@ -96,6 +97,42 @@ void fb_init(struct limine_framebuffer* fb_info) {
     fb_clear();
 }
 
+void* fb_get_address(void) {
+    return fb_addr;
+}
+
+void fb_set_address(void* address) {
+    fb_addr = (uint32_t*)address;
+}
+
+#define FB_BENCH_CHARS   2000
+#define FB_BENCH_SCROLLS 20
+
+void fb_benchmark(uint64_t* char_cycles, uint64_t* scroll_cycles) {
+    fb_clear();
+
+    // Characters: fill rows without ever scrolling
+    uint64_t start = rdtsc();
+    for (int i = 0; i < FB_BENCH_CHARS; i++) {
+        if (cursor_y >= rows - 1) {
+            cursor_x = 0;
+            cursor_y = 0;
+        }
+        fb_putchar('A' + (i % 26));
+    }
+    *char_cycles = (rdtsc() - start) / FB_BENCH_CHARS;
+
+    // Scrolls: a newline on the last row
+    start = rdtsc();
+    for (int i = 0; i < FB_BENCH_SCROLLS; i++) {
+        cursor_y = rows - 1;
+        fb_putchar('\n');
+    }
+    *scroll_cycles = (rdtsc() - start) / FB_BENCH_SCROLLS;
+
+    fb_clear();
+}
+
 void fb_clear(void) {
     memset(fb_addr, 0, fb_height * pitch);
     cursor_x = 0;
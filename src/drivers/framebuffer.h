@@ -10,6 +10,25 @@
  */
 void fb_init(struct limine_framebuffer* fb_info);
 
+/**
+ * @brief Returns the address the console currently draws to.
+ */
+void* fb_get_address(void);
+
+/**
+ * @brief Redirects drawing to another mapping of the same framebuffer
+ * (e.g. a write-combining one from vmm_map_mmio()).
+ */
+void fb_set_address(void* address);
+
+/**
+ * @brief Measures console throughput at the current address.
+ * Leaves the screen cleared.
+ * @param char_cycles TSC cycles per character drawn.
+ * @param scroll_cycles TSC cycles per full-screen scroll.
+ */
+void fb_benchmark(uint64_t* char_cycles, uint64_t* scroll_cycles);
+
 /**
  * @brief Clears the screen to black.
  */
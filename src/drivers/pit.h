@@ -10,4 +10,16 @@
  */
 void pit_init(uint32_t frequency);
 
+/**
+ * @brief Measures the TSC frequency against PIT channel 2.
+ * Polls (works with interrupts disabled) for about 10ms.
+ * @return TSC ticks per second, also cached for pit_get_tsc_hz().
+ */
+uint64_t pit_calibrate_tsc(void);
+
+/**
+ * @brief Returns the TSC frequency found by pit_calibrate_tsc() (0 before).
+ */
+uint64_t pit_get_tsc_hz(void);
+
 #endif // __PIT_H__
\ No newline at end of file
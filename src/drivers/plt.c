@@ -1,10 +1,13 @@
 #include "pit.h"
 #include "io.h"         // For outb()
 #include "serialport.h" // For debugging
+#include "cpu.h"        // For rdtsc()
 
 // PIT Registers
 #define PIT_CHANNEL0_DATA 0x40
+#define PIT_CHANNEL2_DATA 0x42
 #define PIT_COMMAND_REG   0x43
+#define PIT_GATE_PORT     0x61 // Bit 0: channel 2 gate, bit 1: speaker, bit 5: OUT2
 
 // PIT's base frequency is ~1.193182 MHz
 #define PIT_BASE_FREQUENCY 1193182
@@ -34,4 +37,40 @@ void pit_init(uint32_t frequency) {
     outb(PIT_CHANNEL0_DATA, high);
     
     serial_write_string("PIT initialized at 100 Hz.\n");
+}
+
+// TSC ticks per second, measured once by pit_calibrate_tsc()
+static uint64_t tsc_hz = 0;
+
+uint64_t pit_calibrate_tsc(void) {
+    // 10ms worth of PIT ticks
+    uint16_t count = PIT_BASE_FREQUENCY / 100;
+
+    // Gate channel 2 on, keep the speaker off
+    uint8_t gate = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+
+    // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+    outb(PIT_COMMAND_REG, 0xB0);
+    outb(PIT_CHANNEL2_DATA, count & 0xFF);
+    outb(PIT_CHANNEL2_DATA, (count >> 8) & 0xFF);
+
+    // Restart the count with a rising edge on the gate
+    uint8_t value = inb(PIT_GATE_PORT);
+    outb(PIT_GATE_PORT, value & ~0x01);
+    outb(PIT_GATE_PORT, value | 0x01);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        // Wait for OUT2 to go high
+    }
+    uint64_t end = rdtsc();
+
+    outb(PIT_GATE_PORT, gate);
+    tsc_hz = (end - start) * 100;
+    return tsc_hz;
+}
+
+uint64_t pit_get_tsc_hz(void) {
+    return tsc_hz;
 }
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include "timer.h"
+#include "spinlock.h"
+#include "cpu.h"        // For rdtsc()
+#include "tick.h"       // For tick_wheel_changed()
+#include <stddef.h>
+
+static volatile uint64_t ticks = 0;
+
+// Once timer_use_tsc() ran, ticks are counted by the TSC instead of by
+// interrupts: tick n starts at tsc_base + n * tsc_per_tick
+static uint64_t tsc_base = 0;
+static uint64_t tsc_per_tick = 0;
+
+// --- Timer Wheel ---
+// Level L holds timers due within 64 slots of 64^L ticks each. Every
+// tick runs one level-0 slot; every 64 ticks one level-1 slot is cascaded
+// (its timers re-inserted into finer levels), and so on up. A timer is
+// cascaded at most once per level, so a tick is O(1) amortized.
+
+#define WHEEL_BITS   6
+#define WHEEL_SIZE   (1u << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+
+static ktimer_t* wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t wheel_time = 0;     // Last tick the wheel processed
+static uint64_t wheel_armed = 0;    // Tick the wheel runs next, see timer_arm_next()
+static spinlock_t wheel_lock = SPINLOCK_INIT;
+
+static void slot_push(ktimer_t** slot, ktimer_t* timer) {
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+    timer->pending = true;
+}
+
+/**
+ * @brief Puts a timer in the finest level whose slot it will be cascaded
+ * or run from in time.
+ */
+static void wheel_insert(ktimer_t* timer) {
+    const unsigned int top_shift = WHEEL_BITS * (WHEEL_LEVELS - 1);
+    uint64_t expires = timer->expires;
+    if (expires <= wheel_time) {
+        expires = wheel_time + 1;
+    } else if ((expires >> top_shift) - (wheel_time >> top_shift) >= WHEEL_SIZE) {
+        // Beyond the wheel: park it in the last top-level slot, from
+        // where it is cascaded and placed again
+        expires = ((wheel_time >> top_shift) + WHEEL_SIZE - 1) << top_shift;
+    }
+
+    // Level L works if the slot is less than a full turn of that level away
+    unsigned int level = 0;
+    unsigned int shift = 0;
+    while ((expires >> shift) - (wheel_time >> shift) >= WHEEL_SIZE) {
+        level++;
+        shift += WHEEL_BITS;
+    }
+
+    slot_push(&wheel[level][(expires >> shift) & WHEEL_MASK], timer);
+}
+
+static void wheel_remove(ktimer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->pending = false;
+}
+
+/**
+ * @brief Advances the wheel by one tick.
+ * @return The timers that expired, linked through `next`.
+ */
+static ktimer_t* wheel_advance(void) {
+    wheel_time++;
+
+    // Cascade coarser slots that came due, coarsest first
+    for (unsigned int level = WHEEL_LEVELS - 1; level > 0; level--) {
+        unsigned int shift = level * WHEEL_BITS;
+        if ((wheel_time & ((1ull << shift) - 1)) != 0) {
+            continue;
+        }
+        ktimer_t** slot = &wheel[level][(wheel_time >> shift) & WHEEL_MASK];
+        ktimer_t* timer = *slot;
+        *slot = NULL;
+        while (timer != NULL) {
+            ktimer_t* next = timer->next;
+            if (timer->expires <= wheel_time) {
+                slot_push(&wheel[0][wheel_time & WHEEL_MASK], timer); // Due this tick
+            } else {
+                wheel_insert(timer);
+            }
+            timer = next;
+        }
+    }
+
+    ktimer_t** slot = &wheel[0][wheel_time & WHEEL_MASK];
+    ktimer_t* expired = NULL;
+    ktimer_t* timer = *slot;
+    *slot = NULL;
+    while (timer != NULL) {
+        ktimer_t* next = timer->next;
+        if (timer->expires > wheel_time) {
+            wheel_insert(timer); // Clamped when armed; not due yet
+        } else {
+            timer->pending = false;
+            timer->next = expired;
+            expired = timer;
+        }
+        timer = next;
+    }
+    return expired;
+}
+
+/**
+ * @brief Earliest tick at which the wheel has something to do: a level-0
+ * slot to run or a coarser slot to cascade (the timers in it may be due
+ * later, so this errs early). UINT64_MAX if the wheel is empty.
+ */
+static uint64_t wheel_next_event(void) {
+    uint64_t next = UINT64_MAX;
+    for (unsigned int level = 0; level < WHEEL_LEVELS; level++) {
+        unsigned int shift = level * WHEEL_BITS;
+        uint64_t base = wheel_time >> shift;
+        for (uint64_t i = 1; i <= WHEEL_SIZE; i++) {
+            if (wheel[level][(base + i) & WHEEL_MASK] != NULL) {
+                uint64_t when = (base + i) << shift;
+                if (when < next) {
+                    next = when;
+                }
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+// --- Public Functions ---
+
+uint64_t get_ticks(void) {
+    if (tsc_per_tick != 0) {
+        return (rdtsc() - tsc_base) / tsc_per_tick;
+    }
+    return ticks;
+}
+
+void timer_use_tsc(uint64_t tsc_hz) {
+    uint64_t per_tick = tsc_hz / TIMER_HZ;
+    tsc_base = rdtsc() - ticks * per_tick; // Carry on from the current tick
+    tsc_per_tick = per_tick;
+}
+
+uint64_t timer_tick_to_tsc(uint64_t tick) {
+    return tsc_base + tick * tsc_per_tick;
+}
+
+// Only the boot CPU calls this (from the PIT); the other CPUs' timers
+// just drive their own schedulers
+void timer_tick(void) {
+    ticks++;
+    timer_run();
+}
+
+void timer_run(void) {
+    uint64_t now = get_ticks();
+
+    // Catch up on the ticks since the last run. After a long idle most
+    // of them have nothing to do: jump over those to the next busy one.
+    spin_lock(&wheel_lock);
+    ktimer_t* expired = NULL;
+    while (wheel_time < now) {
+        if (now - wheel_time > 1) {
+            uint64_t next = wheel_next_event();
+            if (next > now) {
+                wheel_time = now;
+                break;
+            }
+            wheel_time = next - 1;
+        }
+        ktimer_t* batch = wheel_advance();
+        while (batch != NULL) {
+            ktimer_t* next = batch->next;
+            batch->next = expired;
+            expired = batch;
+            batch = next;
+        }
+    }
+    spin_unlock(&wheel_lock);
+
+    // Run callbacks without the lock, so they can re-arm timers
+    while (expired != NULL) {
+        ktimer_t* next = expired->next;
+        expired->callback(expired);
+        expired = next;
+    }
+}
+
+uint64_t timer_arm_next(void) {
+    uint64_t irq = spin_lock_irqsave(&wheel_lock);
+    wheel_armed = wheel_next_event();
+    uint64_t next = wheel_armed;
+    spin_unlock_irqrestore(&wheel_lock, irq);
+    return next;
+}
+
+void timer_init(ktimer_t* timer, void (*callback)(ktimer_t* timer), void* data) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+    timer->pending = false;
+}
+
+void timer_add(ktimer_t* timer, uint64_t expires) {
+    uint64_t irq = spin_lock_irqsave(&wheel_lock);
+    if (timer->pending) {
+        wheel_remove(timer);
+    }
+    timer->expires = expires;
+    wheel_insert(timer);
+    // Sooner than the wheel's owner planned to look: tell it
+    bool sooner = expires < wheel_armed;
+    if (sooner) {
+        wheel_armed = expires;
+    }
+    spin_unlock_irqrestore(&wheel_lock, irq);
+    if (sooner) {
+        tick_wheel_changed();
+    }
+}
+
+bool timer_cancel(ktimer_t* timer) {
+    uint64_t irq = spin_lock_irqsave(&wheel_lock);
+    bool was_pending = timer->pending;
+    if (was_pending) {
+        wheel_remove(timer);
+    }
+    spin_unlock_irqrestore(&wheel_lock, irq);
+    return was_pending;
+}
@@ -2,6 +2,10 @@
 #define __TIMER_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+
+// Timer interrupts per second, on every CPU
+#define TIMER_HZ 100
 
 /**
  * @brief Gets the current number of ticks since boot.
@@ -10,8 +14,65 @@
 uint64_t get_ticks(void);
 
 /**
- * @brief Timer tick handler called on each timer interrupt.
+ * @brief Timer tick handler for a periodic tick (the PIT).
+ * Advances the tick count and runs the timers that expired.
  */
 void timer_tick(void);
 
-#endif // __TIMER_H__
\ No newline at end of file
+/**
+ * @brief Counts ticks with the TSC from now on, so they advance without
+ * an interrupt per tick (see tick.h).
+ */
+void timer_use_tsc(uint64_t tsc_hz);
+
+/**
+ * @brief The TSC value at which tick `tick` starts (after timer_use_tsc()).
+ */
+uint64_t timer_tick_to_tsc(uint64_t tick);
+
+/**
+ * @brief Runs the timers that expired up to get_ticks(), catching up on
+ * any ticks that passed without an interrupt. Called by the CPU that
+ * owns the wheel (the boot CPU).
+ */
+void timer_run(void);
+
+/**
+ * @brief Returns the tick at which timer_run() must run next (UINT64_MAX
+ * if no timer is pending) and remembers it: a timer_add() due sooner
+ * calls tick_wheel_changed().
+ */
+uint64_t timer_arm_next(void);
+
+// --- Timers ---
+// One-shot callbacks at a given tick, kept in a hierarchical timer wheel
+// (4 levels of 64 slots), so arming, cancelling and each tick are O(1).
+// Callbacks run inside the timer interrupt and must not sleep.
+
+typedef struct ktimer {
+    struct ktimer* next;        // Next timer in the wheel slot
+    struct ktimer** pprev;      // The pointer that points at this timer
+    uint64_t expires;           // Tick the callback runs at
+    void (*callback)(struct ktimer* timer);
+    void* data;                 // For the callback
+    bool pending;               // In the wheel
+} ktimer_t;
+
+/**
+ * @brief Sets up a timer (not armed).
+ */
+void timer_init(ktimer_t* timer, void (*callback)(ktimer_t* timer), void* data);
+
+/**
+ * @brief Arms a timer to fire at tick `expires` (next tick if that has
+ * passed). A pending timer is moved.
+ */
+void timer_add(ktimer_t* timer, uint64_t expires);
+
+/**
+ * @brief Disarms a timer.
+ * @return true if it was pending (its callback will not run).
+ */
+bool timer_cancel(ktimer_t* timer);
+
+#endif // __TIMER_H__
@@ -0,0 +1,132 @@
+#include "arena.h"
+#include "pmm.h"
+#include "paging.h"     // For PHYS_TO_VIRT
+#include <stdbool.h>
+
+#define ARENA_ALIGN 16
+
+// Header at the start of every chunk (2^order naturally aligned pages)
+typedef struct arena_chunk {
+    struct arena_chunk* next;   // Older chunk
+    uint64_t order;
+} arena_chunk_t;
+
+static size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// --- Chunks ---
+
+static arena_chunk_t* chunk_create(unsigned int order) {
+    void* phys = pmm_alloc_pages(order);
+    if (phys == NULL) {
+        return NULL;
+    }
+    page_t* page = pmm_phys_to_page((uint64_t)phys);
+    for (uint64_t i = 0; i < (1ull << order); i++) {
+        page[i].owner = PAGE_OWNER_ARENA;
+    }
+
+    arena_chunk_t* chunk = (arena_chunk_t*)PHYS_TO_VIRT(phys);
+    chunk->next = NULL;
+    chunk->order = order;
+    return chunk;
+}
+
+static void chunk_destroy(arena_chunk_t* chunk) {
+    uint64_t phys = VIRT_TO_PHYS(chunk);
+    page_t* page = pmm_phys_to_page(phys);
+    for (uint64_t i = 0; i < (1ull << chunk->order); i++) {
+        page[i].owner = PAGE_OWNER_NONE;
+    }
+    pmm_free_pages((void*)phys, chunk->order);
+}
+
+// Where allocations start in a chunk (after its header, and after the
+// arena header in the first chunk)
+static uint8_t* chunk_data(arena_chunk_t* chunk, bool first) {
+    size_t header = sizeof(arena_chunk_t) + (first ? sizeof(arena_t) : 0);
+    return (uint8_t*)chunk + align_up(header, ARENA_ALIGN);
+}
+
+static uint8_t* chunk_end(arena_chunk_t* chunk) {
+    return (uint8_t*)chunk + (PAGE_SIZE << chunk->order);
+}
+
+// --- Public Functions ---
+
+arena_t* arena_create(size_t size) {
+    // Checked before any rounding, which could wrap a huge size
+    if (size > PMM_MAX_BLOCK_SIZE) {
+        return NULL;
+    }
+    size_t header = align_up(sizeof(arena_chunk_t) + sizeof(arena_t), ARENA_ALIGN);
+    unsigned int order = pmm_size_to_order(header + size);
+    arena_chunk_t* chunk = chunk_create(order);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    arena_t* arena = (arena_t*)(chunk + 1);
+    arena->chunks = chunk;
+    arena->next = chunk_data(chunk, true);
+    arena->end = chunk_end(chunk);
+    arena->order = order;
+    arena->used = 0;
+    arena->peak = 0;
+    return arena;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+    // No chunk can hold more than the largest PMM block
+    if (size > PMM_MAX_BLOCK_SIZE) {
+        return NULL;
+    }
+    size = align_up(size ? size : 1, ARENA_ALIGN);
+
+    if ((size_t)(arena->end - arena->next) < size) {
+        // Start a new chunk; the rest of the current one is abandoned
+        // until the next reset
+        unsigned int order = pmm_size_to_order(align_up(sizeof(arena_chunk_t), ARENA_ALIGN) + size);
+        if (order < arena->order) {
+            order = arena->order;
+        }
+        arena_chunk_t* chunk = chunk_create(order);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = chunk_data(chunk, false);
+        arena->end = chunk_end(chunk);
+    }
+
+    void* ptr = arena->next;
+    arena->next += size;
+    arena->used += size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    return ptr;
+}
+
+void arena_reset(arena_t* arena) {
+    // The arena header lives in the oldest chunk: free all the others
+    while (arena->chunks->next != NULL) {
+        arena_chunk_t* chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        chunk_destroy(chunk);
+    }
+    arena->next = chunk_data(arena->chunks, true);
+    arena->end = chunk_end(arena->chunks);
+    arena->used = 0;
+}
+
+void arena_destroy(arena_t* arena) {
+    arena_chunk_t* chunk = arena->chunks;
+    while (chunk != NULL) {
+        arena_chunk_t* next = chunk->next;
+        chunk_destroy(chunk); // The last one takes the header with it
+        chunk = next;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A scoped bump allocator for short-lived data that dies together (one
+// shell command, one request). Allocation moves a pointer; nothing is
+// freed on its own, arena_reset() drops everything at once. Backed by
+// PMM pages, so transient data never fragments the kmalloc heap.
+//
+// An arena is not locked: each one has a single user at a time.
+
+struct arena_chunk;
+
+typedef struct {
+    struct arena_chunk* chunks; // Newest first; the last one holds this header
+    uint8_t* next;              // Bump pointer in the newest chunk
+    uint8_t* end;               // End of the newest chunk
+    unsigned int order;         // Default chunk size: 2^order pages
+    size_t used;                // Bytes handed out since the last reset
+    size_t peak;                // Highest `used` seen
+} arena_t;
+
+/**
+ * @brief Creates an arena whose first chunk holds at least `size` bytes.
+ * Later chunks are the same size, or bigger for large requests.
+ * @return The arena, or NULL if out of memory.
+ */
+arena_t* arena_create(size_t size);
+
+/**
+ * @brief Allocates `size` bytes, 16-byte aligned. Not zeroed.
+ * @return The memory, or NULL if out of memory.
+ */
+void* arena_alloc(arena_t* arena, size_t size);
+
+/**
+ * @brief Frees everything allocated from the arena. The first chunk is
+ * kept, so an arena reset after every use stays in one chunk.
+ */
+void arena_reset(arena_t* arena);
+
+/**
+ * @brief Returns all of the arena's pages (including the header) to the PMM.
+ */
+void arena_destroy(arena_t* arena);
+
+#endif // __ARENA_H__
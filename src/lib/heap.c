@@ -1,125 +1,586 @@
 #include "heap.h"
 #include "pmm.h"
+#include "paging.h"     // For PHYS_TO_VIRT
+#include "spinlock.h"
+#include "slab.h"
+#include "pit.h"        // For pit_get_tsc_hz()
 #include "serialport.h" // For serial_write_string
+#include "string.h"
 #include <stddef.h>
 #include <stdbool.h>
 
-// A header for each free memory block
-typedef struct heap_block {
-    size_t size;
-    struct heap_block* next;
-} heap_block_t;
+// --- Size Classes ---
+// Powers of two plus the midpoints between them, so no request wastes
+// more than a third of its object.
+static const size_t class_sizes[HEAP_NUM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
 
-// The start of our free list
-static heap_block_t* free_list_head = NULL;
+// One object cache per size class
+static kmem_cache_t classes[HEAP_NUM_CLASSES];
+
+// size_index[(size + 15) / 16] is the class for `size` (size <= 2048)
+static uint8_t size_index[HEAP_MAX_SMALL / 16 + 1];
+
+// Tracing hooks, see heap_trace.c. They must expand inside the public
+// functions so the return address is the caller's.
+#ifdef HEAP_TRACE
+#define TRACE_ALLOC(ptr, size) heap_trace_alloc((ptr), (size), __builtin_return_address(0))
+#define TRACE_FREE(ptr)        heap_trace_free(ptr)
+#else
+#define TRACE_ALLOC(ptr, size) ((void)0)
+#define TRACE_FREE(ptr)        ((void)0)
+#endif
+
+static spinlock_t heap_lock = SPINLOCK_INIT;  // The arena
+static spinlock_t stats_lock = SPINLOCK_INIT; // `stats`
+static heap_stats_t stats;
+
+// --- Page Accounting ---
+
+void heap_account_pages(int64_t pages) {
+    uint64_t irq = spin_lock_irqsave(&stats_lock);
+    stats.pages += pages;
+    if (stats.pages > stats.peak_pages) {
+        stats.peak_pages = stats.pages;
+    }
+    spin_unlock_irqrestore(&stats_lock, irq);
+}
+
+// --- Boundary-Tag Arena (Requests Above HEAP_MAX_SMALL) ---
+// Variable-sized blocks carved out of multi-page chunks, with boundary
+// tags so a freed block merges with free neighbours in O(1).
+//
+// Chunk layout (chunks are naturally aligned PMM blocks):
+//   [btag_chunk_t][prologue footer][block][block]...[epilogue header]
+// Block layout:
+//   [header: size | used][payload ...][footer: size | used]
+// Sizes are multiples of 16 and include the header and footer, so
+// payloads stay 16-byte aligned. Free blocks keep their list links in
+// the payload.
+
+typedef struct btag_chunk {
+    struct btag_chunk* next;
+    struct btag_chunk* prev;
+    uint64_t order;             // Chunk is PAGE_SIZE << order bytes
+    uint64_t reserved;
+} btag_chunk_t;
+
+typedef struct btag_free {
+    struct btag_free* next;
+    struct btag_free* prev;
+} btag_free_t;
+
+#define BTAG_USED         1ull
+#define BTAG_TAG_SIZE     8    // Header or footer
+#define BTAG_OVERHEAD     (2 * BTAG_TAG_SIZE)
+#define BTAG_MIN_BLOCK    32   // Header + list links + footer
+#define BTAG_FIRST_BLOCK  (sizeof(btag_chunk_t) + BTAG_TAG_SIZE)
+#define BTAG_CHUNK_ORDER  4    // Default chunk: 64KiB
+#define BTAG_NUM_BINS     24   // Bin i holds free blocks of [2^i, 2^(i+1))
+
+static btag_chunk_t* btag_chunks = NULL;
+static btag_free_t* btag_bins[BTAG_NUM_BINS];
+static uint32_t btag_bin_mask = 0;         // Bit i set if bin i is non-empty
+static unsigned int btag_empty_chunks = 0; // Wholly free chunks kept around
+
+static inline uint64_t* block_header(void* payload) {
+    return (uint64_t*)((uint8_t*)payload - BTAG_TAG_SIZE);
+}
+
+static inline uint64_t block_size(const uint64_t* header) {
+    return *header & ~(uint64_t)15;
+}
+
+static inline void* block_payload(uint64_t* header) {
+    return (uint8_t*)header + BTAG_TAG_SIZE;
+}
+
+// Writes matching header and footer tags
+static void block_set(uint64_t* header, uint64_t size, bool used) {
+    uint64_t tag = size | (used ? BTAG_USED : 0);
+    header[0] = tag;
+    *(uint64_t*)((uint8_t*)header + size - BTAG_TAG_SIZE) = tag;
+}
+
+static unsigned int btag_bin(uint64_t size) {
+    unsigned int bin = 63 - __builtin_clzll(size);
+    return (bin < BTAG_NUM_BINS) ? bin : BTAG_NUM_BINS - 1;
+}
+
+static void btag_insert(uint64_t* header) {
+    unsigned int bin = btag_bin(block_size(header));
+    btag_free_t* node = (btag_free_t*)block_payload(header);
+    node->prev = NULL;
+    node->next = btag_bins[bin];
+    if (node->next != NULL) {
+        node->next->prev = node;
+    }
+    btag_bins[bin] = node;
+    btag_bin_mask |= 1u << bin;
+}
+
+static void btag_remove(uint64_t* header) {
+    unsigned int bin = btag_bin(block_size(header));
+    btag_free_t* node = (btag_free_t*)block_payload(header);
+    if (node->prev != NULL) {
+        node->prev->next = node->next;
+    } else {
+        btag_bins[bin] = node->next;
+    }
+    if (node->next != NULL) {
+        node->next->prev = node->prev;
+    }
+    if (btag_bins[bin] == NULL) {
+        btag_bin_mask &= ~(1u << bin);
+    }
+}
+
+// Usable bytes for blocks in a chunk of 2^order pages
+static uint64_t btag_chunk_usable(unsigned int order) {
+    return (PAGE_SIZE << order) - BTAG_FIRST_BLOCK - BTAG_TAG_SIZE;
+}
+
+/**
+ * @brief Adds a chunk big enough for a block of `need` bytes and
+ * returns its single free block (already on a free list).
+ */
+static uint64_t* btag_grow(uint64_t need) {
+    unsigned int order = BTAG_CHUNK_ORDER;
+    while (order <= PMM_MAX_ORDER && btag_chunk_usable(order) < need) {
+        order++;
+    }
+    if (order > PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    void* phys = pmm_alloc_pages(order);
+    if (phys == NULL) {
+        return NULL;
+    }
+    // Tag every page so kfree() recognises interior pointers
+    page_t* page = pmm_phys_to_page((uint64_t)phys);
+    for (uint64_t i = 0; i < (1ull << order); i++) {
+        page[i].owner = PAGE_OWNER_HEAP;
+    }
+    heap_account_pages(1ll << order);
+
+    btag_chunk_t* chunk = (btag_chunk_t*)PHYS_TO_VIRT(phys);
+    chunk->order = order;
+    chunk->prev = NULL;
+    chunk->next = btag_chunks;
+    if (btag_chunks != NULL) {
+        btag_chunks->prev = chunk;
+    }
+    btag_chunks = chunk;
+
+    // Prologue footer and epilogue header stop coalescing at the edges
+    uint8_t* base = (uint8_t*)chunk;
+    uint64_t usable = btag_chunk_usable(order);
+    *(uint64_t*)(base + sizeof(btag_chunk_t)) = BTAG_USED;
+    *(uint64_t*)(base + BTAG_FIRST_BLOCK + usable) = BTAG_USED;
+
+    uint64_t* block = (uint64_t*)(base + BTAG_FIRST_BLOCK);
+    block_set(block, usable, false);
+    btag_insert(block);
+    btag_empty_chunks++;
+    return block;
+}
+
+// Is this free block a whole chunk? Only then is it bounded by the
+// prologue and epilogue (tags of size 0) on both sides.
+static btag_chunk_t* btag_whole_chunk(uint64_t* header) {
+    uint64_t* right = (uint64_t*)((uint8_t*)header + block_size(header));
+    if (*(header - 1) != BTAG_USED || *right != BTAG_USED) {
+        return NULL;
+    }
+    return (btag_chunk_t*)((uint8_t*)header - BTAG_FIRST_BLOCK);
+}
+
+static void btag_release_chunk(btag_chunk_t* chunk) {
+    if (chunk->prev != NULL) {
+        chunk->prev->next = chunk->next;
+    } else {
+        btag_chunks = chunk->next;
+    }
+    if (chunk->next != NULL) {
+        chunk->next->prev = chunk->prev;
+    }
+
+    unsigned int order = chunk->order;
+    void* phys = (void*)VIRT_TO_PHYS(chunk);
+    page_t* page = pmm_phys_to_page((uint64_t)phys);
+    for (uint64_t i = 1; i < (1ull << order); i++) {
+        page[i].owner = PAGE_OWNER_NONE;
+    }
+    heap_account_pages(-(1ll << order));
+    pmm_free_pages(phys, order);
+}
+
+/**
+ * @brief Shrinks a used block to `need` bytes, freeing the tail if it
+ * is big enough to be a block of its own.
+ */
+static void btag_split(uint64_t* header, uint64_t need) {
+    uint64_t size = block_size(header);
+    if (size - need < BTAG_MIN_BLOCK) {
+        block_set(header, size, true);
+        return;
+    }
+    block_set(header, need, true);
+    uint64_t* rest = (uint64_t*)((uint8_t*)header + need);
+    block_set(rest, size - need, false);
+
+    // The tail may touch a free block on its right
+    uint64_t* next = (uint64_t*)((uint8_t*)rest + size - need);
+    if (!(*next & BTAG_USED)) {
+        btag_remove(next);
+        block_set(rest, size - need + block_size(next), false);
+    }
+    btag_insert(rest);
+}
+
+// Block size (with tags) for a request of `size` bytes
+static uint64_t btag_block_need(size_t size) {
+    uint64_t need = ((uint64_t)size + BTAG_OVERHEAD + 15) & ~(uint64_t)15;
+    return (need < BTAG_MIN_BLOCK) ? BTAG_MIN_BLOCK : need;
+}
+
+static void* btag_alloc(size_t size) {
+    uint64_t need = btag_block_need(size);
+    uint64_t* found = NULL;
+
+    // First fit in the request's own bin, then any block of a larger bin
+    unsigned int bin = btag_bin(need);
+    for (btag_free_t* node = btag_bins[bin]; node != NULL; node = node->next) {
+        uint64_t* header = block_header(node);
+        if (block_size(header) >= need) {
+            found = header;
+            break;
+        }
+    }
+    if (found == NULL) {
+        uint32_t larger = btag_bin_mask & ~((2u << bin) - 1);
+        if (larger != 0) {
+            found = block_header(btag_bins[__builtin_ctz(larger)]);
+        } else {
+            found = btag_grow(need);
+            if (found == NULL) {
+                return NULL;
+            }
+        }
+    }
+
+    if (btag_whole_chunk(found) != NULL) {
+        btag_empty_chunks--;
+    }
+    btag_remove(found);
+    btag_split(found, need);
+    return block_payload(found);
+}
+
+static void btag_free(void* ptr) {
+    uint64_t* header = block_header(ptr);
+    uint64_t size = block_size(header);
+
+    // Merge with the block on the left (its footer is just before us)
+    uint64_t left_tag = *(header - 1);
+    if (!(left_tag & BTAG_USED)) {
+        uint64_t* left = (uint64_t*)((uint8_t*)header - block_size(&left_tag));
+        btag_remove(left);
+        size += block_size(left);
+        header = left;
+    }
+
+    // Merge with the block on the right
+    uint64_t* right = (uint64_t*)((uint8_t*)header + size);
+    if (!(*right & BTAG_USED)) {
+        btag_remove(right);
+        size += block_size(right);
+    }
+
+    block_set(header, size, false);
+
+    // Give wholly free chunks back, keeping one to absorb churn
+    btag_chunk_t* chunk = btag_whole_chunk(header);
+    if (chunk != NULL) {
+        if (btag_empty_chunks > 0 || chunk->order != BTAG_CHUNK_ORDER) {
+            btag_release_chunk(chunk);
+            return;
+        }
+        btag_empty_chunks++;
+    }
+    btag_insert(header);
+}
 
 /**
- * @brief Requests more memory from the PMM to add to the heap.
- * @return true on success, false if the PMM is out of memory.
+ * @brief Grows or shrinks an arena block in place if possible.
+ * @return true if `ptr` now holds at least `size` bytes.
  */
-static bool request_more_memory() {
-    // Request one page for now
-    void* p = pmm_alloc_page();
-    if (p == NULL) {
-        serial_write_string("ERROR: kmalloc failed to get new page from PMM\n");
-        return false;
-    }
-    
-    // Treat this new page as one giant free block
-    heap_block_t* new_block = (heap_block_t*)p;
-    new_block->size = 4096 - sizeof(heap_block_t); // Size is page size minus our header
-    new_block->next = NULL;
-
-    // kfree will add it to the free list for us
-    kfree((void*)(new_block + 1));
+static bool btag_resize(void* ptr, size_t size) {
+    uint64_t* header = block_header(ptr);
+    uint64_t have = block_size(header);
+    uint64_t need = btag_block_need(size);
+
+    if (need > have) {
+        // Absorb the free block on the right if that is enough
+        uint64_t* right = (uint64_t*)((uint8_t*)header + have);
+        if ((*right & BTAG_USED) || have + block_size(right) < need) {
+            return false;
+        }
+        btag_remove(right);
+        have += block_size(right);
+        block_set(header, have, true);
+    }
+    btag_split(header, need);
     return true;
 }
 
+// --- Public Functions ---
+
 void heap_init(void) {
-    free_list_head = NULL;
+    static const char* names[HEAP_NUM_CLASSES] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64", "kmalloc-96",
+        "kmalloc-128", "kmalloc-192", "kmalloc-256", "kmalloc-384", "kmalloc-512",
+        "kmalloc-768", "kmalloc-1024", "kmalloc-1536", "kmalloc-2048"
+    };
+    for (unsigned int i = 0; i < HEAP_NUM_CLASSES; i++) {
+        kmem_cache_init(&classes[i], names[i], class_sizes[i], 16, NULL);
+    }
+
+    // Map every 16-byte size step to the smallest class that fits it
+    unsigned int c = 0;
+    for (unsigned int i = 0; i <= HEAP_MAX_SMALL / 16; i++) {
+        while (class_sizes[c] < i * 16) {
+            c++;
+        }
+        size_index[i] = c;
+    }
+
+    memset(&stats, 0, sizeof(stats));
     serial_write_string("Kernel heap initialized.\n");
 }
 
+/**
+ * @brief kmalloc() without tracing (krealloc() records its own caller).
+ */
+static void* heap_alloc(size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+
+    void* ptr;
+    if (size <= HEAP_MAX_SMALL) {
+        ptr = kmem_cache_alloc(&classes[size_index[(size + 15) / 16]]);
+    } else if (size > PMM_MAX_BLOCK_SIZE) {
+        // Larger than any PMM block (and rounding it could wrap)
+        ptr = NULL;
+    } else {
+        uint64_t irq = spin_lock_irqsave(&heap_lock);
+        ptr = btag_alloc(size);
+        spin_unlock_irqrestore(&heap_lock, irq);
+    }
+
+    if (ptr == NULL) {
+        serial_write_string("ERROR: kmalloc failed to get memory from PMM\n");
+        return NULL;
+    }
+    __atomic_add_fetch(&stats.allocs, 1, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+static void heap_free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+
+    uint64_t phys = VIRT_TO_PHYS(ptr);
+    page_t* page = pmm_phys_to_page(phys);
+    if (page == NULL) {
+        serial_write_string("ERROR: kfree of a pointer outside the heap\n");
+        return;
+    }
+
+    if (page->owner == PAGE_OWNER_SLAB) {
+        kmem_cache_free(kmem_cache_of(ptr), ptr);
+    } else if (page->owner == PAGE_OWNER_HEAP) {
+        uint64_t irq = spin_lock_irqsave(&heap_lock);
+        btag_free(ptr);
+        spin_unlock_irqrestore(&heap_lock, irq);
+    } else {
+        serial_write_string("ERROR: kfree of a pointer not from kmalloc\n");
+        return;
+    }
+    __atomic_add_fetch(&stats.frees, 1, __ATOMIC_RELAXED);
+}
+
 void* kmalloc(size_t size) {
-    // We must align to the size of our header for sanity
-    if (size < sizeof(heap_block_t)) {
-        size = sizeof(heap_block_t);
-    }
-    
-    // For simplicity, let's also align to 16 bytes for 64-bit
-    size = (size + 15) & ~15;
-
-    // Outer loop to handle requesting more memory
-    while (true) {
-        heap_block_t* curr = free_list_head;
-        heap_block_t* prev = NULL;
-
-        // --- 1. Search the free list for a block ---
-        while (curr != NULL) {
-            if (curr->size >= size) {
-                // Found a block!
-                
-                // Can we split it? We split if the remaining space
-                // is large enough to hold a new block header.
-                if (curr->size > size + sizeof(heap_block_t)) {
-                    // Yes, split the block.
-                    // 1. Create a new header for the *remaining* part.
-                    heap_block_t* new_free_block = (heap_block_t*)((char*)curr + sizeof(heap_block_t) + size);
-                    new_free_block->size = curr->size - size - sizeof(heap_block_t);
-                    new_free_block->next = curr->next;
-                    
-                    // 2. Link the list to this new free block.
-                    if (prev == NULL) {
-                        free_list_head = new_free_block;
-                    } else {
-                        prev->next = new_free_block;
-                    }
-                    
-                    // 3. Resize the block we are returning.
-                    curr->size = size;
-
-                } else {
-                    // No, we can't split. Use the whole block.
-                    // Just unlink it from the list.
-                    if (prev == NULL) {
-                        free_list_head = curr->next;
-                    } else {
-                        prev->next = curr->next;
-                    }
-                }
-                
-                curr->next = NULL; // Not on the free list anymore
-                
-                // Return a pointer to the data area (just *after* the header)
-                return (void*)(curr + 1);
-            }
-            
-            // Not big enough, check next block
-            prev = curr;
-            curr = curr->next;
+    void* ptr = heap_alloc(size);
+    TRACE_ALLOC(ptr, size);
+    return ptr;
+}
+
+void kfree(void* ptr) {
+    TRACE_FREE(ptr);
+    heap_free(ptr);
+}
+
+void* krealloc(void* ptr, size_t size) {
+    if (ptr == NULL) {
+        void* block = heap_alloc(size);
+        TRACE_ALLOC(block, size);
+        return block;
+    }
+    if (size == 0) {
+        TRACE_FREE(ptr);
+        heap_free(ptr);
+        return NULL;
+    }
+
+    size_t old_size;
+    kmem_cache_t* cache = kmem_cache_of(ptr);
+    if (cache != NULL) {
+        old_size = cache->object_size;
+        if (size <= old_size) {
+            TRACE_ALLOC(ptr, size);
+            return ptr;
+        }
+    } else {
+        uint64_t irq = spin_lock_irqsave(&heap_lock);
+        bool resized = size > HEAP_MAX_SMALL && size <= PMM_MAX_BLOCK_SIZE &&
+                       btag_resize(ptr, size);
+        old_size = block_size(block_header(ptr)) - BTAG_OVERHEAD;
+        spin_unlock_irqrestore(&heap_lock, irq);
+        if (resized) {
+            TRACE_ALLOC(ptr, size);
+            return ptr;
         }
+    }
+
+    // Move: new block, copy what fits, free the old one
+    void* moved = heap_alloc(size);
+    if (moved == NULL) {
+        return NULL;
+    }
+    memcpy(moved, ptr, (old_size < size) ? old_size : size);
+    TRACE_FREE(ptr);
+    heap_free(ptr);
+    TRACE_ALLOC(moved, size);
+    return moved;
+}
+
+void heap_get_stats(heap_stats_t* out) {
+    uint64_t irq = spin_lock_irqsave(&stats_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&stats_lock, irq);
 
-        // --- 2. No block found. Request more memory from PMM. ---
-        if (request_more_memory() == false) {
-            // PMM is out of memory, we can't satisfy the request.
-            serial_write_string("PANIC: Kernel heap is out of memory!\n");
-            return NULL;
+    irq = spin_lock_irqsave(&heap_lock);
+
+    // Walk the arena's free lists for fragmentation figures
+    out->arena_chunks = 0;
+    out->arena_bytes = 0;
+    for (btag_chunk_t* chunk = btag_chunks; chunk != NULL; chunk = chunk->next) {
+        out->arena_chunks++;
+        out->arena_bytes += PAGE_SIZE << chunk->order;
+    }
+    out->free_blocks = 0;
+    out->free_bytes = 0;
+    out->largest_free = 0;
+    for (unsigned int bin = 0; bin < BTAG_NUM_BINS; bin++) {
+        for (btag_free_t* node = btag_bins[bin]; node != NULL; node = node->next) {
+            uint64_t size = block_size(block_header(node));
+            out->free_blocks++;
+            out->free_bytes += size;
+            if (size > out->largest_free) {
+                out->largest_free = size;
+            }
         }
-        
-        // If we got here, request_more_memory() succeeded.
-        // The `while(true)` loop will now run again to find the new block.
     }
+    spin_unlock_irqrestore(&heap_lock, irq);
 }
 
-void kfree(void* ptr) {
-    if (ptr == NULL) {
-        return;
+kmem_cache_t* heap_get_class_cache(unsigned int index) {
+    return (index < HEAP_NUM_CLASSES) ? &classes[index] : NULL;
+}
+
+// --- Benchmark ---
+
+#define HEAP_BENCH_OPS   20000
+#define HEAP_BENCH_SLOTS 512
+
+// xorshift64: deterministic, so every run replays the same trace
+static uint64_t bench_rand(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Mostly small objects, some mid-sized ones and the odd multi-page buffer
+static size_t bench_size(uint64_t* state) {
+    uint64_t r = bench_rand(state);
+    unsigned int pick = r % 100;
+    r >>= 8;
+    if (pick < 70) return 8 + r % 249;        // 8..256
+    if (pick < 90) return 257 + r % 1792;     // 257..2048
+    if (pick < 98) return 2049 + r % 14336;   // 2049..16384
+    return 16385 + r % 49152;                 // 16385..65536
+}
+
+void heap_benchmark(heap_bench_result_t* result) {
+    static void* slots[HEAP_BENCH_SLOTS];
+    static size_t slot_sizes[HEAP_BENCH_SLOTS];
+    memset(slots, 0, sizeof(slots));
+    memset(result, 0, sizeof(*result));
+
+    uint64_t irq = spin_lock_irqsave(&stats_lock);
+    uint64_t base_pages = stats.pages;
+    spin_unlock_irqrestore(&stats_lock, irq);
+    uint64_t peak_pages = base_pages; // The global peak is left alone
+
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    uint64_t live_bytes = 0;
+    uint64_t cycles = 0;
+
+    for (unsigned int op = 0; op < HEAP_BENCH_OPS; op++) {
+        unsigned int slot = bench_rand(&state) % HEAP_BENCH_SLOTS;
+        uint64_t start;
+        if (slots[slot] == NULL) {
+            size_t size = bench_size(&state);
+            start = rdtsc();
+            slots[slot] = kmalloc(size);
+            cycles += rdtsc() - start;
+            if (slots[slot] != NULL) {
+                slot_sizes[slot] = size;
+                live_bytes += size;
+                if (live_bytes > result->peak_requested) {
+                    result->peak_requested = live_bytes;
+                }
+                // Pages only grow on allocation: sample them here, untimed
+                irq = spin_lock_irqsave(&stats_lock);
+                if (stats.pages > peak_pages) {
+                    peak_pages = stats.pages;
+                }
+                spin_unlock_irqrestore(&stats_lock, irq);
+            }
+        } else {
+            start = rdtsc();
+            kfree(slots[slot]);
+            cycles += rdtsc() - start;
+            slots[slot] = NULL;
+            live_bytes -= slot_sizes[slot];
+        }
     }
 
-    // Get the header, which is right before the data pointer
-    heap_block_t* block = (heap_block_t*)ptr - 1;
+    for (unsigned int i = 0; i < HEAP_BENCH_SLOTS; i++) {
+        kfree(slots[i]);
+    }
 
-    // Add this block to the front of the free list
-    block->next = free_list_head;
-    free_list_head = block;
-}
\ No newline at end of file
+    result->ops = HEAP_BENCH_OPS;
+    result->cycles_per_op = cycles / HEAP_BENCH_OPS;
+    uint64_t hz = pit_get_tsc_hz();
+    result->ns_per_op = hz ? (cycles * 1000000000ull / hz) / HEAP_BENCH_OPS : 0;
+    result->peak_bytes = (peak_pages - base_pages) * PAGE_SIZE;
+}
@@ -2,6 +2,36 @@
 #define __HEAP_H__
 
 #include <stddef.h> // For size_t
+#include <stdint.h>
+
+// Requests up to this size come from per-size-class slabs; larger ones
+// from a boundary-tag arena grown in multi-page chunks.
+#define HEAP_MAX_SMALL   2048
+#define HEAP_NUM_CLASSES 14
+
+// Heap-wide counters, see heap_get_stats()
+typedef struct {
+    uint64_t pages;      // 4KiB pages held by the heap (slabs + large blocks)
+    uint64_t peak_pages; // Highest value of `pages`
+    uint64_t allocs;     // Successful kmalloc() calls
+    uint64_t frees;      // kfree() calls
+
+    // Arena (requests above HEAP_MAX_SMALL)
+    uint64_t arena_chunks; // Chunks taken from the PMM
+    uint64_t arena_bytes;  // Their total size
+    uint64_t free_blocks;  // Free blocks on the arena's lists
+    uint64_t free_bytes;   // Their total size
+    uint64_t largest_free; // Largest free block
+} heap_stats_t;
+
+// Results of heap_benchmark()
+typedef struct {
+    uint64_t ops;            // kmalloc/kfree calls replayed
+    uint64_t cycles_per_op;
+    uint64_t ns_per_op;      // 0 if the TSC was not calibrated
+    uint64_t peak_requested; // Most bytes live at once (as requested)
+    uint64_t peak_bytes;     // Most bytes of pages the heap held for them
+} heap_bench_result_t;
 
 /**
  * @brief Initializes the kernel heap.
@@ -22,4 +52,99 @@ void* kmalloc(size_t size);
  */
 void kfree(void* ptr);
 
+/**
+ * @brief Resizes a block, in place when possible.
+ * Arena blocks grow into a free block that follows them; otherwise the
+ * data moves to a new block. krealloc(NULL, n) is kmalloc(n) and
+ * krealloc(p, 0) frees p.
+ * @return The (possibly moved) block, or NULL on failure (ptr stays valid).
+ */
+void* krealloc(void* ptr, size_t size);
+
+/**
+ * @brief Copies the heap-wide counters into `out`.
+ */
+void heap_get_stats(heap_stats_t* out);
+
+/**
+ * @brief Returns the object cache behind size class `index`, or NULL.
+ */
+struct kmem_cache* heap_get_class_cache(unsigned int index);
+
+/**
+ * @brief Adds (or with a negative count, removes) pages to the heap's
+ * footprint. Used by the slab layer.
+ */
+void heap_account_pages(int64_t pages);
+
+/**
+ * @brief Replays a fixed mixed-size kmalloc/kfree trace.
+ */
+void heap_benchmark(heap_bench_result_t* result);
+
+// --- Allocation Tracing ---
+// Built with HEAP_TRACE=1, kmalloc/kfree/krealloc record every live block
+// (caller, size, tick) in a side table. Without it none of this exists
+// and the hooks compile to nothing.
+#ifdef HEAP_TRACE
+
+// Live kmalloc memory of one call site, see heap_trace_top_sites()
+typedef struct {
+    uint64_t caller;   // Return address of the kmalloc/krealloc call
+    uint64_t bytes;    // Bytes requested and not yet freed
+    uint64_t blocks;
+} heap_trace_site_t;
+
+// One live block, see heap_trace_since_mark()
+typedef struct {
+    uint64_t ptr;
+    uint64_t caller;
+    uint32_t size;
+    uint32_t age;      // Ticks since it was allocated
+} heap_trace_block_t;
+
+typedef struct {
+    uint64_t blocks;   // Live blocks recorded
+    uint64_t bytes;    // Their requested size
+    uint64_t dropped;  // Allocations not recorded because the table was full
+    uint64_t capacity; // Blocks the table can hold
+} heap_trace_stats_t;
+
+/**
+ * @brief Records a block handed out (or resized in place) for `caller`.
+ */
+void heap_trace_alloc(void* ptr, size_t size, void* caller);
+
+/**
+ * @brief Forgets a block that is being freed.
+ */
+void heap_trace_free(void* ptr);
+
+/**
+ * @brief Copies the side table's counters into `out`.
+ */
+void heap_trace_get_stats(heap_trace_stats_t* out);
+
+/**
+ * @brief Sums live blocks by call site.
+ * @return The number of sites written to `sites`, largest first.
+ */
+unsigned int heap_trace_top_sites(heap_trace_site_t* sites, unsigned int max);
+
+/**
+ * @brief Starts a new leak-tracking window.
+ * @return The tick the mark was set at.
+ */
+uint64_t heap_trace_mark(void);
+
+/**
+ * @brief Lists blocks allocated since the last mark that are still live.
+ * `totals` gets the count and bytes of all of them, even past `max`.
+ * @return The number of blocks written to `blocks`.
+ */
+unsigned int heap_trace_since_mark(heap_trace_block_t* blocks, unsigned int max,
+                                   heap_trace_stats_t* totals);
+
+#endif // HEAP_TRACE
+
 #endif // __HEAP_H__
\ No newline at end of file
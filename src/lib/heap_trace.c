@@ -0,0 +1,222 @@
+#include "heap.h"
+
+#ifdef HEAP_TRACE
+
+#include "spinlock.h"
+#include "timer.h"      // For get_ticks()
+#include "paging.h"     // For KERNEL_VIRTUAL_BASE
+#include "string.h"
+#include <stdbool.h>
+
+// --- Side Table ---
+// One entry per live kmalloc block, in an open-addressing hash table
+// (linear probing, keyed by block address). Deletion shifts later entries
+// back instead of leaving tombstones, so lookups never slow down in long
+// sessions.
+
+#define TRACE_SLOTS      8192                    // Power of two
+#define TRACE_MAX_LIVE   (TRACE_SLOTS / 8 * 7)   // Keep probe chains short
+#define TRACE_MAX_SITES  256                     // Distinct callers heaptop can tell apart
+
+typedef struct {
+    uint64_t ptr;      // Block address, 0 if the slot is empty
+    uint32_t caller;   // Return address, as an offset from KERNEL_VIRTUAL_BASE
+    uint32_t size;     // Bytes requested
+    uint32_t tick;     // When it was allocated
+    uint32_t seq;      // Allocation number, compared against the mark
+} trace_entry_t;
+
+static trace_entry_t table[TRACE_SLOTS];
+static uint32_t live = 0;           // Entries in use
+static uint64_t live_bytes = 0;
+static uint64_t dropped = 0;        // Allocations not recorded (table full)
+static uint32_t next_seq = 0;
+static uint32_t mark_seq = 0;
+static uint64_t mark_tick = 0;
+static spinlock_t trace_lock = SPINLOCK_INIT;
+
+// Scratch space for heap_trace_top_sites(), used under trace_lock
+static heap_trace_site_t site_scratch[TRACE_MAX_SITES];
+
+static uint32_t home_slot(uint64_t ptr) {
+    // Blocks are 16-byte aligned; Fibonacci hashing spreads the rest
+    return (uint32_t)(((ptr >> 4) * 0x9E3779B97F4A7C15ull) >> 51) & (TRACE_SLOTS - 1);
+}
+
+static int32_t find_slot(uint64_t ptr) {
+    for (uint32_t i = home_slot(ptr);; i = (i + 1) & (TRACE_SLOTS - 1)) {
+        if (table[i].ptr == ptr) {
+            return i;
+        }
+        if (table[i].ptr == 0) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Empties slot `i`, moving later entries of the probe chain back
+ * so every entry stays reachable from its home slot.
+ */
+static void remove_slot(uint32_t i) {
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & (TRACE_SLOTS - 1);
+        if (table[j].ptr == 0) {
+            break;
+        }
+        // Entry j may fill the hole unless its home lies cyclically in (i, j]
+        uint32_t home = home_slot(table[j].ptr);
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i].ptr = 0;
+}
+
+// --- Hooks (called by kmalloc/kfree/krealloc) ---
+
+void heap_trace_alloc(void* ptr, size_t size, void* caller) {
+    if (ptr == NULL) {
+        return;
+    }
+    uint64_t irq = spin_lock_irqsave(&trace_lock);
+
+    int32_t slot = find_slot((uint64_t)ptr);
+    if (slot >= 0) {
+        // Resized in place by krealloc()
+        live_bytes -= table[slot].size;
+    } else if (live >= TRACE_MAX_LIVE) {
+        dropped++;
+        spin_unlock_irqrestore(&trace_lock, irq);
+        return;
+    } else {
+        slot = home_slot((uint64_t)ptr);
+        while (table[slot].ptr != 0) {
+            slot = (slot + 1) & (TRACE_SLOTS - 1);
+        }
+        live++;
+    }
+
+    table[slot].ptr = (uint64_t)ptr;
+    table[slot].caller = (uint32_t)((uint64_t)caller - KERNEL_VIRTUAL_BASE);
+    table[slot].size = (uint32_t)size;
+    table[slot].tick = (uint32_t)get_ticks();
+    table[slot].seq = next_seq++;
+    live_bytes += size;
+
+    spin_unlock_irqrestore(&trace_lock, irq);
+}
+
+void heap_trace_free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    uint64_t irq = spin_lock_irqsave(&trace_lock);
+    int32_t slot = find_slot((uint64_t)ptr);
+    if (slot >= 0) {
+        live--;
+        live_bytes -= table[slot].size;
+        remove_slot(slot);
+    }
+    spin_unlock_irqrestore(&trace_lock, irq);
+}
+
+// --- Queries ---
+
+void heap_trace_get_stats(heap_trace_stats_t* out) {
+    uint64_t irq = spin_lock_irqsave(&trace_lock);
+    out->blocks = live;
+    out->bytes = live_bytes;
+    out->dropped = dropped;
+    out->capacity = TRACE_MAX_LIVE;
+    spin_unlock_irqrestore(&trace_lock, irq);
+}
+
+unsigned int heap_trace_top_sites(heap_trace_site_t* sites, unsigned int max) {
+    uint64_t irq = spin_lock_irqsave(&trace_lock);
+
+    // Sum live blocks per caller
+    unsigned int count = 0;
+    for (uint32_t i = 0; i < TRACE_SLOTS; i++) {
+        if (table[i].ptr == 0) {
+            continue;
+        }
+        uint64_t caller = KERNEL_VIRTUAL_BASE + table[i].caller;
+        unsigned int s = 0;
+        while (s < count && site_scratch[s].caller != caller) {
+            s++;
+        }
+        if (s == count) {
+            if (count == TRACE_MAX_SITES) {
+                continue; // Too many distinct callers: ignore the rest
+            }
+            site_scratch[count].caller = caller;
+            site_scratch[count].bytes = 0;
+            site_scratch[count].blocks = 0;
+            count++;
+        }
+        site_scratch[s].bytes += table[i].size;
+        site_scratch[s].blocks++;
+    }
+
+    // Largest first (insertion sort: count is small)
+    for (unsigned int i = 1; i < count; i++) {
+        heap_trace_site_t site = site_scratch[i];
+        unsigned int j = i;
+        while (j > 0 && site_scratch[j - 1].bytes < site.bytes) {
+            site_scratch[j] = site_scratch[j - 1];
+            j--;
+        }
+        site_scratch[j] = site;
+    }
+
+    if (count > max) {
+        count = max;
+    }
+    memcpy(sites, site_scratch, count * sizeof(heap_trace_site_t));
+    spin_unlock_irqrestore(&trace_lock, irq);
+    return count;
+}
+
+uint64_t heap_trace_mark(void) {
+    uint64_t irq = spin_lock_irqsave(&trace_lock);
+    mark_seq = next_seq;
+    mark_tick = get_ticks();
+    spin_unlock_irqrestore(&trace_lock, irq);
+    return mark_tick;
+}
+
+unsigned int heap_trace_since_mark(heap_trace_block_t* blocks, unsigned int max,
+                                   heap_trace_stats_t* totals) {
+    uint64_t irq = spin_lock_irqsave(&trace_lock);
+    uint32_t now = (uint32_t)get_ticks();
+    unsigned int count = 0;
+
+    totals->blocks = 0;
+    totals->bytes = 0;
+    totals->dropped = dropped;
+    totals->capacity = TRACE_MAX_LIVE;
+    for (uint32_t i = 0; i < TRACE_SLOTS; i++) {
+        // Sequence numbers wrap, so compare by distance from the mark
+        if (table[i].ptr == 0 || table[i].seq - mark_seq >= next_seq - mark_seq) {
+            continue;
+        }
+        totals->blocks++;
+        totals->bytes += table[i].size;
+        if (count < max) {
+            blocks[count].ptr = table[i].ptr;
+            blocks[count].caller = KERNEL_VIRTUAL_BASE + table[i].caller;
+            blocks[count].size = table[i].size;
+            blocks[count].age = now - table[i].tick;
+            count++;
+        }
+    }
+
+    spin_unlock_irqrestore(&trace_lock, irq);
+    return count;
+}
+
+#endif // HEAP_TRACE
@@ -2,8 +2,19 @@
 #include "framebuffer.h" // For fb_print, fb_putchar, etc.
 #include "string.h"  // For strcmp
 #include "pmm.h"         // For alloc command
+#include "cpu.h"         // For MAX_CPUS
+#include "vmm.h"         // For vmtest command
 #include "heap.h"        // For ktest command
+#include "slab.h"        // For slabinfo command
 #include "timer.h"       // For uptime command
+#include "pit.h"         // For TSC frequency
+#include "task.h"        // For heapmt command
+#include "fpu.h"         // For fpustat command
+#include "irq.h"         // For irqinfo command
+#include "ioapic.h"      // For irqinfo command
+#include "tick.h"        // For wakeups command
+#include "arena.h"       // For per-command scratch memory
+#include "serialport.h"  // For serial_write_string
 #include "tar.h"        
 
 // --- Shell Buffer  ---
@@ -11,6 +22,62 @@ static char line_buffer[256];
 static int buffer_index = 0;
 #define MAX_BUFFER 255
 
+// --- Command Scratch ---
+// Everything a command needs only while it runs (its argument words,
+// result tables) comes from this arena, which is reset after each command.
+#define SHELL_SCRATCH_SIZE (4 * PAGE_SIZE)
+#define SHELL_MAX_ARGS     16
+static arena_t* scratch = NULL;
+
+/**
+ * @brief Splits a command line into space-separated words, copied into
+ * the scratch arena.
+ * @return The number of words stored in argv (at most `max`).
+ */
+static int shell_split(const char* line, char** argv, int max) {
+    int argc = 0;
+    while (argc < max) {
+        while (*line == ' ') {
+            line++;
+        }
+        if (*line == '\0') {
+            break;
+        }
+        size_t len = 0;
+        while (line[len] != ' ' && line[len] != '\0') {
+            len++;
+        }
+        char* word = (char*)arena_alloc(scratch, len + 1);
+        if (word == NULL) {
+            break;
+        }
+        memcpy(word, line, len);
+        word[len] = '\0';
+        argv[argc++] = word;
+        line += len;
+    }
+    return argc;
+}
+
+/**
+ * @brief Parses a decimal command argument.
+ * @return false if `word` is empty or not all digits.
+ */
+static bool shell_parse_uint(const char* word, uint64_t* out) {
+    uint64_t value = 0;
+    if (*word == '\0') {
+        return false;
+    }
+    for (; *word != '\0'; word++) {
+        if (*word < '0' || *word > '9') {
+            return false;
+        }
+        value = value * 10 + (uint64_t)(*word - '0');
+    }
+    *out = value;
+    return true;
+}
+
 // --- Print Helpers ---
 static void fb_print_uint(uint64_t n) {
     if (n == 0) {
@@ -37,11 +104,293 @@ static void fb_print_hex(uint64_t n) {
     }
 }
 
+// --- Multi-task Heap Benchmark ---
+// The shell runs inside the keyboard interrupt, so it cannot wait for
+// other tasks. 'heapmt' wakes a coordinator task instead, which runs one
+// round per worker count and prints the results when they are in.
+#define HEAPMT_MAX_WORKERS 8
+#define HEAPMT_ITERATIONS  8192 // Batches per worker and round
+#define HEAPMT_BATCH       16   // Objects held at once by a worker
+
+static bool heapmt_ready = false;
+static volatile bool heapmt_requested = false;
+static volatile uint32_t heapmt_round = 0;   // Bumped to start a round
+static volatile uint32_t heapmt_workers = 0; // Workers taking part in it
+static volatile uint32_t heapmt_done = 0;    // Workers finished with it
+static uint64_t heapmt_finish = 0;           // TSC when the last one finished
+static uint32_t heapmt_next_id = 0;
+static wait_queue_t heapmt_request_wq = WAIT_QUEUE_INIT; // Coordinator waits for 'heapmt'
+static wait_queue_t heapmt_start_wq = WAIT_QUEUE_INIT;   // Workers wait for a round
+static wait_queue_t heapmt_done_wq = WAIT_QUEUE_INIT;    // Coordinator waits for workers
+
+static void heapmt_worker(void) {
+    uint32_t id = __atomic_fetch_add(&heapmt_next_id, 1, __ATOMIC_RELAXED);
+    uint32_t seen = 0;
+    void* batch[HEAPMT_BATCH];
+
+    for (;;) {
+        wait_event(heapmt_start_wq, heapmt_round != seen);
+        seen = heapmt_round;
+        if (id >= heapmt_workers) {
+            continue;
+        }
+
+        for (unsigned int i = 0; i < HEAPMT_ITERATIONS; i++) {
+            for (unsigned int j = 0; j < HEAPMT_BATCH; j++) {
+                batch[j] = kmalloc(32u << (j % 6)); // 32..1024 bytes
+            }
+            for (unsigned int j = 0; j < HEAPMT_BATCH; j++) {
+                kfree(batch[j]);
+            }
+        }
+
+        // Record the latest finish time before counting ourselves done
+        uint64_t now = rdtsc();
+        uint64_t last = heapmt_finish;
+        while (now > last && !__atomic_compare_exchange_n(&heapmt_finish, &last, now, true,
+                                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        __atomic_add_fetch(&heapmt_done, 1, __ATOMIC_RELEASE);
+        wake_up(&heapmt_done_wq);
+    }
+}
+
+static void heapmt_coordinator(void) {
+    for (;;) {
+        wait_event(heapmt_request_wq, heapmt_requested);
+
+        uint64_t hz = pit_get_tsc_hz();
+        uint64_t base_rate = 0;
+        fb_print("heapmt: kmalloc/kfree throughput by task count\n");
+        fb_print("  tasks  ops/s  scaling (x100)\n");
+        for (uint32_t n = 1; n <= HEAPMT_MAX_WORKERS; n *= 2) {
+            heapmt_done = 0;
+            heapmt_workers = n;
+            heapmt_finish = 0;
+            uint64_t start = rdtsc();
+            __atomic_add_fetch(&heapmt_round, 1, __ATOMIC_RELEASE);
+            wake_up(&heapmt_start_wq);
+            wait_event(heapmt_done_wq, __atomic_load_n(&heapmt_done, __ATOMIC_ACQUIRE) >= n);
+
+            uint64_t cycles = heapmt_finish - start;
+            uint64_t ops = (uint64_t)n * HEAPMT_ITERATIONS * HEAPMT_BATCH * 2;
+            uint64_t rate = (cycles && hz) ? ops * hz / cycles : 0;
+            if (n == 1) {
+                base_rate = rate;
+            }
+            fb_print("  ");
+            fb_print_uint(n);
+            fb_print("  ");
+            fb_print_uint(rate);
+            fb_print("  ");
+            fb_print_uint(base_rate ? rate * 100 / base_rate : 0);
+            fb_print("\n");
+        }
+        heapmt_requested = false;
+    }
+}
+
+/**
+ * @brief Starts the benchmark; the tasks are created on first use and
+ * then wait for the next request.
+ */
+static bool heapmt_start(void) {
+    if (!heapmt_ready) {
+        for (int i = 0; i < HEAPMT_MAX_WORKERS; i++) {
+            if (create_task(heapmt_worker) == NULL) {
+                return false;
+            }
+        }
+        // It prints: keep it on the boot CPU, with the shell
+        if (create_task_on(heapmt_coordinator, 0) == NULL) {
+            return false;
+        }
+        heapmt_ready = true;
+    }
+    if (heapmt_requested) {
+        return false;
+    }
+    heapmt_requested = true;
+    wake_up(&heapmt_request_wq);
+    return true;
+}
+
+// 'spawnbench' creates short tasks that return right away; the reaper
+// frees them, so a second run gets its stacks from the stack cache.
+// It runs in a task of its own so that it can wait for the children.
+#define SPAWNBENCH_TASKS 32
+
+static volatile bool spawnbench_running = false;
+static volatile uint32_t spawnbench_ran = 0;
+static wait_queue_t spawnbench_done_wq = WAIT_QUEUE_INIT;
+
+static void spawnbench_child(void) {
+    __atomic_add_fetch(&spawnbench_ran, 1, __ATOMIC_RELEASE);
+    wake_up(&spawnbench_done_wq);
+}
+
+static void spawnbench_task(void) {
+    task_stats_t before, after;
+    task_get_stats(&before);
+    spawnbench_ran = 0;
+    uint64_t cycles = 0;
+    uint32_t created = 0;
+    for (; created < SPAWNBENCH_TASKS; created++) {
+        uint64_t start = rdtsc();
+        task_t* task = create_task(spawnbench_child);
+        cycles += rdtsc() - start;
+        if (task == NULL) {
+            break;
+        }
+    }
+    wait_event(spawnbench_done_wq, __atomic_load_n(&spawnbench_ran, __ATOMIC_ACQUIRE) >= created);
+    task_get_stats(&after);
+
+    fb_print("Created "); fb_print_uint(created);
+    fb_print(" tasks, "); fb_print_uint(created ? cycles / created : 0);
+    fb_print(" cycles each\n");
+    fb_print("  Stacks reused: "); fb_print_uint(after.stack_hits - before.stack_hits);
+    fb_print(", from the PMM: "); fb_print_uint(after.stack_misses - before.stack_misses);
+    fb_print("\n");
+    fb_print("  Total created: "); fb_print_uint(after.created);
+    fb_print(", exited: "); fb_print_uint(after.exited);
+    fb_print(", reaped: "); fb_print_uint(after.reaped);
+    fb_print(", stacks cached: "); fb_print_uint(after.cached_stacks);
+    fb_print("\n");
+    fb_print("  Children run: "); fb_print_uint(spawnbench_ran);
+    fb_print("\n");
+    spawnbench_running = false;
+}
+
+// 'switchbench' blocks, so it runs in a task of its own that exits
+// once it has printed the results
+#define SWITCHBENCH_ROUNDS 10000
+
+static volatile bool switchbench_running = false;
+
+static void switchbench_task(void) {
+    switch_bench_result_t result;
+    if (!task_switch_benchmark(SWITCHBENCH_ROUNDS, &result)) {
+        fb_print("switchbench: could not create the helper task\n");
+    } else {
+        fb_print("Task switch latency (cycles per switch, ");
+        fb_print_uint(result.rounds);
+        fb_print(" round trips):\n");
+        fb_print("  before (interrupt frame, 22-word copy, iretq):  ");
+        fb_print_uint(result.frame_copy_cycles);
+        fb_print("\n  after (task_yield, callee-saved swap):  ");
+        fb_print_uint(result.yield_cycles);
+        fb_print("\n");
+    }
+    switchbench_running = false;
+}
+
+// 'smpbench' splits a fixed amount of CPU-bound work over 1, 2, 4...
+// tasks, one per CPU, and reports the speedup over one CPU. The
+// coordinator prints, so it stays on the boot CPU with the shell.
+#define SMPBENCH_WORK 50000000ull   // Loop iterations per round, in total
+
+static volatile bool smpbench_running = false;
+static volatile uint32_t smpbench_workers = 0;
+static volatile uint32_t smpbench_done = 0;
+static volatile uint64_t smpbench_sink = 0;
+static wait_queue_t smpbench_done_wq = WAIT_QUEUE_INIT;
+
+static void smpbench_worker(void) {
+    uint64_t x = rdtsc() | 1;
+    for (uint64_t i = SMPBENCH_WORK / smpbench_workers; i > 0; i--) {
+        // xorshift64: no memory traffic, so CPUs do not slow each other down
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    smpbench_sink = x;
+    __atomic_add_fetch(&smpbench_done, 1, __ATOMIC_RELEASE);
+    wake_up(&smpbench_done_wq);
+}
+
+static void smpbench_task(void) {
+    uint32_t cpus = task_online_cpus();
+    uint64_t base_cycles = 0;
+    fb_print("smpbench: ");
+    fb_print_uint(cpus);
+    fb_print(" CPUs online\n");
+    fb_print("  tasks  cycles  speedup (x100)\n");
+    for (uint32_t n = 1; n <= cpus; n *= 2) {
+        smpbench_workers = n;
+        smpbench_done = 0;
+        uint64_t start = rdtsc();
+        uint32_t created = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (create_task_on(smpbench_worker, i) != NULL) {
+                created++;
+            }
+        }
+        wait_event(smpbench_done_wq, __atomic_load_n(&smpbench_done, __ATOMIC_ACQUIRE) >= created);
+        uint64_t cycles = rdtsc() - start;
+        if (created < n) {
+            fb_print("smpbench: out of memory\n");
+            break;
+        }
+        if (n == 1) {
+            base_cycles = cycles;
+        }
+        fb_print("  ");
+        fb_print_uint(n);
+        fb_print("  ");
+        fb_print_uint(cycles);
+        fb_print("  ");
+        fb_print_uint(cycles ? base_cycles * 100 / cycles : 0);
+        fb_print("\n");
+    }
+    smpbench_running = false;
+}
+
+// 'wakeups' counts each CPU's timer interrupts and reschedule IPIs over
+// one second, from a task that sleeps in between (its own wakeup shows
+// up on the boot CPU)
+static volatile bool wakeups_running = false;
+
+static void wakeups_task(void) {
+    static tick_stats_t before[MAX_CPUS];
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        tick_get_stats(cpu, &before[cpu]);
+    }
+    task_sleep_ticks(TIMER_HZ);
+
+    fb_print(tick_oneshot() ? "Wakeups per second (tickless):\n" : "Wakeups per second (periodic tick):\n");
+    fb_print("CPU  timer  IPI\n");
+    for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        task_cpu_stats_t online;
+        tick_stats_t after;
+        if (!task_get_cpu_stats(cpu, &online) || !tick_get_stats(cpu, &after)) {
+            continue;
+        }
+        fb_print_uint(cpu);
+        fb_print("  "); fb_print_uint(after.timer - before[cpu].timer);
+        fb_print("  "); fb_print_uint(after.ipi - before[cpu].ipi);
+        fb_print("\n");
+    }
+    wakeups_running = false;
+}
+
 // --- Command Execution ---
-static void shell_execute(const char* command) {
+static void shell_execute(const char* line) {
+    char** argv = (scratch != NULL) ? (char**)arena_alloc(scratch, SHELL_MAX_ARGS * sizeof(char*)) : NULL;
+    if (argv == NULL) {
+        fb_print("shell: out of scratch memory\n");
+        return;
+    }
+    int argc = shell_split(line, argv, SHELL_MAX_ARGS);
+    const char* command = (argc > 0) ? argv[0] : "";
+
     if (strcmp(command, "help") == 0) {
         fb_print("Welcome to myOS!\n");
-        fb_print("Available commands: help, clear, panic, alloc, ktest, uptime, syscall, cat, ls\n");
+        fb_print("Available commands: help, clear, panic, alloc, pmmbench, pmmstat, pages, vmtest, vmmap, ctxbench, fbbench, schedbench, switchbench, spawnbench, smpbench, rqstat, irqinfo [irq cpu], wakeups, fpustat, ktest, heapbench, heapmt, heapstat, "
+#ifdef HEAP_TRACE
+                 "heaptop, heapmark, heapleaks, "
+#endif
+                 "slabinfo, uptime, syscall, cat [file], ls\n");
     }
     else if (strcmp(command, "clear") == 0) {
         fb_clear();
@@ -64,6 +413,393 @@ static void shell_execute(const char* command) {
         else {
             fb_print("  Allocation failed! Out of memory.\n");
         }
+
+        fb_print("Allocating one 2MiB block (order 9)...\n");
+        void* big = pmm_alloc_pages(9);
+        if (big != NULL) {
+            fb_print("  Successfully allocated 2MiB at: ");
+            fb_print_hex((uint64_t)big);
+            fb_print(((uint64_t)big & 0x1FFFFF) == 0 ? " (aligned)" : " (NOT aligned!)");
+            fb_print("\n  Freeing it back...\n");
+            pmm_free_pages(big, 9);
+        }
+        else {
+            fb_print("  Allocation failed! No contiguous 2MiB block.\n");
+        }
+
+        fb_print("Free pages: ");
+        fb_print_uint(pmm_get_free_pages());
+        fb_print(" / ");
+        fb_print_uint(pmm_get_total_pages());
+        fb_print("\n");
+    }
+    else if (strcmp(command, "pmmbench") == 0) {
+        static const unsigned int levels[] = { 10, 50, 90, 99 };
+        fb_print("PMM allocation latency (cycles per operation):\n");
+        fb_print("  used%  free pages  bit scan  word scan  alloc+free\n");
+        for (unsigned int i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+            pmm_bench_result_t result;
+            pmm_benchmark(levels[i], &result);
+            fb_print("  ");
+            fb_print_uint(levels[i]);
+            fb_print("%    ");
+            fb_print_uint(result.free_pages);
+            fb_print("  ");
+            fb_print_uint(result.bitwise_cycles);
+            fb_print("  ");
+            fb_print_uint(result.word_cycles);
+            fb_print("  ");
+            fb_print_uint(result.alloc_cycles);
+            fb_print("\n");
+        }
+    }
+    else if (strcmp(command, "pmmstat") == 0) {
+        fb_print("Per-CPU page caches:\n");
+        fb_print("  cpu  cached  low/high/batch  alloc hits/misses  hit%  refills  drains\n");
+        for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            pmm_cache_stats_t stats;
+            pmm_cache_get_stats(cpu, &stats);
+            uint64_t allocs = stats.alloc_hits + stats.alloc_misses;
+            if (allocs == 0 && stats.free_hits + stats.free_misses == 0) {
+                continue; // CPU never used its cache
+            }
+            fb_print("  ");
+            fb_print_uint(cpu);
+            fb_print("    ");
+            fb_print_uint(stats.cached);
+            fb_print("  ");
+            fb_print_uint(stats.low);
+            fb_print("/");
+            fb_print_uint(stats.high);
+            fb_print("/");
+            fb_print_uint(stats.batch);
+            fb_print("  ");
+            fb_print_uint(stats.alloc_hits);
+            fb_print("/");
+            fb_print_uint(stats.alloc_misses);
+            fb_print("  ");
+            fb_print_uint(allocs ? (stats.alloc_hits * 100) / allocs : 0);
+            fb_print("  ");
+            fb_print_uint(stats.refills);
+            fb_print("  ");
+            fb_print_uint(stats.drains);
+            fb_print("\n");
+        }
+
+        pmm_zero_pool_stats_t zero;
+        pmm_zero_pool_get_stats(&zero);
+        fb_print("Zeroed page pool: ");
+        fb_print_uint(zero.pooled);
+        fb_print(" pooled, ");
+        fb_print_uint(zero.hits);
+        fb_print(" hits, ");
+        fb_print_uint(zero.misses);
+        fb_print(" misses, ");
+        fb_print_uint(zero.zeroed_in_idle);
+        fb_print(" zeroed in idle\n");
+    }
+    else if (strcmp(command, "pages") == 0) {
+        static const char* owner_names[PAGE_OWNER_COUNT] = {
+            "free", "kernel", "pmm", "kernel image", "bootloader", "firmware",
+            "device", "page table", "stack", "heap", "slab", "arena", "shared", "zero pool"
+        };
+        uint64_t counts[PAGE_OWNER_COUNT];
+        pmm_count_owners(counts);
+        fb_print("Page frame database (4KiB pages by owner):\n");
+        for (int i = 0; i < PAGE_OWNER_COUNT; i++) {
+            if (counts[i] == 0) {
+                continue;
+            }
+            fb_print("  ");
+            fb_print(owner_names[i]);
+            fb_print(": ");
+            fb_print_uint(counts[i]);
+            fb_print("\n");
+        }
+    }
+    else if (strcmp(command, "vmtest") == 0) {
+        page_table_t* pml4 = vmm_get_kernel_pml4();
+        uint64_t tables_before;
+        uint64_t counts[PAGE_OWNER_COUNT];
+        pmm_count_owners(counts);
+        tables_before = counts[PAGE_OWNER_PAGE_TABLE];
+
+        fb_print("Mapping one 4KiB page in the VMM test window...\n");
+        void* frame = pmm_alloc_zeroed_page();
+        if (frame == NULL || !vmm_map(pml4, VMM_TEST_BASE, (uint64_t)frame, PTE_WRITE, PAGE_SIZE)) {
+            fb_print("  Mapping failed!\n");
+            if (frame != NULL) pmm_free_page(frame);
+            return;
+        }
+        volatile uint64_t* window = (volatile uint64_t*)VMM_TEST_BASE;
+        window[0] = 0xC0FFEEull;
+        fb_print("  Translated to: ");
+        fb_print_hex(vmm_virt_to_phys(pml4, VMM_TEST_BASE));
+        fb_print(*(volatile uint64_t*)PHYS_TO_VIRT(frame) == 0xC0FFEEull ? " (write visible via HHDM)\n"
+                                                                         : " (write NOT visible!)\n");
+        vmm_unmap(pml4, VMM_TEST_BASE, PAGE_SIZE);
+        pmm_free_page(frame);
+
+        fb_print("Mapping 2MiB, then unmapping its first 4KiB...\n");
+        void* block = pmm_alloc_pages(9);
+        if (block != NULL && vmm_map(pml4, VMM_TEST_BASE, (uint64_t)block, PTE_WRITE, PAGE_SIZE_2M)) {
+            vmm_unmap(pml4, VMM_TEST_BASE, PAGE_SIZE);
+            fb_print("  First page: ");
+            fb_print(vmm_virt_to_phys(pml4, VMM_TEST_BASE) == 0 ? "unmapped" : "STILL MAPPED!");
+            fb_print(", second page: ");
+            fb_print(vmm_virt_to_phys(pml4, VMM_TEST_BASE + PAGE_SIZE) == (uint64_t)block + PAGE_SIZE
+                     ? "mapped\n" : "WRONG!\n");
+            vmm_unmap(pml4, VMM_TEST_BASE, PAGE_SIZE_2M);
+        } else {
+            fb_print("  Mapping failed!\n");
+        }
+        if (block != NULL) pmm_free_pages(block, 9);
+
+        pmm_count_owners(counts);
+        fb_print("Page tables before/after: ");
+        fb_print_uint(tables_before);
+        fb_print("/");
+        fb_print_uint(counts[PAGE_OWNER_PAGE_TABLE]);
+        fb_print("\n");
+    }
+    else if (strcmp(command, "vmmap") == 0) {
+        static const struct { const char* name; uint64_t start, end; } regions[] = {
+            { "identity", 0, 0x0000800000000000ull },
+            { "hhdm    ", VIRTUAL_MEMORY_OFFSET, VMALLOC_BASE },
+            { "vmalloc ", VMALLOC_BASE, KERNEL_VIRTUAL_BASE },
+            { "kernel  ", KERNEL_VIRTUAL_BASE, 0xffffffffffffffffull },
+        };
+        vmm_layout_t layout;
+        vmm_get_layout(&layout);
+
+        fb_print("Kernel address space:\n");
+        fb_print("  Direct map: ");
+        fb_print_uint(layout.hhdm_size >> 20);
+        fb_print(" MiB, 1GiB pages ");
+        fb_print(layout.gb_pages ? "supported\n" : "not supported\n");
+        fb_print("  Kernel image: ");
+        fb_print_hex(layout.kernel_virt);
+        fb_print(" + ");
+        fb_print_uint(layout.kernel_size >> 10);
+        fb_print(" KiB");
+        fb_print(layout.kernel_large_pages ? " (2MiB layout)\n" : " (4KiB layout, not 2MiB congruent)\n");
+        fb_print("  Global pages: ");
+        fb_print(layout.global_pages ? "on" : "off");
+        fb_print(", PCID: ");
+        fb_print(layout.pcid ? "on" : "off");
+        fb_print(", PAT write-combining: ");
+        fb_print(layout.pat ? "on\n" : "off\n");
+
+        fb_print("  region    4KiB    2MiB    1GiB    tables\n");
+        for (unsigned int i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+            vmm_region_stats_t stats;
+            vmm_get_region_stats(vmm_get_kernel_pml4(), regions[i].start, regions[i].end, &stats);
+            fb_print("  ");
+            fb_print(regions[i].name);
+            fb_print("  ");
+            fb_print_uint(stats.pages_4k);
+            fb_print("    ");
+            fb_print_uint(stats.pages_2m);
+            fb_print("    ");
+            fb_print_uint(stats.pages_1g);
+            fb_print("    ");
+            fb_print_uint(stats.tables);
+            fb_print("\n");
+        }
+    }
+    else if (strcmp(command, "ctxbench") == 0) {
+        static const char* mode_names[3] = { "no global", "global   ", "pcid     " };
+        vmm_ctx_bench_t result;
+        vmm_ctx_benchmark(&result);
+        vmm_ctx_bench_mode_t* modes[3] = { &result.flush, &result.global, &result.pcid };
+        bool available[3] = { true, result.pge_supported, result.pcid_supported };
+
+        fb_print("Address space switch cost (cycles), working set of ");
+        fb_print_uint(result.pages);
+        fb_print(" pages:\n");
+        fb_print("  warm (no switch): ");
+        fb_print_uint(result.warm_cycles);
+        fb_print("\n  mode       switch  refill  penalty\n");
+        for (int i = 0; i < 3; i++) {
+            fb_print("  ");
+            fb_print(mode_names[i]);
+            if (!available[i]) {
+                fb_print("  not supported by this CPU\n");
+                continue;
+            }
+            fb_print("  ");
+            fb_print_uint(modes[i]->switch_cycles);
+            fb_print("  ");
+            fb_print_uint(modes[i]->refill_cycles);
+            fb_print("  ");
+            fb_print_uint(modes[i]->refill_cycles > result.warm_cycles
+                          ? modes[i]->refill_cycles - result.warm_cycles : 0);
+            fb_print("\n");
+        }
+    }
+    else if (strcmp(command, "fbbench") == 0) {
+        // Compare an uncached console with the write-combining one it
+        // normally uses. The mapping (and its HHDM alias) is retyped in
+        // place, so the framebuffer never has two conflicting types.
+        struct limine_framebuffer* fb = vmm_get_framebuffer();
+        void* console = fb_get_address();
+        uint64_t fb_size = fb->pitch * fb->height;
+        static const uint64_t types[2] = { PTE_CACHE_UC, PTE_CACHE_WC };
+        uint64_t char_cycles[2] = { 0, 0 }, scroll_cycles[2] = { 0, 0 };
+        uint64_t hz = pit_get_tsc_hz();
+
+        for (int i = 0; i < 2; i++) {
+            if (vmm_set_mmio_cache(console, fb_size, types[i])) {
+                fb_benchmark(&char_cycles[i], &scroll_cycles[i]);
+            }
+        }
+
+        static const char* names[2] = { "uncached       ", "write-combining" };
+        fb_print("Console throughput:\n");
+        fb_print("  mapping          chars/s  scrolls/s\n");
+        for (int i = 0; i < 2; i++) {
+            fb_print("  ");
+            fb_print(names[i]);
+            fb_print("  ");
+            fb_print_uint(char_cycles[i] ? hz / char_cycles[i] : 0);
+            fb_print("  ");
+            fb_print_uint(scroll_cycles[i] ? hz / scroll_cycles[i] : 0);
+            fb_print("\n");
+        }
+        if (char_cycles[0] == 0 || char_cycles[1] == 0) {
+            fb_print("  (could not change the framebuffer's memory type)\n");
+        }
+    }
+    else if (strcmp(command, "schedbench") == 0) {
+        static const uint32_t task_counts[] = { 10, 100, 1000 };
+        fb_print("Cost of picking the next task (cycles):\n");
+        fb_print("  tasks  list walk (1 ready)  bitmap (1 ready)  bitmap (all ready)\n");
+        for (unsigned int i = 0; i < sizeof(task_counts) / sizeof(task_counts[0]); i++) {
+            sched_bench_result_t result;
+            fb_print("  ");
+            fb_print_uint(task_counts[i]);
+            if (!task_sched_benchmark(task_counts[i], &result)) {
+                fb_print("  out of memory\n");
+                continue;
+            }
+            fb_print("  ");
+            fb_print_uint(result.list_cycles);
+            fb_print("  ");
+            fb_print_uint(result.bitmap_cycles);
+            fb_print("  ");
+            fb_print_uint(result.bitmap_busy_cycles);
+            fb_print("\n");
+        }
+    }
+    else if (strcmp(command, "switchbench") == 0) {
+        if (switchbench_running) {
+            fb_print("switchbench: already running\n");
+        } else {
+            switchbench_running = true;
+            if (create_task_on(switchbench_task, 0) == NULL) {
+                fb_print("switchbench: out of memory\n");
+                switchbench_running = false;
+            }
+        }
+    }
+    else if (strcmp(command, "smpbench") == 0) {
+        if (smpbench_running) {
+            fb_print("smpbench: already running\n");
+        } else {
+            smpbench_running = true;
+            if (create_task_on(smpbench_task, 0) == NULL) {
+                fb_print("smpbench: out of memory\n");
+                smpbench_running = false;
+            }
+        }
+    }
+    else if (strcmp(command, "rqstat") == 0) {
+        task_cpu_stats_t stats;
+        fb_print("CPU  queued  tasks  steals  stolen  attempts\n");
+        for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (!task_get_cpu_stats(cpu, &stats)) {
+                continue;
+            }
+            fb_print_uint(cpu);
+            fb_print("  "); fb_print_uint(stats.queued);
+            fb_print("  "); fb_print_uint(stats.tasks);
+            fb_print("  "); fb_print_uint(stats.steals);
+            fb_print("  "); fb_print_uint(stats.stolen);
+            fb_print("  "); fb_print_uint(stats.steal_attempts);
+            fb_print("\n");
+        }
+    }
+    else if (strcmp(command, "irqinfo") == 0 && argc == 3) {
+        // 'irqinfo <irq> <cpu>': route an ISA IRQ to another CPU
+        uint64_t irq, cpu;
+        if (!shell_parse_uint(argv[1], &irq) || !shell_parse_uint(argv[2], &cpu) || irq >= 16) {
+            fb_print("usage: irqinfo [irq cpu]\n");
+        } else if (!irq_set_cpu((uint8_t)irq, (unsigned int)cpu)) {
+            fb_print("irqinfo: no I/O APIC, or that CPU is not online\n");
+        } else {
+            fb_print("IRQ "); fb_print_uint(irq);
+            fb_print(" now goes to CPU "); fb_print_uint(cpu); fb_print("\n");
+        }
+    }
+    else if (strcmp(command, "irqinfo") == 0) {
+        if (!irq_uses_apic()) {
+            fb_print("IRQs: 8259 PIC (no I/O APIC)\n");
+        } else {
+            static const char* irq_names[] = { "timer", "keyboard" };
+            fb_print("IRQs: I/O APIC\n");
+            fb_print("IRQ  GSI  vector  APIC ID  mode\n");
+            for (uint8_t irq = 0; irq < 2; irq++) {
+                ioapic_route_t route;
+                if (!ioapic_get_isa_route(irq, &route)) {
+                    continue;
+                }
+                fb_print_uint(irq);
+                fb_print("  "); fb_print_uint(route.gsi);
+                fb_print("  "); fb_print_uint(route.vector);
+                fb_print("  "); fb_print_uint(route.apic_id);
+                fb_print(route.level ? "  level" : "  edge");
+                fb_print(route.active_low ? "/low" : "/high");
+                fb_print(route.masked ? " masked (" : " (");
+                fb_print(irq_names[irq]);
+                fb_print(")\n");
+            }
+        }
+    }
+    else if (strcmp(command, "wakeups") == 0) {
+        if (wakeups_running) {
+            fb_print("wakeups: already running\n");
+        } else {
+            wakeups_running = true;
+            if (create_task_on(wakeups_task, 0) == NULL) {
+                fb_print("wakeups: out of memory\n");
+                wakeups_running = false;
+            }
+        }
+    }
+    else if (strcmp(command, "fpustat") == 0) {
+        static const char* mode_names[] = { "FXSAVE", "XSAVE", "XSAVEOPT" };
+        fpu_info_t info;
+        fpu_get_info(&info);
+        fb_print("FPU state: "); fb_print(mode_names[info.mode]);
+        fb_print(", XCR0 "); fb_print_hex(info.xcr0);
+        fb_print(", "); fb_print_uint(info.area_size);
+        fb_print(" bytes per task\n");
+        fb_print("  #NM traps: "); fb_print_uint(info.traps);
+        fb_print(", restores: "); fb_print_uint(info.restores);
+        fb_print(", saves: "); fb_print_uint(info.saves);
+        fb_print(", saved for handlers: "); fb_print_uint(info.irq_saves);
+        fb_print("\n");
+    }
+    else if (strcmp(command, "spawnbench") == 0) {
+        if (spawnbench_running) {
+            fb_print("spawnbench: already running\n");
+        } else {
+            spawnbench_running = true;
+            if (create_task(spawnbench_task) == NULL) {
+                fb_print("spawnbench: out of memory\n");
+                spawnbench_running = false;
+            }
+        }
     }
     else if (strcmp(command, "ktest") == 0) {
         fb_print("Testing kernel heap (kmalloc)...\n");
@@ -83,16 +819,172 @@ static void shell_execute(const char* command) {
         void* a3 = kmalloc(30);
         fb_print("  Allocated at: "); fb_print_hex((uint64_t)a3); fb_print("\n");
 
-        fb_print("  Freeing a2 and a3...\n");
+        fb_print("  Allocating 10000 bytes (a4)...\n");
+        void* a4 = kmalloc(10000);
+        fb_print("  Allocated at: "); fb_print_hex((uint64_t)a4); fb_print("\n");
+
+        fb_print("  Growing a4 to 20000 bytes with krealloc...\n");
+        void* a5 = krealloc(a4, 20000);
+        fb_print("  Now at: "); fb_print_hex((uint64_t)a5);
+        fb_print(a5 == a4 ? " (grown in place)\n" : " (moved)\n");
+
+        fb_print("  Freeing a2, a3 and a4...\n");
         kfree(a2);
         kfree(a3);
+        kfree(a5 != NULL ? a5 : a4);
 
         fb_print("Heap test complete.\n");
     }
+    else if (strcmp(command, "heapbench") == 0) {
+        heap_bench_result_t result;
+        heap_benchmark(&result);
+        fb_print("Heap trace replay (");
+        fb_print_uint(result.ops);
+        fb_print(" mixed-size kmalloc/kfree):\n  ");
+        fb_print_uint(result.ns_per_op);
+        fb_print(" ns/op (");
+        fb_print_uint(result.cycles_per_op);
+        fb_print(" cycles)\n  peak live: ");
+        fb_print_uint(result.peak_requested / 1024);
+        fb_print(" KiB requested, ");
+        fb_print_uint(result.peak_bytes / 1024);
+        fb_print(" KiB of pages\n");
+#ifdef HEAP_TRACE
+        fb_print("  (allocation tracing is on and included in these numbers)\n");
+#endif
+
+    }
+    else if (strcmp(command, "heapmt") == 0) {
+        if (heapmt_start()) {
+            fb_print("Running heap benchmark tasks, results follow...\n");
+        } else {
+            fb_print("heapmt: already running or out of memory\n");
+        }
+    }
+    else if (strcmp(command, "heapstat") == 0) {
+        heap_stats_t stats;
+        heap_get_stats(&stats);
+        fb_print("Kernel heap:\n  pages held: ");
+        fb_print_uint(stats.pages);
+        fb_print(" (peak ");
+        fb_print_uint(stats.peak_pages);
+        fb_print("), kmalloc/kfree calls: ");
+        fb_print_uint(stats.allocs);
+        fb_print("/");
+        fb_print_uint(stats.frees);
+        fb_print("\n  arena: ");
+        fb_print_uint(stats.arena_chunks);
+        fb_print(" chunks, ");
+        fb_print_uint(stats.arena_bytes / 1024);
+        fb_print(" KiB, ");
+        fb_print_uint(stats.free_bytes / 1024);
+        fb_print(" KiB free in ");
+        fb_print_uint(stats.free_blocks);
+        fb_print(" blocks, largest ");
+        fb_print_uint(stats.largest_free / 1024);
+        fb_print(" KiB\n  fragmentation: ");
+        // Share of free memory not usable by one request of the largest size
+        fb_print_uint(stats.free_bytes ? 100 - (stats.largest_free * 100) / stats.free_bytes : 0);
+        fb_print("%\n");
+    }
+#ifdef HEAP_TRACE
+    else if (strcmp(command, "heaptop") == 0) {
+        heap_trace_site_t* sites = (heap_trace_site_t*)arena_alloc(scratch, 16 * sizeof(heap_trace_site_t));
+        heap_trace_stats_t trace;
+        heap_trace_get_stats(&trace);
+        unsigned int count = (sites != NULL) ? heap_trace_top_sites(sites, 16) : 0;
+
+        fb_print("Live kmalloc memory by call site (");
+        fb_print_uint(trace.blocks);
+        fb_print(" blocks, ");
+        fb_print_uint(trace.bytes);
+        fb_print(" bytes");
+        if (trace.dropped > 0) {
+            fb_print(", ");
+            fb_print_uint(trace.dropped);
+            fb_print(" not recorded");
+        }
+        fb_print("):\n  caller              bytes  blocks\n");
+        for (unsigned int i = 0; i < count; i++) {
+            fb_print("  ");
+            fb_print_hex(sites[i].caller);
+            fb_print("  ");
+            fb_print_uint(sites[i].bytes);
+            fb_print("  ");
+            fb_print_uint(sites[i].blocks);
+            fb_print("\n");
+        }
+    }
+    else if (strcmp(command, "heapmark") == 0) {
+        fb_print("Heap mark set at tick ");
+        fb_print_uint(heap_trace_mark());
+        fb_print("; 'heapleaks' lists what is allocated from now on and not freed\n");
+    }
+    else if (strcmp(command, "heapleaks") == 0) {
+        heap_trace_block_t* blocks = (heap_trace_block_t*)arena_alloc(scratch, 32 * sizeof(heap_trace_block_t));
+        heap_trace_stats_t totals;
+        unsigned int count = (blocks != NULL) ? heap_trace_since_mark(blocks, 32, &totals) : 0;
+
+        fb_print("Live blocks allocated since the mark: ");
+        fb_print_uint(totals.blocks);
+        fb_print(" (");
+        fb_print_uint(totals.bytes);
+        fb_print(" bytes)\n");
+        if (count > 0) {
+            fb_print("  address             size  caller              age (ticks)\n");
+        }
+        for (unsigned int i = 0; i < count; i++) {
+            fb_print("  ");
+            fb_print_hex(blocks[i].ptr);
+            fb_print("  ");
+            fb_print_uint(blocks[i].size);
+            fb_print("  ");
+            fb_print_hex(blocks[i].caller);
+            fb_print("  ");
+            fb_print_uint(blocks[i].age);
+            fb_print("\n");
+        }
+        if (totals.blocks > count) {
+            fb_print("  ...\n");
+        }
+    }
+#else
+    else if (strcmp(command, "heaptop") == 0 || strcmp(command, "heapmark") == 0 ||
+             strcmp(command, "heapleaks") == 0) {
+        fb_print("Allocation tracing is not built in (build with HEAP_TRACE=1)\n");
+    }
+#endif
+    else if (strcmp(command, "slabinfo") == 0) {
+        fb_print("Object caches:\n");
+        fb_print("  name            objsize  active/total  slabs  pages/slab  cached  remote\n");
+        for (kmem_cache_t* cache = kmem_cache_next(NULL); cache != NULL; cache = kmem_cache_next(cache)) {
+            kmem_cache_info_t info;
+            kmem_cache_get_info(cache, &info);
+            fb_print("  ");
+            fb_print(info.name);
+            for (size_t pad = strlen(info.name); pad < 16; pad++) {
+                fb_putchar(' ');
+            }
+            fb_print_uint(info.size);
+            fb_print("  ");
+            fb_print_uint(info.active);
+            fb_print("/");
+            fb_print_uint(info.total);
+            fb_print("  ");
+            fb_print_uint(info.slabs);
+            fb_print("  ");
+            fb_print_uint(info.pages_per_slab);
+            fb_print("  ");
+            fb_print_uint(info.cached);
+            fb_print("  ");
+            fb_print_uint(info.remote);
+            fb_print("\n");
+        }
+    }
     else if (strcmp(command, "uptime") == 0) {
         uint64_t current_ticks = get_ticks();
-        uint64_t seconds = current_ticks / 100;
-        uint64_t centiseconds = current_ticks % 100;
+        uint64_t seconds = current_ticks / TIMER_HZ;
+        uint64_t centiseconds = (current_ticks % TIMER_HZ) * 100 / TIMER_HZ;
         fb_print("Uptime: ");
         fb_print_uint(seconds);
         fb_print(".");
@@ -124,19 +1016,26 @@ static void shell_execute(const char* command) {
         tar_list_files();
     }
     else if (strcmp(command, "cat") == 0) {
-        fb_print("Reading from initrd/hello.txt...\n");
+        const char* name = (argc > 1) ? argv[1] : "hello.txt";
+        fb_print("Reading from initrd/");
+        fb_print(name);
+        fb_print("...\n");
         
-        char* content = (char*)tar_lookup("hello.txt");
+        char* content = (char*)tar_lookup(name);
         
         if (content != NULL) {
-            fb_print("Content of hello.txt:\n");
+            fb_print("Content of ");
+            fb_print(name);
+            fb_print(":\n");
             fb_print(content);
             fb_print("\n");
         } else {
-            fb_print("ERROR: Could not find hello.txt!\n");
+            fb_print("ERROR: Could not find ");
+            fb_print(name);
+            fb_print("!\n");
         }
     }
-    else if (strcmp(command, "") == 0) {
+    else if (argc == 0) {
         // Do nothing
     }
     else {
@@ -149,6 +1048,11 @@ static void shell_execute(const char* command) {
 // --- Public Functions ---
 
 void kshell_init(void) {
+    scratch = arena_create(SHELL_SCRATCH_SIZE);
+    if (scratch == NULL) {
+        serial_write_string("ERROR: kshell could not create its scratch arena\n");
+    }
+
     // Print the initial prompt
     fb_print("> ");
 }
@@ -159,6 +1063,9 @@ void kshell_process_char(char c) {
         fb_putchar('\n');
         line_buffer[buffer_index] = '\0'; // Null-terminate
         shell_execute(line_buffer);      // Process command
+        if (scratch != NULL) {
+            arena_reset(scratch);          // Drop the command's scratch data
+        }
         buffer_index = 0;                  // Reset buffer
         fb_print("> ");                    // Print new prompt
     }
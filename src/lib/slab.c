@@ -0,0 +1,483 @@
+#include "slab.h"
+#include "heap.h"       // For heap_account_pages()
+#include "pmm.h"
+#include "paging.h"     // For PHYS_TO_VIRT
+#include "string.h"
+#include "cpu.h"
+#include <stddef.h>
+
+// A slab: 2^order naturally aligned pages. The header sits at the start,
+// followed by a stack of free object indices, followed by the objects.
+// Keeping the free list outside the objects leaves them constructed.
+typedef struct slab {
+    struct slab* next;          // Neighbours in the cache's partial or full list
+    struct slab* prev;
+    kmem_cache_t* cache;        // The cache this slab belongs to
+    uint32_t cpu;               // Home CPU: frees elsewhere go to its remote list
+    uint32_t inuse;             // Objects handed out
+    uint32_t free_count;        // Entries in free_index[]
+    uint16_t free_index[];      // Indices of the free objects
+} slab_t;
+
+// Slabs get big enough to hold this many objects (up to SLAB_MAX_ORDER)
+#define SLAB_MIN_OBJECTS 8
+#define SLAB_MAX_ORDER   3
+
+// All caches, newest first
+static kmem_cache_t* cache_list = NULL;
+static spinlock_t cache_list_lock = SPINLOCK_INIT;
+
+// Descriptors for caches made by kmem_cache_create()
+static kmem_cache_t cache_cache;
+static bool cache_cache_ready = false;
+
+// --- Geometry ---
+
+static size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+// Where objects start in a slab holding `count` of them
+static uint32_t objects_offset(uint32_t count, size_t align) {
+    return align_up(sizeof(slab_t) + count * sizeof(uint16_t), align);
+}
+
+// How many objects of `size` fit in a slab of `bytes`
+static uint32_t objects_per_slab(size_t bytes, size_t size, size_t align) {
+    uint32_t count = bytes / size;
+    while (count > 0 && objects_offset(count, align) + count * size > bytes) {
+        count--;
+    }
+    return count;
+}
+
+// --- Page Tagging ---
+
+/**
+ * @brief Tags every page of a slab so kmem_cache_of() can find the slab
+ * head from any object: owner says "slab", order gives the slab size.
+ */
+static void tag_block(void* phys, unsigned int order, uint8_t owner) {
+    page_t* page = pmm_phys_to_page((uint64_t)phys);
+    for (uint64_t i = 0; i < (1ull << order); i++) {
+        page[i].owner = owner;
+        page[i].order = (owner == PAGE_OWNER_NONE) ? 0 : order;
+    }
+}
+
+// --- Slab Lists ---
+
+static void slab_list_push(slab_t** head, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_remove(slab_t** head, slab_t* slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/**
+ * @brief Gets a new slab from the PMM and constructs its objects.
+ */
+static slab_t* slab_create(kmem_cache_t* cache) {
+    void* phys = pmm_alloc_pages(cache->order);
+    if (phys == NULL) {
+        return NULL;
+    }
+    tag_block(phys, cache->order, PAGE_OWNER_SLAB);
+    heap_account_pages(1ll << cache->order);
+
+    slab_t* slab = (slab_t*)PHYS_TO_VIRT(phys);
+    slab->cache = cache;
+    slab->cpu = cpu_id();
+    slab->inuse = 0;
+    slab->free_count = cache->objects_per_slab;
+
+    // Hand objects out in address order: the stack top is index 0
+    uint8_t* objects = (uint8_t*)slab + cache->objects_offset;
+    for (uint32_t i = 0; i < cache->objects_per_slab; i++) {
+        slab->free_index[i] = cache->objects_per_slab - 1 - i;
+        if (cache->ctor != NULL) {
+            cache->ctor(objects + i * cache->size);
+        }
+    }
+
+    cache->slabs++;
+    return slab;
+}
+
+static void slab_destroy(slab_t* slab) {
+    kmem_cache_t* cache = slab->cache;
+    void* phys = (void*)VIRT_TO_PHYS(slab);
+    cache->slabs--;
+    heap_account_pages(-(1ll << cache->order));
+    tag_block(phys, cache->order, PAGE_OWNER_NONE);
+    pmm_free_pages(phys, cache->order);
+}
+
+static slab_t* slab_of(kmem_cache_t* cache, const void* obj) {
+    uint64_t slab_size = PAGE_SIZE << cache->order;
+    return (slab_t*)((uint64_t)obj & ~(slab_size - 1));
+}
+
+// --- Slab Layer (cache->lock held) ---
+
+/**
+ * @brief Takes one object out of the cache's slabs, creating a slab if
+ * none has room. An empty slab moves to the CPU taking from it.
+ */
+static void* slab_take(kmem_cache_t* cache) {
+    slab_t* slab = cache->partial;
+    if (slab == NULL) {
+        slab = slab_create(cache);
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab_list_push(&cache->partial, slab);
+    } else if (slab->inuse == 0) {
+        cache->empty_slabs--;
+        slab->cpu = cpu_id();
+    }
+
+    uint16_t index = slab->free_index[--slab->free_count];
+    slab->inuse++;
+    cache->active++;
+
+    if (slab->free_count == 0) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    return (uint8_t*)slab + cache->objects_offset + index * cache->size;
+}
+
+/**
+ * @brief Puts one object back into its slab.
+ */
+static void slab_give(kmem_cache_t* cache, void* obj) {
+    slab_t* slab = slab_of(cache, obj);
+    uint16_t index = ((uint8_t*)obj - ((uint8_t*)slab + cache->objects_offset)) / cache->size;
+
+    if (slab->free_count == 0) {
+        // Was full: it has room again
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    slab->free_index[slab->free_count++] = index;
+    slab->inuse--;
+    cache->active--;
+
+    if (slab->inuse == 0) {
+        // Keep one empty slab per cache to absorb alloc/free ping-pong
+        if (cache->empty_slabs > 0) {
+            slab_list_remove(&cache->partial, slab);
+            slab_destroy(slab);
+        } else {
+            cache->empty_slabs++;
+        }
+    }
+}
+
+// --- Magazine Layer (interrupts off, on the owning CPU) ---
+
+/**
+ * @brief Pushes an object onto a CPU's remote list. Lock-free and safe
+ * from any CPU; the link is stored in the object's first word.
+ */
+static void remote_push(kmem_cpu_cache_t* cpu, void* obj) {
+    void* head = __atomic_load_n(&cpu->remote, __ATOMIC_RELAXED);
+    do {
+        *(void**)obj = head;
+    } while (!__atomic_compare_exchange_n(&cpu->remote, &head, obj, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&cpu->remote_frees, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Takes everything other CPUs freed to this CPU. Objects fill the
+ * magazine; the rest go back to their slabs.
+ */
+static void remote_drain(kmem_cache_t* cache, kmem_cpu_cache_t* cpu) {
+    // Only the owner takes from the list, and it takes all of it at once,
+    // so pushes racing with us cannot cause ABA problems.
+    void* list = __atomic_exchange_n(&cpu->remote, NULL, __ATOMIC_ACQUIRE);
+    bool locked = false;
+
+    while (list != NULL) {
+        void* obj = list;
+        list = *(void**)obj;
+        if (cache->ctor != NULL) {
+            cache->ctor(obj); // The link clobbered its constructed state
+        }
+
+        if (cpu->count < KMEM_MAGAZINE_SIZE) {
+            cpu->objects[cpu->count++] = obj;
+        } else {
+            if (!locked) {
+                spin_lock(&cache->lock);
+                locked = true;
+            }
+            slab_give(cache, obj);
+        }
+    }
+    if (locked) {
+        spin_unlock(&cache->lock);
+    }
+}
+
+/**
+ * @brief Refills an empty magazine: first from the remote list, then with
+ * half a magazine from the slabs (one lock round-trip per batch).
+ */
+static void magazine_refill(kmem_cache_t* cache, kmem_cpu_cache_t* cpu) {
+    if (__atomic_load_n(&cpu->remote, __ATOMIC_RELAXED) != NULL) {
+        remote_drain(cache, cpu);
+        if (cpu->count > 0) {
+            return;
+        }
+    }
+
+    spin_lock(&cache->lock);
+    while (cpu->count < KMEM_MAGAZINE_SIZE / 2) {
+        void* obj = slab_take(cache);
+        if (obj == NULL) {
+            break;
+        }
+        cpu->objects[cpu->count++] = obj;
+    }
+    spin_unlock(&cache->lock);
+}
+
+/**
+ * @brief Returns magazine objects to the slabs until `keep` are left.
+ */
+static void magazine_flush(kmem_cache_t* cache, kmem_cpu_cache_t* cpu, uint32_t keep) {
+    spin_lock(&cache->lock);
+    while (cpu->count > keep) {
+        slab_give(cache, cpu->objects[--cpu->count]);
+    }
+    spin_unlock(&cache->lock);
+    if (cpu->count < cpu->low) {
+        cpu->low = cpu->count;
+    }
+}
+
+/**
+ * @brief Returns the `idle` objects at the bottom of the magazine to the
+ * slabs. Allocation pops from the top, so these are the ones that have
+ * gone unused longest; the cache-hot top is kept.
+ */
+static void magazine_trim(kmem_cache_t* cache, kmem_cpu_cache_t* cpu, uint32_t idle) {
+    spin_lock(&cache->lock);
+    for (uint32_t i = 0; i < idle; i++) {
+        slab_give(cache, cpu->objects[i]);
+    }
+    spin_unlock(&cache->lock);
+
+    cpu->count -= idle;
+    for (uint32_t i = 0; i < cpu->count; i++) {
+        cpu->objects[i] = cpu->objects[i + idle];
+    }
+}
+
+// --- Public Functions ---
+
+bool kmem_cache_init(kmem_cache_t* cache, const char* name, size_t size,
+                     size_t align, void (*ctor)(void* obj)) {
+    if (align == 0) {
+        align = KMEM_CACHE_LINE;
+    }
+    if (size == 0 || (align & (align - 1)) != 0) {
+        return false;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    size_t len = strlen(name);
+    if (len >= KMEM_NAME_LEN) {
+        len = KMEM_NAME_LEN - 1;
+    }
+    memcpy(cache->name, name, len);
+
+    cache->object_size = size;
+    cache->align = align;
+    cache->size = align_up(size, align);
+    cache->ctor = ctor;
+
+    cache->order = 0;
+    while (cache->order < SLAB_MAX_ORDER &&
+           objects_per_slab(PAGE_SIZE << cache->order, cache->size, align) < SLAB_MIN_OBJECTS) {
+        cache->order++;
+    }
+    cache->objects_per_slab = objects_per_slab(PAGE_SIZE << cache->order, cache->size, align);
+    if (cache->objects_per_slab == 0) {
+        return false;
+    }
+    cache->objects_offset = objects_offset(cache->objects_per_slab, align);
+    cache->lock = (spinlock_t)SPINLOCK_INIT;
+
+    uint64_t irq = spin_lock_irqsave(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    spin_unlock_irqrestore(&cache_list_lock, irq);
+    return true;
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align,
+                                void (*ctor)(void* obj)) {
+    if (!cache_cache_ready) {
+        if (!kmem_cache_init(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0, NULL)) {
+            return NULL;
+        }
+        cache_cache_ready = true;
+    }
+
+    kmem_cache_t* cache = (kmem_cache_t*)kmem_cache_alloc(&cache_cache);
+    if (cache == NULL) {
+        return NULL;
+    }
+    if (!kmem_cache_init(cache, name, size, align, ctor)) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+    return cache;
+}
+
+bool kmem_cache_destroy(kmem_cache_t* cache) {
+    // The cache must be idle, so every CPU's front end can be emptied here
+    uint64_t irq = irq_save();
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        remote_drain(cache, &cache->cpu[i]);
+        magazine_flush(cache, &cache->cpu[i], 0);
+    }
+    irq_restore(irq);
+
+    irq = spin_lock_irqsave(&cache->lock);
+    if (cache->active != 0) {
+        spin_unlock_irqrestore(&cache->lock, irq);
+        return false;
+    }
+    while (cache->partial != NULL) {
+        slab_t* slab = cache->partial;
+        slab_list_remove(&cache->partial, slab);
+        slab_destroy(slab);
+    }
+    spin_unlock_irqrestore(&cache->lock, irq);
+
+    irq = spin_lock_irqsave(&cache_list_lock);
+    kmem_cache_t** link = &cache_list;
+    while (*link != NULL && *link != cache) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        *link = cache->next;
+    }
+    spin_unlock_irqrestore(&cache_list_lock, irq);
+
+    if (kmem_cache_of(cache) == &cache_cache) {
+        kmem_cache_free(&cache_cache, cache);
+    }
+    return true;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    uint64_t irq = irq_save();
+    kmem_cpu_cache_t* cpu = &cache->cpu[cpu_id()];
+
+    if (cpu->count == 0) {
+        magazine_refill(cache, cpu);
+    }
+    void* obj = NULL;
+    if (cpu->count > 0) {
+        obj = cpu->objects[--cpu->count];
+        if (cpu->count < cpu->low) {
+            cpu->low = cpu->count;
+        }
+    }
+
+    irq_restore(irq);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj) {
+    slab_t* slab = slab_of(cache, obj);
+
+    uint64_t irq = irq_save();
+    unsigned int id = cpu_id();
+
+    if (slab->cpu != id) {
+        // Not ours: hand it to the home CPU without touching any lock
+        remote_push(&cache->cpu[slab->cpu], obj);
+    } else {
+        kmem_cpu_cache_t* cpu = &cache->cpu[id];
+        if (cpu->count == KMEM_MAGAZINE_SIZE) {
+            magazine_flush(cache, cpu, KMEM_MAGAZINE_SIZE / 2);
+        }
+        cpu->objects[cpu->count++] = obj;
+    }
+
+    irq_restore(irq);
+}
+
+void kmem_cache_reap(void) {
+    uint64_t irq = spin_lock_irqsave(&cache_list_lock);
+    unsigned int id = cpu_id();
+    for (kmem_cache_t* cache = cache_list; cache != NULL; cache = cache->next) {
+        kmem_cpu_cache_t* cpu = &cache->cpu[id];
+        if (__atomic_load_n(&cpu->remote, __ATOMIC_RELAXED) != NULL) {
+            remote_drain(cache, cpu);
+        }
+        // Objects below the low-water mark were not needed at any point
+        // since the last reap: give those back and keep the working set
+        if (cpu->low > 0) {
+            magazine_trim(cache, cpu, cpu->low);
+        }
+        cpu->low = cpu->count;
+    }
+    spin_unlock_irqrestore(&cache_list_lock, irq);
+}
+
+kmem_cache_t* kmem_cache_of(const void* obj) {
+    page_t* page = pmm_phys_to_page(VIRT_TO_PHYS(obj));
+    if (page == NULL || page->owner != PAGE_OWNER_SLAB) {
+        return NULL;
+    }
+    uint64_t slab_size = PAGE_SIZE << page->order;
+    return ((slab_t*)((uint64_t)obj & ~(slab_size - 1)))->cache;
+}
+
+kmem_cache_t* kmem_cache_next(kmem_cache_t* cache) {
+    return (cache == NULL) ? cache_list : cache->next;
+}
+
+void kmem_cache_get_info(kmem_cache_t* cache, kmem_cache_info_t* info) {
+    // Magazine counts are read without their CPUs' cooperation: a snapshot
+    uint64_t cached = 0;
+    uint64_t remote = 0;
+    for (unsigned int i = 0; i < MAX_CPUS; i++) {
+        cached += __atomic_load_n(&cache->cpu[i].count, __ATOMIC_RELAXED);
+        remote += __atomic_load_n(&cache->cpu[i].remote_frees, __ATOMIC_RELAXED);
+    }
+
+    uint64_t irq = spin_lock_irqsave(&cache->lock);
+    info->name = cache->name;
+    info->object_size = cache->object_size;
+    info->size = cache->size;
+    info->active = (cache->active > cached) ? cache->active - cached : 0;
+    info->cached = cached;
+    info->remote = remote;
+    info->slabs = cache->slabs;
+    info->total = (uint64_t)cache->slabs * cache->objects_per_slab;
+    info->pages_per_slab = 1u << cache->order;
+    spin_unlock_irqrestore(&cache->lock, irq);
+}
@@ -0,0 +1,137 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+#include "cpu.h"      // For MAX_CPUS
+
+// Default alignment for typed caches: one cache line, so objects used
+// by different CPUs never share a line.
+#define KMEM_CACHE_LINE 64
+
+// Longest cache name kept (including the terminator)
+#define KMEM_NAME_LEN 24
+
+// Objects each CPU keeps cached per object cache
+#define KMEM_MAGAZINE_SIZE 16
+
+struct slab;
+
+// One CPU's front end for a cache. Only that CPU touches `objects` and
+// `count` (with interrupts off); other CPUs only push to `remote`.
+typedef struct {
+    void* objects[KMEM_MAGAZINE_SIZE]; // Loaded magazine, used as a stack
+    uint32_t count;
+    uint32_t low;                      // Fewest objects held since the last reap
+    void* remote;                      // Lock-free list of objects freed elsewhere
+    uint64_t remote_frees;             // Objects other CPUs pushed here
+} __attribute__((aligned(KMEM_CACHE_LINE))) kmem_cpu_cache_t;
+
+// An object cache: slabs of equal, pre-constructed objects.
+// Objects handed back with kmem_cache_free() must be in their
+// constructed state again; the constructor only runs when a slab is
+// created (or when an object comes back through a remote-free list,
+// whose link overwrites its first word), not on every allocation.
+//
+// Each slab belongs to the CPU that created it. Frees on that CPU go to
+// its magazine; frees on other CPUs are pushed onto the owner's remote
+// list without taking a lock, and the owner collects them when its
+// magazine runs dry.
+typedef struct kmem_cache {
+    char name[KMEM_NAME_LEN];
+    size_t object_size;         // Size requested at creation
+    size_t size;                // Object stride (object_size rounded to align)
+    size_t align;
+    void (*ctor)(void* obj);    // Constructor, or NULL
+    unsigned int order;         // Slabs are 2^order pages
+    uint32_t objects_per_slab;
+    uint32_t objects_offset;    // Where the objects start in a slab
+    struct slab* partial;       // Slabs with at least one free object
+    struct slab* full;          // Slabs with none
+    uint32_t empty_slabs;       // Completely free slabs kept on `partial`
+    uint32_t slabs;             // Slabs owned by this cache
+    uint64_t active;            // Objects handed out
+    spinlock_t lock;            // Guards the slab lists and counters above
+    struct kmem_cache* next;    // All caches, for kmem_cache_next()
+    kmem_cpu_cache_t cpu[MAX_CPUS];
+} kmem_cache_t;
+
+// A snapshot of one cache's counters, see kmem_cache_get_info()
+typedef struct {
+    const char* name;
+    size_t object_size;
+    size_t size;
+    uint64_t active;   // Objects in use
+    uint64_t cached;   // Objects sitting in CPU magazines
+    uint64_t remote;   // Objects freed through remote lists so far
+    uint64_t total;    // Objects in all slabs
+    uint64_t slabs;
+    unsigned int pages_per_slab;
+} kmem_cache_info_t;
+
+/**
+ * @brief Creates an object cache.
+ * @param name Shown by the 'slabinfo' shell command (copied).
+ * @param size Object size in bytes.
+ * @param align Object alignment (power of two); 0 means KMEM_CACHE_LINE.
+ * @param ctor Called once per object when its slab is created, or NULL.
+ * @return The cache, or NULL if the object cannot fit a slab or memory ran out.
+ */
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align,
+                                void (*ctor)(void* obj));
+
+/**
+ * @brief Sets up a cache in caller-provided storage (for caches needed
+ * before kmem_cache_create() works, like the kmalloc size classes).
+ * @return false if the object cannot fit a slab.
+ */
+bool kmem_cache_init(kmem_cache_t* cache, const char* name, size_t size,
+                     size_t align, void (*ctor)(void* obj));
+
+/**
+ * @brief Frees all slabs of an empty cache and the cache itself.
+ * CPU magazines and remote lists are emptied first.
+ * @return false (and the cache is kept) if objects are still in use.
+ */
+bool kmem_cache_destroy(kmem_cache_t* cache);
+
+/**
+ * @brief Takes a constructed object from the cache.
+ * @return The object, or NULL if out of memory.
+ */
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+/**
+ * @brief Returns an object to its cache. Safe to call on any CPU: objects
+ * from another CPU's slabs go back through that CPU's remote list.
+ */
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+
+/**
+ * @brief Trims this CPU's magazines in all caches. Cached objects pin
+ * their slabs, so the idle loop calls this now and then to let empty
+ * slabs go back to the PMM. Only objects that sat in a magazine through
+ * the whole interval since the last reap are returned; the working set
+ * stays cached.
+ */
+void kmem_cache_reap(void);
+
+/**
+ * @brief Returns the cache an object was allocated from, or NULL if
+ * `obj` does not point into a slab.
+ */
+kmem_cache_t* kmem_cache_of(const void* obj);
+
+/**
+ * @brief Iterates over all caches: pass NULL to get the first one.
+ */
+kmem_cache_t* kmem_cache_next(kmem_cache_t* cache);
+
+/**
+ * @brief Copies a cache's counters into `info`.
+ */
+void kmem_cache_get_info(kmem_cache_t* cache, kmem_cache_info_t* info);
+
+#endif // __SLAB_H__
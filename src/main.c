@@ -14,6 +14,11 @@
 #include "pit.h"
 #include "timer.h"
 #include "task.h"
+#include "fpu.h"
+#include "lapic.h"
+#include "smp.h"
+#include "irq.h"
+#include "tick.h"
 #include "kshell.h"
 #include "tar.h"
 
@@ -57,6 +62,20 @@ module_request = {
     .revision = 0
 };
 
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_rsdp_request
+rsdp_request = {
+    .id = LIMINE_RSDP_REQUEST,
+    .revision = 0
+};
+
+__attribute__((used, section(".limine_requests")))
+static volatile struct limine_smp_request
+smp_request = {
+    .id = LIMINE_SMP_REQUEST,
+    .revision = 0
+};
+
 
 __attribute__((used, section(".limine_requests_start")))
 static volatile LIMINE_REQUESTS_START_MARKER;
@@ -93,6 +112,7 @@ void _start(void) {
 
     // --- 2. Initialize Core CPU Systems ---
     gdt_init();
+    smp_init_bsp(); // Per-CPU data (cpu_id()) from here on
     idt_init();
     pic_remap_and_init();
 
@@ -120,16 +140,34 @@ void _start(void) {
     }
 
     // --- 4. Initialize Memory Systems ---
-    // (VMM must be first to set up the higher-half kernel)
-    vmm_init(); 
+    // (The PMM runs on the bootloader's HHDM; the VMM then builds the
+    // kernel page tables out of PMM pages)
     pmm_init(memmap_request.response);
+    vmm_init();
     heap_init();
+    fpu_init(); // Save areas come from the heap
 
     // --- 5. Initialize Subsystems & Drivers ---
     global_framebuffer = framebuffer_request.response->framebuffers[0];
     fb_init(global_framebuffer);
+    pit_calibrate_tsc();
+
+    // Draw through a write-combining mapping instead of the HHDM
+    void* fb_wc = vmm_map_mmio(VIRT_TO_PHYS(global_framebuffer->address),
+                               global_framebuffer->pitch * global_framebuffer->height,
+                               PTE_CACHE_WC);
+    if (fb_wc != NULL) {
+        fb_set_address(fb_wc);
+    }
+    lapic_init();
+
+    // Device IRQs through the I/O APIC if there is one (else the PIC)
+    irq_init(rsdp_request.response != NULL ? rsdp_request.response->address : NULL);
     task_init();
-    pit_init(100); // Initialize PIT to 100Hz
+    tick_init(); // Tickless with the local APIC timer, else the PIT
+
+    // Bring up the other CPUs; each joins the scheduler on its own
+    smp_init(smp_request.response);
     
     // Load the initrd (RAM disk)
     struct limine_file* initrd = module_request.response->modules[0];
@@ -144,9 +182,8 @@ void _start(void) {
 
     // --- 7. Enable Interrupts & Idle ---
     // All initialization is done. Interrupts can be enabled. The shell
-    // will run in the timer interrupt context.
+    // runs in the keyboard interrupt handler. This context is the
+    // idle task from now on; it zeroes pages while the CPU is idle.
     __asm__ volatile ("sti");
-    for (;;) {
-        __asm__ volatile ("hlt");
-    }
+    task_run_idle();
 }
\ No newline at end of file